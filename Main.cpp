@@ -1,224 +1,405 @@
-//
-// Copyright (C) 2009 Roadkill Software
-//
-// This program is free software; you can redistribute it and/or
-// modify it under the terms of the GNU General Public License
-// as published by the Free Software Foundation; either version 2
-// of the License, or (at your option) any later version.
-//
-// This program is distributed in the hope that it will be useful,
-// but WITHOUT ANY WARRANTY; without even the implied warranty of
-// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
-//
-// See the GNU General Public License for more details.
-//
-// You should have received a copy of the GNU General Public License
-// along with this program; if not, write to the Free Software
-// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
-//
-
-#define WIN32_LEAN_AND_MEAN 1
-#include <windows.h>
-
-#include <Rk/Display.hpp>
-#include <Rk/RenderContext.hpp>
-#include <Rk/OpenGL.hpp>
-
-#include "World.hpp"
-
-static HINSTANCE nt_dll;
-typedef unsigned (*TimerResFn) (unsigned, bool, unsigned*);
-static TimerResFn NtSetTimerResolution;
-
-static HINSTANCE winmm_dll;
-typedef unsigned (*timeGetTimeType) ();
-static timeGetTimeType timeGetTime = 0;
-
-/*static double msec_per_count;
-static rki64 clock_base;*/
-
-/*void clock_reset ()
-{
-  QueryPerformanceCounter ((LARGE_INTEGER*) &clock_base);
-}*/
-
-inline unsigned clock_now ()
-{
-  /*rki64 now;
-  QueryPerformanceCounter ((LARGE_INTEGER*) &now);
-  return double (now - clock_base) * msec_per_count;*/
-  return timeGetTime ();
-}
-
-static void timing_initialize ()
-{
-  nt_dll = LoadLibrary ("ntdll.dll");
-  assert (nt_dll);
-  
-  NtSetTimerResolution = (TimerResFn) GetProcAddress (
-    nt_dll, "NtSetTimerResolution"
-  );
-  assert (NtSetTimerResolution);
-  
-  typedef unsigned (*TimerQueryFn) (unsigned*, unsigned*, unsigned*);
-  
-  TimerQueryFn NtQueryTimerResolution = (TimerQueryFn) GetProcAddress (
-    nt_dll, "NtQueryTimerResolution"
-  );
-  assert (NtQueryTimerResolution);
-  
-  winmm_dll = LoadLibrary ("winmm.dll");
-  assert (winmm_dll);
-  
-  timeGetTime = (timeGetTimeType) GetProcAddress (winmm_dll, "timeGetTime");
-  assert (timeGetTime);
-  
-  unsigned best_res;
-  unsigned worst_res;
-  unsigned dummy;
-  NtQueryTimerResolution (&worst_res, &best_res, &dummy);
-  
-  NtSetTimerResolution (best_res > 10000 ? best_res : 10000, true, &dummy);
-  
-  /*rki64 clock_freq;
-  QueryPerformanceFrequency ((LARGE_INTEGER*) &clock_freq);
-  
-  msec_per_count = 1000.0 / double (clock_freq);*/
-}
-
-static void timing_shutdown ()
-{
-  unsigned dummy;
-  NtSetTimerResolution (0, false, &dummy);
-  FreeLibrary (winmm_dll);
-  FreeLibrary (nt_dll);
-}
-
-//
-// handle_message
-//
-static LRESULT handle_message (Rk::Display* source, unsigned message, WPARAM wp, LPARAM lp)
-{
-  switch (message)
-  {
-    case WM_CLOSE:
-      PostQuitMessage (0);
-    break;
-    
-    case WM_KEYDOWN:
-    break;
-    
-    case WM_KEYUP:
-    break;
-    
-    default:
-      return Rk::display_default_message (source, message, wp, lp);
-  }
-  
-  return 0;
-}
-
-//
-// frame_begin
-//
-static void frame_begin (int w, int h)
-{
-  glViewport (0, 0, w, h);
-  
-  glClearColor (0.5, 0.75, 0.9, 1.0);
-  glClear (GL_COLOR_BUFFER_BIT);
-  
-  glMatrixMode (GL_PROJECTION);
-  glLoadIdentity ();
-  gluPerspective (75.0, float (w) / float (h), 0.1, 100.0);
-  
-  glMatrixMode (GL_MODELVIEW);
-  glLoadIdentity ();
-  gluLookAt (
-    0.0, 0.0, 0.0,
-    1.0, 0.0, 0.0,
-    0.0, 0.0, 1.0
-  );
-  //glTranslatef (-player_x (), -player_y () - player_height () / 2, 0);
-}
-
-//
-// frame_end
-//
-static void frame_end (Rk::RenderContext* context)
-{
-  Rk::rendercontext_flip (context);
-}
-
-//
-// WinMain
-//
-int WINAPI WinMain (HINSTANCE instance, HINSTANCE, LPSTR, int)
-{
-  timing_initialize ();
-  
-  World* world = world_load ("libindoor/Test.indoor");
-  assert (world);
-  
-  PeekMessage (0, 0, 0, 0, PM_NOREMOVE);
-  
-  Rk::display_initialize (instance);
-  Rk::Display* display = Rk::display_create ("Terrain", handle_message, false, 1024, 768);
-  Rk::display_show (display);
-  Rk::RenderContext* render_context = rendercontext_create (display);
-  
-  MSG message;
-  const unsigned frame_rate_hz = 75;
-  const unsigned frame_delay = 1000 / frame_rate_hz;
-  unsigned before = clock_now ();
-  
-  glEnable (GL_CULL_FACE);
-  
-  for (;;)
-  {
-    // Handle messages
-    while (PeekMessage (&message, 0, 0, 0, PM_REMOVE))
-    {
-      if (message.message == WM_QUIT)
-        break;
-      
-      DispatchMessage (&message);
-    }
-    
-    if (message.message == WM_QUIT)
-      break;
-    
-    //
-    // Do stuff
-    //
-    unsigned w, h;
-    display_get_size (display, w, h);
-    
-    frame_begin (w, h);
-      world_render (world, Vector3 (), Vector3 (1, 0, 0));
-    
-    unsigned elapsed = clock_now () - before;
-    while (elapsed < frame_delay)
-    {
-      Sleep (1);
-      elapsed = clock_now () - before;
-    }
-    
-    before += frame_delay;
-    
-    frame_end (render_context);
-  }
-  
-  // Shut down
-  Rk::display_hide (display);
-  
-  Rk::rendercontext_free (render_context);
-  Rk::display_free (display);
-  Rk::display_shutdown ();
-  
-  world_free (world);
-  
-  timing_shutdown ();
-  
-  return 0;
-}
+//
+// Copyright (C) 2009 Roadkill Software
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+
+#define WIN32_LEAN_AND_MEAN 1
+#include <windows.h>
+
+#include <Rk/Display.hpp>
+#include <Rk/RenderContext.hpp>
+#include <Rk/OpenGL.hpp>
+
+#include "World.hpp"
+
+#define world_filename "libindoor/Test.indoor"
+
+// Triangles kept in memory at once, and how near the camera they're loaded
+#define world_page_budget (32u << 20)
+#define world_page_radius 64.0f
+
+// How often to check the world file for a recompile, 0 not to. Watched
+//  files are loaded whole, outside the page budget; see Loader.
+#define world_watch_ms 0
+
+static HINSTANCE nt_dll;
+typedef unsigned (*TimerResFn) (unsigned, bool, unsigned*);
+static TimerResFn NtSetTimerResolution;
+
+static HINSTANCE winmm_dll;
+typedef unsigned (*timeGetTimeType) ();
+static timeGetTimeType timeGetTime = 0;
+
+/*static double msec_per_count;
+static rki64 clock_base;*/
+
+/*void clock_reset ()
+{
+  QueryPerformanceCounter ((LARGE_INTEGER*) &clock_base);
+}*/
+
+inline unsigned clock_now ()
+{
+  /*rki64 now;
+  QueryPerformanceCounter ((LARGE_INTEGER*) &now);
+  return double (now - clock_base) * msec_per_count;*/
+  return timeGetTime ();
+}
+
+static void timing_initialize ()
+{
+  nt_dll = LoadLibrary ("ntdll.dll");
+  assert (nt_dll);
+  
+  NtSetTimerResolution = (TimerResFn) GetProcAddress (
+    nt_dll, "NtSetTimerResolution"
+  );
+  assert (NtSetTimerResolution);
+  
+  typedef unsigned (*TimerQueryFn) (unsigned*, unsigned*, unsigned*);
+  
+  TimerQueryFn NtQueryTimerResolution = (TimerQueryFn) GetProcAddress (
+    nt_dll, "NtQueryTimerResolution"
+  );
+  assert (NtQueryTimerResolution);
+  
+  winmm_dll = LoadLibrary ("winmm.dll");
+  assert (winmm_dll);
+  
+  timeGetTime = (timeGetTimeType) GetProcAddress (winmm_dll, "timeGetTime");
+  assert (timeGetTime);
+  
+  unsigned best_res;
+  unsigned worst_res;
+  unsigned dummy;
+  NtQueryTimerResolution (&worst_res, &best_res, &dummy);
+  
+  NtSetTimerResolution (best_res > 10000 ? best_res : 10000, true, &dummy);
+  
+  /*rki64 clock_freq;
+  QueryPerformanceFrequency ((LARGE_INTEGER*) &clock_freq);
+  
+  msec_per_count = 1000.0 / double (clock_freq);*/
+}
+
+static void timing_shutdown ()
+{
+  unsigned dummy;
+  NtSetTimerResolution (0, false, &dummy);
+  FreeLibrary (winmm_dll);
+  FreeLibrary (nt_dll);
+}
+
+//
+// Loader
+// Loads the world on its own thread so the window opens, and frames keep
+//  coming, while the disk is read. If watching, it loads the file again
+//  each time it is rewritten. A loaded world waits in Ready until the frame
+//  loop swaps it in between frames. The frame loop is the only thing that
+//  draws a world, so once it is between frames the world it swapped out is
+//  no longer in use; it goes back in Retired to be freed here too.
+//
+//  A watched file is loaded whole rather than paged: the compiler rewrites
+//  it in place, under a paged world still reading it.
+//
+struct Loader
+{
+  const char* filename;
+  unsigned watch_ms; // 0 if not watching
+  HANDLE thread;
+  HANDLE wake;       // Set when a world is retired, and to quit
+  
+  // Guarded by lock
+  CRITICAL_SECTION lock;
+  World* ready;
+  World* retired;
+  bool quit;
+  
+};
+
+//
+// loader_thread
+//
+static DWORD WINAPI loader_thread (LPVOID param)
+{
+  Loader* loader = (Loader*) param;
+  
+  // Write times of the file last loaded and as last checked
+  FILETIME loaded = { 0, 0 };
+  FILETIME seen   = { 0, 0 };
+  bool first = true;
+  
+  for (;;)
+  {
+    EnterCriticalSection (&loader -> lock);
+    bool quit = loader -> quit;
+    World* retired = loader -> retired;
+    loader -> retired = 0;
+    LeaveCriticalSection (&loader -> lock);
+    
+    world_free (retired);
+    
+    if (quit)
+      break;
+    
+    // A file still being written changes between checks, so a new one is
+    //  only loaded once it has stayed the same for one
+    FILETIME written = { 0, 0 };
+    WIN32_FILE_ATTRIBUTE_DATA attributes;
+    if (GetFileAttributesEx (loader -> filename, GetFileExInfoStandard, &attributes))
+      written = attributes.ftLastWriteTime;
+    
+    bool changed = CompareFileTime (&written, &loaded) != 0
+                && CompareFileTime (&written, &seen)   == 0;
+    seen = written;
+    
+    if (first || (loader -> watch_ms && changed))
+    {
+      first = false;
+      loaded = written;
+      
+      World* world = loader -> watch_ms
+        ? world_load       (loader -> filename)
+        : world_load_paged (loader -> filename, world_page_budget, world_page_radius);
+      
+      // One not yet swapped in is just replaced
+      if (world)
+      {
+        EnterCriticalSection (&loader -> lock);
+        World* stale = loader -> ready;
+        loader -> ready = world;
+        LeaveCriticalSection (&loader -> lock);
+        
+        world_free (stale);
+      }
+    }
+    
+    WaitForSingleObject (loader -> wake, loader -> watch_ms ? loader -> watch_ms : INFINITE);
+  }
+  
+  return 0;
+}
+
+//
+// loader_start
+//
+static Loader* loader_start (const char* filename, unsigned watch_ms)
+{
+  Loader* loader = new Loader;
+  loader -> filename = filename;
+  loader -> watch_ms = watch_ms;
+  loader -> ready = 0;
+  loader -> retired = 0;
+  loader -> quit = false;
+  
+  InitializeCriticalSection (&loader -> lock);
+  loader -> wake = CreateEvent (0, FALSE, FALSE, 0);
+  loader -> thread = loader -> wake ? CreateThread (0, 0, loader_thread, loader, 0, 0) : 0;
+  
+  if (!loader -> thread)
+  {
+    if (loader -> wake)
+      CloseHandle (loader -> wake);
+    DeleteCriticalSection (&loader -> lock);
+    delete loader;
+    return 0;
+  }
+  
+  return loader;
+}
+
+//
+// loader_stop
+//
+static void loader_stop (Loader* loader)
+{
+  EnterCriticalSection (&loader -> lock);
+  loader -> quit = true;
+  LeaveCriticalSection (&loader -> lock);
+  
+  SetEvent (loader -> wake);
+  WaitForSingleObject (loader -> thread, INFINITE);
+  
+  world_free (loader -> ready);
+  world_free (loader -> retired);
+  
+  CloseHandle (loader -> thread);
+  CloseHandle (loader -> wake);
+  DeleteCriticalSection (&loader -> lock);
+  delete loader;
+}
+
+//
+// loader_swap
+// Called between frames. Returns the world to draw from now on, retiring
+//  Current if it was replaced. Until the last world retired is freed, the
+//  next waits.
+//
+static World* loader_swap (Loader* loader, World* current)
+{
+  EnterCriticalSection (&loader -> lock);
+  
+  World* world = current;
+  if (loader -> ready && !loader -> retired)
+  {
+    world = loader -> ready;
+    loader -> ready = 0;
+    loader -> retired = current;
+  }
+  
+  LeaveCriticalSection (&loader -> lock);
+  
+  if (world != current && current)
+    SetEvent (loader -> wake);
+  
+  return world;
+}
+
+//
+// handle_message
+//
+static LRESULT handle_message (Rk::Display* source, unsigned message, WPARAM wp, LPARAM lp)
+{
+  switch (message)
+  {
+    case WM_CLOSE:
+      PostQuitMessage (0);
+    break;
+    
+    case WM_KEYDOWN:
+    break;
+    
+    case WM_KEYUP:
+    break;
+    
+    default:
+      return Rk::display_default_message (source, message, wp, lp);
+  }
+  
+  return 0;
+}
+
+//
+// frame_begin
+//
+static void frame_begin (int w, int h)
+{
+  glViewport (0, 0, w, h);
+  
+  glClearColor (0.5, 0.75, 0.9, 1.0);
+  glClear (GL_COLOR_BUFFER_BIT);
+  
+  glMatrixMode (GL_PROJECTION);
+  glLoadIdentity ();
+  gluPerspective (75.0, float (w) / float (h), 0.1, 100.0);
+  
+  glMatrixMode (GL_MODELVIEW);
+  glLoadIdentity ();
+  gluLookAt (
+    0.0, 0.0, 0.0,
+    1.0, 0.0, 0.0,
+    0.0, 0.0, 1.0
+  );
+  //glTranslatef (-player_x (), -player_y () - player_height () / 2, 0);
+}
+
+//
+// frame_end
+//
+static void frame_end (Rk::RenderContext* context)
+{
+  Rk::rendercontext_flip (context);
+}
+
+//
+// WinMain
+//
+int WINAPI WinMain (HINSTANCE instance, HINSTANCE, LPSTR, int)
+{
+  timing_initialize ();
+  
+  Loader* loader = loader_start (world_filename, world_watch_ms);
+  assert (loader);
+  
+  World* world = 0; // Until the loader has one
+  
+  PeekMessage (0, 0, 0, 0, PM_NOREMOVE);
+  
+  Rk::display_initialize (instance);
+  Rk::Display* display = Rk::display_create ("Terrain", handle_message, false, 1024, 768);
+  Rk::display_show (display);
+  Rk::RenderContext* render_context = rendercontext_create (display);
+  
+  MSG message;
+  const unsigned frame_rate_hz = 75;
+  const unsigned frame_delay = 1000 / frame_rate_hz;
+  unsigned before = clock_now ();
+  
+  glEnable (GL_CULL_FACE);
+  
+  for (;;)
+  {
+    // Handle messages
+    while (PeekMessage (&message, 0, 0, 0, PM_REMOVE))
+    {
+      if (message.message == WM_QUIT)
+        break;
+      
+      DispatchMessage (&message);
+    }
+    
+    if (message.message == WM_QUIT)
+      break;
+    
+    //
+    // Do stuff
+    //
+    unsigned w, h;
+    display_get_size (display, w, h);
+    
+    world = loader_swap (loader, world);
+    
+    frame_begin (w, h);
+    if (world)
+      world_render (world, Vector3 (), Vector3 (1, 0, 0));
+    
+    unsigned elapsed = clock_now () - before;
+    while (elapsed < frame_delay)
+    {
+      Sleep (1);
+      elapsed = clock_now () - before;
+    }
+    
+    before += frame_delay;
+    
+    frame_end (render_context);
+  }
+  
+  // Shut down
+  Rk::display_hide (display);
+  
+  Rk::rendercontext_free (render_context);
+  Rk::display_free (display);
+  Rk::display_shutdown ();
+  
+  loader_stop (loader);
+  world_free (world);
+  
+  timing_shutdown ();
+  
+  return 0;
+}
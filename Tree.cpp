@@ -0,0 +1,769 @@
+//
+// Copyright (C) 2009 Roadkill Software
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+
+#include "Tree.hpp"
+
+#include <cassert>
+#include <cstring>
+#include <cfloat>
+
+//
+// node_free
+//
+static void node_free (Node* root, rku32 depth)
+{
+  if (!root)
+    return;
+  
+  Node** stack = new Node* [depth + 1];
+  Node** top = stack;
+  *top++ = root;
+  
+  while (top != stack)
+  {
+    Node* node = *--top;
+    
+    if (node -> front) *top++ = node -> front;
+    if (node -> back ) *top++ = node -> back;
+    
+    delete node;
+  }
+  
+  delete [] stack;
+}
+
+//
+// clusters_free
+//
+static void clusters_free (Cluster* clusters, rku32 count)
+{
+  if (!clusters)
+    return;
+  
+  for (rku32 i = 0; i != count; i++)
+  {
+    delete [] clusters [i].triangles;
+    delete [] clusters [i].arrived;
+  }
+  
+  delete [] clusters;
+}
+
+//
+// lz_get_length
+//
+static bool lz_get_length (const rku8*& in, const rku8* in_end, rku32& length)
+{
+  for (;;)
+  {
+    if (in == in_end)
+      return false;
+    
+    rku8 extra = *in++;
+    length += extra;
+    
+    if (extra != 255)
+      return true;
+  }
+}
+
+//
+// lz_decompress
+// Decodes the compiler's LZ blocks; see libindoor/Lz.hpp. Returns true if
+//  In decodes to exactly Out_size bytes.
+//
+static bool lz_decompress (const rku8* in, rku32 size, rku8* out, rku32 out_size)
+{
+  const rku8* in_end = in + size;
+  rku8* out_begin = out;
+  rku8* out_end = out + out_size;
+  
+  while (in != in_end)
+  {
+    rku8 token = *in++;
+    
+    rku32 literal_count = token >> 4;
+    if (literal_count == 15 && !lz_get_length (in, in_end, literal_count))
+      return false;
+    
+    if (rku32 (in_end - in) < literal_count || rku32 (out_end - out) < literal_count)
+      return false;
+    
+    memcpy (out, in, literal_count);
+    in  += literal_count;
+    out += literal_count;
+    
+    if (in == in_end)
+      break;
+    
+    if (in_end - in < 2)
+      return false;
+    
+    rku32 offset = in [0] | (in [1] << 8);
+    in += 2;
+    
+    rku32 length = token & 15;
+    if (length == 15 && !lz_get_length (in, in_end, length))
+      return false;
+    length += 4;
+    
+    if (offset == 0 || rku32 (out - out_begin) < offset || rku32 (out_end - out) < length)
+      return false;
+    
+    const rku8* from = out - offset;
+    while (length--)
+      *out++ = *from++;
+  }
+  
+  return out == out_end;
+}
+
+//
+// source_close
+//
+void source_close (Source* source)
+{
+  if (!source)
+    return;
+  
+  for (rku32 i = 0; i != source_slots; i++)
+    delete [] source -> slots [i].data;
+  
+  delete [] source -> packed;
+  delete [] source -> packed_starts;
+  delete [] source -> plain_starts;
+  fclose (source -> file);
+  delete source;
+}
+
+//
+// source_open
+//
+Source* source_open (const char* filename)
+{
+  FILE* file = fopen (filename, "rb");
+  if (!file)
+    return 0;
+  
+  Source* source = new Source;
+  source -> file = file;
+  source -> position = 0;
+  source -> block_count = 0;
+  source -> plain_starts = 0;
+  source -> packed_starts = 0;
+  source -> packed = 0;
+  source -> reads = 0;
+  
+  for (rku32 i = 0; i != source_slots; i++)
+  {
+    source -> slots [i].block = ~0u;
+    source -> slots [i].used = 0;
+    source -> slots [i].data = 0;
+  }
+  
+  char magic [8];
+  rku32 header [3]; // Pack format, plain size, block count
+  
+  if (fread (magic, 1, 8, file) != 8 || strncmp (magic, "RKINDPAK", 8))
+  {
+    fseek (file, 0, SEEK_SET);
+    return source;
+  }
+  
+  if (fread (header, 4, 3, file) != 3 || header [0] != 1)
+  {
+    source_close (source);
+    return 0;
+  }
+  
+  rku32 count = header [2];
+  source -> block_count   = count;
+  source -> plain_starts  = new rku32 [count + 1];
+  source -> packed_starts = new rku32 [count + 1];
+  source -> plain_starts  [0] = 0;
+  source -> packed_starts [0] = 20 + count * 8;
+  
+  // Blocks no bigger than the compiler makes, none packed to more than
+  //  they hold, adding up to the plain size
+  bool ok = true;
+  for (rku32 i = 0; i != count && ok; i++)
+  {
+    rku32 sizes [2]; // Plain, packed
+    ok = fread (sizes, 4, 2, file) == 2
+      && sizes [0] <= pack_block_size
+      && sizes [1] <= sizes [0];
+    
+    source -> plain_starts  [i + 1] = source -> plain_starts  [i] + sizes [0];
+    source -> packed_starts [i + 1] = source -> packed_starts [i] + sizes [1];
+  }
+  
+  if (!ok || source -> plain_starts [count] != header [1])
+  {
+    source_close (source);
+    return 0;
+  }
+  
+  source -> packed = new rku8 [pack_block_size];
+  return source;
+}
+
+//
+// source_block
+// Unpacks Block, if it isn't already, and returns its plain bytes.
+//
+static const rku8* source_block (Source* source, rku32 block)
+{
+  source -> reads++;
+  
+  SourceSlot* slot = source -> slots;
+  for (rku32 i = 0; i != source_slots; i++)
+  {
+    SourceSlot& s = source -> slots [i];
+    if (s.block == block)
+    {
+      s.used = source -> reads;
+      return s.data;
+    }
+    
+    if (s.used < slot -> used)
+      slot = &s;
+  }
+  
+  rku32 plain_size  = source -> plain_starts  [block + 1] - source -> plain_starts  [block];
+  rku32 packed_size = source -> packed_starts [block + 1] - source -> packed_starts [block];
+  
+  if (!slot -> data)
+    slot -> data = new rku8 [pack_block_size];
+  
+  slot -> block = ~0u;
+  
+  if (fseek (source -> file, source -> packed_starts [block], SEEK_SET)
+   || fread (source -> packed, 1, packed_size, source -> file) != packed_size)
+  {
+    return 0;
+  }
+  
+  if (packed_size == plain_size)
+    memcpy (slot -> data, source -> packed, plain_size);
+  else if (!lz_decompress (source -> packed, packed_size, slot -> data, plain_size))
+    return 0;
+  
+  slot -> block = block;
+  slot -> used = source -> reads;
+  return slot -> data;
+}
+
+//
+// source_read
+// As fread, returning the number of whole items read.
+//
+rku32 source_read (Source* source, void* data, rku32 size, rku32 count)
+{
+  if (!source -> block_count)
+    return fread (data, size, count, source -> file);
+  
+  rku8* out = (rku8*) data;
+  rku32 wanted = size * count;
+  rku32 got = 0;
+  
+  // Blocks in order, from the one holding the position
+  rku32 low = 0, high = source -> block_count;
+  while (high - low > 1)
+  {
+    rku32 mid = (low + high) / 2;
+    if (source -> plain_starts [mid] <= source -> position)
+      low = mid;
+    else
+      high = mid;
+  }
+  
+  for (rku32 block = low; got != wanted && block != source -> block_count; block++)
+  {
+    if (source -> plain_starts [block + 1] <= source -> position)
+      continue;
+    
+    const rku8* plain = source_block (source, block);
+    if (!plain)
+      break;
+    
+    rku32 offset = source -> position - source -> plain_starts [block];
+    rku32 length = source -> plain_starts [block + 1] - source -> position;
+    if (length > wanted - got)
+      length = wanted - got;
+    
+    memcpy (out + got, plain + offset, length);
+    got += length;
+    source -> position += length;
+  }
+  
+  return got / size;
+}
+
+//
+// source_seek
+//
+bool source_seek (Source* source, rku32 position)
+{
+  if (!source -> block_count)
+    return fseek (source -> file, position, SEEK_SET) == 0;
+  
+  if (position > source -> plain_starts [source -> block_count])
+    return false;
+  
+  source -> position = position;
+  return true;
+}
+
+//
+// Leaf encodings
+//
+#define leaf_floats    0
+#define leaf_quantized 1
+
+//
+// leaf_dequantize
+// Reads a quantized leaf block into Count float triangles: origin and step
+//  for each axis, then 16-bit coordinates along them.
+//
+static bool leaf_dequantize (Source* source, rkf32* triangles, rku32 count)
+{
+  rkf32 origin [3], step [3];
+  if (source_read (source, origin, 4, 3) != 3
+   || source_read (source, step,   4, 3) != 3)
+  {
+    return false;
+  }
+  
+  rku16 coords [9 * 64];
+  
+  while (count)
+  {
+    rku32 batch = count < 64 ? count : 64;
+    if (source_read (source, coords, 18, batch) != batch)
+      return false;
+    
+    for (rku32 i = 0; i != batch * 9; i++)
+      *triangles++ = origin [i % 3] + rkf32 (coords [i]) * step [i % 3];
+    
+    count -= batch;
+  }
+  
+  return true;
+}
+
+//
+// world_load_nodes
+// Reads the node table, stored in pre-order, front before back. Each stack
+//  entry is the slot the next node read belongs in. Empty leaves note where
+//  their triangles are and join their cluster's chain, backwards; see
+//  world_open.
+//
+static Node* world_load_nodes (Source* source, rku32 depth, rku32 plane_count, Cluster* clusters, rku32 cluster_count)
+{
+  Node* root = 0;
+  
+  Node*** stack = new Node** [depth + 1];
+  Node*** top = stack;
+  *top++ = &root;
+  
+  bool ok = true;
+  
+  while (ok && top != stack)
+  {
+    Node** slot = *--top;
+    
+    Node* node = new Node;
+    node -> front   = 0;
+    node -> back    = 0;
+    node -> cluster = 0;
+    node -> cluster_next = 0;
+    *slot = node;
+    
+    if (source_read (source, &node -> contents, 1, 1) != 1)
+    {
+      ok = false;
+    }
+    else if (node -> contents == 255)
+    {
+      // A deeper tree than the header claims is corrupt, as is a plane
+      //  past the end of the table
+      if (source_read (source, &node -> partition, 4, 1) != 1
+       || node -> partition >= plane_count
+       || top + 2 > stack + depth + 1)
+      {
+        ok = false;
+        continue;
+      }
+      
+      *top++ = &node -> back;
+      *top++ = &node -> front;
+    }
+    else if (node -> contents == 0)
+    {
+      rku32 leaf [3]; // Triangle count, offset, cluster
+      if (source_read (source, &node -> encoding, 1, 1) != 1
+       || node -> encoding > leaf_quantized
+       || source_read (source, leaf, 4, 3) != 3
+       || leaf [2] >= cluster_count)
+      {
+        ok = false;
+        continue;
+      }
+      
+      Cluster* cluster = clusters + leaf [2];
+      node -> cluster = cluster;
+      node -> triangle_count = leaf [0];
+      node -> offset = leaf [1];
+      node -> cluster_next = cluster -> leaves;
+      cluster -> leaves = node;
+    }
+    else if (node -> contents >= 3)
+    {
+      ok = false;
+    }
+  }
+  
+  delete [] stack;
+  
+  if (!ok)
+  {
+    node_free (root, depth);
+    return 0;
+  }
+  
+  return root;
+}
+
+//
+// cluster_read
+// Reads the blocks of the cluster's leaves into Triangles, one after
+//  another.
+//
+bool cluster_read (Source* source, const Cluster* cluster, rkf32* triangles)
+{
+  for (Node* leaf = cluster -> leaves; leaf; leaf = leaf -> cluster_next)
+  {
+    rku32 count = leaf -> triangle_count;
+    
+    if (!source_seek (source, leaf -> offset))
+      return false;
+    
+    if (leaf -> encoding == leaf_floats)
+    {
+      if (source_read (source, triangles, 36, count) != count)
+        return false;
+    }
+    else if (!leaf_dequantize (source, triangles, count))
+    {
+      return false;
+    }
+    
+    triangles += count * 9;
+  }
+  
+  return true;
+}
+
+//
+// world_open
+// Reads all but the leaf triangles, leaving Source at the caller's
+//  disposal.
+//
+World* world_open (Source* source)
+{
+  char magic [8];
+  rku32 header [5]; // Format, depth, node, plane and cluster table offsets
+  rku32 stored_planes;
+  
+  if (source_read (source, magic, 1, 8) != 8
+   || strncmp (magic, "RKINDOOR", 8)
+   || source_read (source, header, 4, 5) != 5
+   || header [0] != 6
+   || !source_seek (source, header [3])
+   || source_read (source, &stored_planes, 4, 1) != 1)
+  {
+    return 0;
+  }
+  
+  World* world = new World;
+  world -> depth = header [1];
+  world -> plane_count = stored_planes * 2;
+  world -> planes = new Rk::Plane <rkf32> [world -> plane_count];
+  world -> clusters = 0;
+  world -> cluster_count = 0;
+  world -> frame = 0;
+  world -> render_stack = 0;
+  world -> cache.leaf = 0;
+  world -> cache.position = Vector3 (0, 0, 0);
+  world -> cache.slack = 0.0f;
+  world -> cache.clusters = 0;
+  world -> cache.count = 0;
+  world -> pager = 0;
+  
+  bool ok = true;
+  for (rku32 i = 0; i != stored_planes && ok; i++)
+  {
+    Rk::Plane <rkf32>& plane = world -> planes [i * 2];
+    ok = source_read (source, &plane, 4, 4) == 4;
+    world -> planes [i * 2 + 1] = Rk::Plane <rkf32> (-plane.normal, -plane.distance);
+  }
+  
+  if (ok)
+  {
+    ok = source_seek (source, header [4])
+      && source_read (source, &world -> cluster_count, 4, 1) == 1;
+  }
+  
+  if (ok)
+  {
+    world -> clusters = new Cluster [world -> cluster_count];
+    
+    for (rku32 i = 0; i != world -> cluster_count; i++)
+    {
+      Cluster& cluster = world -> clusters [i];
+      cluster.triangle_count = 0;
+      cluster.leaves = 0;
+      cluster.triangles = 0;
+      cluster.listed = 0;
+      cluster.state = cluster_absent;
+      cluster.arrived = 0;
+      cluster.next_arrived = 0;
+      cluster.used = 0;
+      cluster.newer = 0;
+      cluster.older = 0;
+      
+      ok = ok
+        && source_read (source, &cluster.triangle_count, 4, 1) == 1
+        && source_read (source, cluster.mins, 4, 3) == 3
+        && source_read (source, cluster.maxs, 4, 3) == 3;
+    }
+  }
+  
+  world -> root = 0;
+  if (ok)
+  {
+    source_seek (source, header [2]);
+    world -> root = world_load_nodes (source, world -> depth, world -> plane_count,
+      world -> clusters, world -> cluster_count);
+  }
+  
+  // Chains were built backwards. Their leaves must hold exactly what their
+  //  cluster was said to.
+  for (rku32 i = 0; i != world -> cluster_count && world -> root; i++)
+  {
+    Cluster& cluster = world -> clusters [i];
+    Node* leaves = 0;
+    rku32 left = cluster.triangle_count;
+    
+    while (Node* leaf = cluster.leaves)
+    {
+      cluster.leaves = leaf -> cluster_next;
+      leaf -> cluster_next = leaves;
+      leaves = leaf;
+      
+      if (leaf -> triangle_count > left)
+        ok = false;
+      else
+        left -= leaf -> triangle_count;
+    }
+    
+    cluster.leaves = leaves;
+    
+    if (!ok || left)
+    {
+      node_free (world -> root, world -> depth);
+      world -> root = 0;
+    }
+  }
+  
+  if (!world -> root)
+  {
+    clusters_free (world -> clusters, world -> cluster_count);
+    delete [] world -> planes;
+    delete world;
+    return 0;
+  }
+  
+  world -> render_stack = new Node* [world -> depth + 1];
+  world -> cache.clusters = new Cluster* [world -> cluster_count];
+  return world;
+}
+
+//
+// world_close
+// Frees all but the pager, which is stopped first; see world_free.
+//
+void world_close (World* world)
+{
+  node_free (world -> root, world -> depth);
+  clusters_free (world -> clusters, world -> cluster_count);
+  delete [] world -> planes;
+  delete [] world -> render_stack;
+  delete [] world -> cache.clusters;
+  delete world;
+}
+
+//
+// node_locate
+// Finds the leaf the walk below reaches first: the camera's.
+//
+Node* node_locate (Node* root, const Rk::Plane <rkf32>* planes, Vector3 position)
+{
+  Node* node = root;
+  
+  while (node && node -> front && node -> back)
+  {
+    rkf32 dist = planes [node -> partition].point_distance (position);
+    node = dist > 0.001 ? node -> front : node -> back;
+  }
+  
+  return node;
+}
+
+//
+// node_order
+// Walks front to back relative to the viewer on the world's preallocated
+//  stack, filling Cache. The far child is pushed first so the near one is
+//  reached first. A cluster is listed at the first of its leaves reached.
+//
+void node_order (Node* root, const Rk::Plane <rkf32>* planes, rku32 frame, Node** stack, Vector3 position, RenderCache* cache)
+{
+  cache -> leaf = 0;
+  cache -> position = position;
+  cache -> slack = FLT_MAX;
+  cache -> count = 0;
+  
+  if (!root)
+    return;
+  
+  Node** top = stack;
+  *top++ = root;
+  
+  while (top != stack)
+  {
+    Node* node = *--top;
+    
+    if (node -> front && node -> back)
+    {
+      rkf32 dist = planes [node -> partition].point_distance (position);
+      
+      // Nodes on the way to the camera's leaf hold while it's there
+      if (cache -> leaf)
+      {
+        rkf32 margin = dist > 0.001 ? dist - 0.001f : 0.001f - dist;
+        if (margin < cache -> slack)
+          cache -> slack = margin;
+      }
+      
+      if (dist > 0.001)
+      {
+        *top++ = node -> back;
+        *top++ = node -> front;
+      }
+      else
+      {
+        *top++ = node -> front;
+        *top++ = node -> back;
+      }
+      
+      continue;
+    }
+    
+    if (!cache -> leaf)
+      cache -> leaf = node;
+    
+    Cluster* cluster = node -> cluster;
+    if (!cluster || cluster -> listed == frame || !cluster -> triangle_count)
+      continue;
+    
+    cluster -> listed = frame;
+    cache -> clusters [cache -> count++] = cluster;
+  }
+}
+
+
+//
+// tree_check
+// Loads Filename as world_load does and walks it twice: once counting the
+//  leaves, and once from the position as world_render does, reading the
+//  triangles of the clusters it would draw.
+//
+bool tree_check (const char* filename, float x, float y, float z, TreeCheck* check)
+{
+  assert (filename);
+  assert (check);
+  
+  Source* source = source_open (filename);
+  if (!source)
+    return false;
+  
+  World* world = world_open (source);
+  if (!world)
+  {
+    source_close (source);
+    return false;
+  }
+  
+  check -> depth = world -> depth;
+  check -> leaves = 0;
+  check -> clusters = 0;
+  check -> triangles = 0;
+  
+  Node** stack = world -> render_stack;
+  Node** top = stack;
+  *top++ = world -> root;
+  
+  while (top != stack)
+  {
+    Node* node = *--top;
+    
+    if (node -> front && node -> back)
+    {
+      *top++ = node -> back;
+      *top++ = node -> front;
+    }
+    else
+    {
+      check -> leaves++;
+    }
+  }
+  
+  for (rku32 i = 0; i != world -> cluster_count; i++)
+  {
+    if (world -> clusters [i].triangle_count)
+      check -> clusters++;
+  }
+  
+  RenderCache* cache = &world -> cache;
+  node_order (world -> root, world -> planes, ++world -> frame, world -> render_stack, Vector3 (x, y, z), cache);
+  check -> listed = cache -> count;
+  
+  bool ok = cache -> leaf != 0;
+  for (rku32 i = 0; i != cache -> count && ok; i++)
+  {
+    Cluster* cluster = cache -> clusters [i];
+    cluster -> triangles = new rkf32 [cluster -> triangle_count * 9];
+    ok = cluster_read (source, cluster, cluster -> triangles);
+    check -> triangles += cluster -> triangle_count;
+  }
+  
+  source_close (source);
+  world_close (world);
+  return ok;
+}
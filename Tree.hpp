@@ -0,0 +1,171 @@
+//
+// Copyright (C) 2009 Roadkill Software
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+
+#ifndef INDOORTEST_H_TREE
+#define INDOORTEST_H_TREE
+
+#include "Vector3.hpp"
+#include "TreeCheck.hpp"
+
+#include <cstdio>
+
+#include <Rk/Types.hpp>
+#include <Rk/Plane.hpp>
+
+//
+// Tree
+// The world as the viewer holds it, and what loads and walks it without
+//  drawing. The drawing and the pager are World.cpp's.
+//
+struct Node;
+
+//
+// Cluster
+// Empty leaves drawn as one batch. Their triangles are gathered into one
+//  array, read whole when the world loads or, for a paged world, when the
+//  camera comes near; see Pager.
+//
+#define cluster_absent   0
+#define cluster_queued   1 // For the pager's thread
+#define cluster_loading  2
+#define cluster_arrived  3 // Read, not yet installed
+#define cluster_resident 4
+#define cluster_failed   5
+
+struct Cluster
+{
+  rku32 triangle_count;
+  rkf32 mins [3], maxs [3]; // Bounds of the triangles
+  Node* leaves;      // Chained through Node::cluster_next, in file order
+  rkf32* triangles;  // 0 while not resident
+  rku32 listed;      // Frame it was last put in a RenderCache
+  
+  // Paged worlds only
+  rku8 state;        // Guarded by Pager::lock
+  rkf32* arrived;    //  as are these, from the pager's thread
+  Cluster* next_arrived;
+  rku32 used;        // Frame it was last near the camera
+  Cluster *newer, *older; // Resident clusters, by use
+  
+};
+
+//
+// Node
+//
+struct Node
+{
+  rku8 contents;
+  Node *front, *back;
+  rku32 partition;  // Into World::planes
+  Cluster* cluster; // Of empty leaves
+  
+  // Empty leaves only
+  Node* cluster_next;
+  rku8 encoding;    // Of the leaf's triangle block
+  rku32 triangle_count;
+  rku32 offset;     // Of the block in the file
+  
+};
+
+struct Pager;
+
+//
+// RenderCache
+// The clusters in the order the front-to-back walk reached them, kept
+//  while it would reach them in the same order. The walk's first descent
+//  is to the camera's leaf, choosing each node's near side by the camera;
+//  while the camera stays in that leaf those choices hold. Planes are unit
+//  length, so each node the walk chose for elsewhere holds while the
+//  camera moves less than Slack from Position, the nearest any of them
+//  came to changing.
+//
+struct RenderCache
+{
+  Node* leaf; // 0 for none cached
+  Vector3 position;
+  rkf32 slack;
+  Cluster** clusters; // Room for all
+  rku32 count;
+  
+};
+
+//
+// World
+//
+struct World
+{
+  Node* root;
+  rku32 depth; // Of the deepest leaf, root being 0
+  Rk::Plane <rkf32>* planes; // Each stored plane then its flip
+  rku32 plane_count;
+  Cluster* clusters;
+  rku32 cluster_count;
+  rku32 frame;
+  Node** render_stack;
+  RenderCache cache;
+  Pager* pager; // 0 unless paged
+  
+};
+
+//
+// Source
+// A .indoor file to load from, plain or packed. A packed file is unpacked
+//  a block at a time as reads reach it, keeping only the few blocks read
+//  most recently - the node table and the triangles it points at are
+//  usually in different ones.
+//
+#define pack_block_size 32768
+#define source_slots    4
+
+struct SourceSlot
+{
+  rku32 block; // ~0 for none
+  rku32 used;  // Source::reads when last used
+  rku8* data;
+  
+};
+
+struct Source
+{
+  FILE* file;
+  rku32 position;
+  
+  // Packed files only
+  rku32 block_count;
+  rku32* plain_starts;  // Of each block, then the end
+  rku32* packed_starts; // Of each block in the file, then the end
+  rku8* packed;         // A block as read from the file
+  SourceSlot slots [source_slots];
+  rku32 reads;
+  
+};
+
+Source* source_open  (const char* filename);
+void    source_close (Source* source);
+rku32   source_read  (Source* source, void* data, rku32 size, rku32 count);
+bool    source_seek  (Source* source, rku32 position);
+
+bool   cluster_read (Source* source, const Cluster* cluster, rkf32* triangles);
+World* world_open   (Source* source);
+void   world_close  (World* world);
+
+Node* node_locate (Node* root, const Rk::Plane <rkf32>* planes, Vector3 position);
+void  node_order  (Node* root, const Rk::Plane <rkf32>* planes, rku32 frame, Node** stack, Vector3 position, RenderCache* cache);
+
+#endif
@@ -0,0 +1,40 @@
+//
+// Copyright (C) 2009 Roadkill Software
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+
+#ifndef INDOORTEST_H_TREECHECK
+#define INDOORTEST_H_TREECHECK
+
+//
+// TreeCheck
+// What tree_check found. Kept apart from Tree.hpp, whose types share
+//  their names with the compiler's, so that indoor --deep can include it.
+//
+struct TreeCheck
+{
+  unsigned depth;     // From the header, which loading holds the tree to
+  unsigned leaves;
+  unsigned clusters;  // Those with triangles
+  unsigned listed;    //  drawn from the position, front to back
+  unsigned triangles; //  holding these
+  
+};
+
+bool tree_check (const char* filename, float x, float y, float z, TreeCheck* check);
+
+#endif
@@ -1,218 +1,466 @@
-//
-// Copyright (C) 2009 Roadkill Software
-//
-// This program is free software; you can redistribute it and/or
-// modify it under the terms of the GNU General Public License
-// as published by the Free Software Foundation; either version 2
-// of the License, or (at your option) any later version.
-//
-// This program is distributed in the hope that it will be useful,
-// but WITHOUT ANY WARRANTY; without even the implied warranty of
-// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
-//
-// See the GNU General Public License for more details.
-//
-// You should have received a copy of the GNU General Public License
-// along with this program; if not, write to the Free Software
-// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
-//
-
-#include "World.hpp"
-
-#include <cstdio>
-#include <cassert>
-#include <cstring>
-
-#include <Rk/Types.hpp>
-#include <Rk/Plane.hpp>
-
-#define WIN32_LEAN_AND_MEAN 1
-#define NOCRYPT
-#define NOUSER
-#define NOSERVICE
-#define NOMCX
-#define NOIME
-#include <windows.h>
-
-#include <gl/gl.h>
-
-//
-// Node
-//
-struct Node
-{
-  rku8 contents;
-  Node *front, *back;
-  Rk::Plane <rkf32> partition;
-  rku32 triangle_count;
-  rkf32* triangles;
-  
-};
-
-//
-// World
-//
-struct World
-{
-  Node* root;
-  
-};
-
-//
-// world_load_nodes
-//
-Node* world_load_nodes (FILE* file)
-{
-  Node* node = new Node;
-  
-  fread (&node -> contents, 1, 1, file);
-  
-  if (node -> contents == 255)
-  {
-    fread (&node -> partition, 4, 4, file);
-    
-    node -> front = world_load_nodes (file);
-    if (!node -> front)
-    {
-      delete node;
-      return 0;
-    }
-    
-    node -> back = world_load_nodes (file);
-    if (!node -> back)
-    {
-      delete node;
-      return 0;
-    }
-    
-    node -> triangles = 0;
-  }
-  else if (node -> contents == 0)
-  {
-    fread (&node -> triangle_count, 4, 1, file);
-    
-    node -> triangles = new rkf32 [node -> triangle_count * 9];
-    fread (node -> triangles, 4, node -> triangle_count * 9, file);
-    
-    node -> front = 0;
-    node -> back  = 0;
-  }
-  else if (node -> contents < 3)
-  {
-    node -> triangles = 0;
-    node -> front     = 0;
-    node -> back      = 0;
-  }
-  else
-  {
-    delete node;
-    return 0;
-  }
-  
-  return node;
-}
-
-//
-// world_load
-//
-World* world_load (const char* filename)
-{
-  assert (filename);
-  
-  FILE* file = fopen (filename, "rb");
-  if (!file)
-    return 0;
-  
-  char magic [8];
-  fread (magic, 1, 8, file);
-  
-  if (strncmp (magic, "RKINDOOR", 8))
-  {
-    fclose (file);
-    return 0;
-  }
-  
-  World* world = new World;
-  
-  world -> root = world_load_nodes (file);
-  if (!world -> root)
-  {
-    delete world;
-    world = 0;
-  }
-  
-  fclose (file);
-  return world;
-}
-
-//
-// node_free
-//
-static void node_free (Node* node)
-{
-  if (!node)
-    return;
-  
-  node_free (node -> front);
-  node_free (node -> back );
-  
-  if (node -> triangles)
-    delete [] node -> triangles;
-}
-
-//
-// world_free
-//
-void world_free (World* world)
-{
-  if (!world)
-    return;
-  
-  node_free (world -> root);
-}
-
-//
-// node_render
-//
-static void node_render (Node* node, Vector3 position, Vector3 facing)
-{
-  if (!node)
-    return;
-  
-  if (node -> triangles)
-  {
-    glVertexPointer (3, GL_FLOAT, 0, node -> triangles);
-    glDrawArrays (GL_TRIANGLES, 0, node -> triangle_count * 3);
-  }
-  else
-  {
-    rkf32 dist = node -> partition.point_distance (position);
-    
-    if (dist > 0.001)
-    {
-      node_render (node -> front, position, facing);
-      node_render (node -> back,  position, facing);
-    }
-    else
-    {
-      node_render (node -> back,  position, facing);
-      node_render (node -> front, position, facing);
-    }
-  }
-}
-
-//
-// world_render
-//
-void world_render (World* world, Vector3 position, Vector3 facing)
-{
-  assert (world);
-  
-  Node* root = world -> root;
-  
-  glColor3f (1.0, 0.0, 0.0);
-  glPolygonMode (GL_FRONT, GL_LINE);
-  glEnable (GL_VERTEX_ARRAY);
-  node_render (root, position, facing);
-  glDisable (GL_VERTEX_ARRAY);
-}
+//
+// Copyright (C) 2009 Roadkill Software
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+
+#include "World.hpp"
+#include "Tree.hpp"
+
+#include <cassert>
+
+#define WIN32_LEAN_AND_MEAN 1
+#define NOCRYPT
+#define NOUSER
+#define NOSERVICE
+#define NOMCX
+#define NOIME
+#include <windows.h>
+
+#include <gl/gl.h>
+
+//
+// Pager
+// Keeps a paged world's triangles near the camera in memory. Each frame
+//  the renderer notes the clusters within Radius; resident ones are marked
+//  used, and the rest are requested nearest first from a thread that reads
+//  them off Source. The frame loop never waits on it: what has arrived is
+//  installed at the start of the next frame, and until then the cluster
+//  just isn't drawn. Requests are only made while the triangles resident
+//  and requested fit in Budget, evicting the clusters least recently near
+//  the camera to make room.
+//
+#define pager_queue 32
+
+struct Pager
+{
+  Source* source; // The pager's thread's alone
+  HANDLE thread;
+  HANDLE wake;    // Set on new requests, and to quit
+  
+  // Guarded by lock
+  CRITICAL_SECTION lock;
+  Cluster* queue [pager_queue]; // Nearest first
+  rku32 queue_next, queue_count;
+  Cluster* arrived;
+  bool quit;
+  
+  // The frame loop's
+  rku32 budget;    // Bytes of triangles
+  rku32 committed; //  resident or requested
+  rkf32 radius;
+  Cluster *newest, *oldest;
+  Cluster* wanted [pager_queue]; // This frame, nearest first
+  rku32 wanted_count;
+  
+};
+
+//
+// pager_thread
+//
+static DWORD WINAPI pager_thread (LPVOID param)
+{
+  Pager* pager = (Pager*) param;
+  
+  for (;;)
+  {
+    Cluster* cluster = 0;
+    
+    EnterCriticalSection (&pager -> lock);
+    bool quit = pager -> quit;
+    if (!quit && pager -> queue_next != pager -> queue_count)
+    {
+      cluster = pager -> queue [pager -> queue_next++];
+      cluster -> state = cluster_loading;
+    }
+    LeaveCriticalSection (&pager -> lock);
+    
+    if (quit)
+      break;
+    
+    if (!cluster)
+    {
+      WaitForSingleObject (pager -> wake, INFINITE);
+      continue;
+    }
+    
+    rkf32* triangles = new rkf32 [cluster -> triangle_count * 9];
+    bool ok = cluster_read (pager -> source, cluster, triangles);
+    
+    if (!ok)
+    {
+      delete [] triangles;
+      triangles = 0;
+    }
+    
+    EnterCriticalSection (&pager -> lock);
+    cluster -> state = ok ? cluster_arrived : cluster_failed;
+    cluster -> arrived = triangles;
+    cluster -> next_arrived = pager -> arrived;
+    pager -> arrived = cluster;
+    LeaveCriticalSection (&pager -> lock);
+  }
+  
+  return 0;
+}
+
+//
+// pager_start
+//
+static Pager* pager_start (Source* source, rku32 budget, rkf32 radius)
+{
+  Pager* pager = new Pager;
+  pager -> source = source;
+  pager -> queue_next = 0;
+  pager -> queue_count = 0;
+  pager -> arrived = 0;
+  pager -> quit = false;
+  pager -> budget = budget;
+  pager -> committed = 0;
+  pager -> radius = radius;
+  pager -> newest = 0;
+  pager -> oldest = 0;
+  pager -> wanted_count = 0;
+  
+  InitializeCriticalSection (&pager -> lock);
+  pager -> wake = CreateEvent (0, FALSE, FALSE, 0);
+  pager -> thread = pager -> wake ? CreateThread (0, 0, pager_thread, pager, 0, 0) : 0;
+  
+  if (!pager -> thread)
+  {
+    if (pager -> wake)
+      CloseHandle (pager -> wake);
+    DeleteCriticalSection (&pager -> lock);
+    delete pager;
+    return 0;
+  }
+  
+  return pager;
+}
+
+//
+// pager_stop
+// Waits out any read in progress. Triangles that arrived uninstalled are
+//  left to clusters_free.
+//
+static void pager_stop (Pager* pager)
+{
+  if (!pager)
+    return;
+  
+  EnterCriticalSection (&pager -> lock);
+  pager -> quit = true;
+  LeaveCriticalSection (&pager -> lock);
+  
+  SetEvent (pager -> wake);
+  WaitForSingleObject (pager -> thread, INFINITE);
+  
+  CloseHandle (pager -> thread);
+  CloseHandle (pager -> wake);
+  DeleteCriticalSection (&pager -> lock);
+  source_close (pager -> source);
+  delete pager;
+}
+
+//
+// pager_touch
+// Makes Cluster the most recently used.
+//
+static void pager_touch (Pager* pager, Cluster* cluster, rku32 frame)
+{
+  cluster -> used = frame;
+  
+  if (pager -> newest == cluster)
+    return;
+  
+  // Unlink, if linked
+  if (cluster -> newer) cluster -> newer -> older = cluster -> older;
+  if (cluster -> older) cluster -> older -> newer = cluster -> newer;
+  if (pager -> oldest == cluster)
+    pager -> oldest = cluster -> newer;
+  
+  cluster -> newer = 0;
+  cluster -> older = pager -> newest;
+  if (pager -> newest)
+    pager -> newest -> newer = cluster;
+  pager -> newest = cluster;
+  
+  if (!pager -> oldest)
+    pager -> oldest = cluster;
+}
+
+//
+// pager_evict
+// Frees the least recently used cluster's triangles.
+//
+static void pager_evict (Pager* pager)
+{
+  Cluster* cluster = pager -> oldest;
+  
+  pager -> oldest = cluster -> newer;
+  if (pager -> oldest)
+    pager -> oldest -> older = 0;
+  else
+    pager -> newest = 0;
+  
+  cluster -> newer = 0;
+  cluster -> older = 0;
+  
+  delete [] cluster -> triangles;
+  cluster -> triangles = 0;
+  cluster -> state = cluster_absent;
+  pager -> committed -= cluster -> triangle_count * 36;
+}
+
+//
+// pager_install
+// Takes what the pager's thread has read since last frame.
+//
+static void pager_install (Pager* pager, rku32 frame)
+{
+  EnterCriticalSection (&pager -> lock);
+  
+  while (Cluster* cluster = pager -> arrived)
+  {
+    pager -> arrived = cluster -> next_arrived;
+    cluster -> next_arrived = 0;
+    
+    if (cluster -> state == cluster_arrived)
+    {
+      cluster -> triangles = cluster -> arrived;
+      cluster -> arrived = 0;
+      cluster -> state = cluster_resident;
+      pager_touch (pager, cluster, frame);
+    }
+    else
+    {
+      pager -> committed -= cluster -> triangle_count * 36;
+    }
+  }
+  
+  LeaveCriticalSection (&pager -> lock);
+}
+
+//
+// pager_request
+// Replaces the requests the pager's thread hasn't started on with this
+//  frame's, so it always reads what is nearest the camera now.
+//
+static void pager_request (Pager* pager, rku32 frame)
+{
+  EnterCriticalSection (&pager -> lock);
+  
+  for (rku32 i = pager -> queue_next; i != pager -> queue_count; i++)
+  {
+    pager -> queue [i] -> state = cluster_absent;
+    pager -> committed -= pager -> queue [i] -> triangle_count * 36;
+  }
+  
+  pager -> queue_next = 0;
+  pager -> queue_count = 0;
+  
+  for (rku32 i = 0; i != pager -> wanted_count; i++)
+  {
+    Cluster* cluster = pager -> wanted [i];
+    if (cluster -> state != cluster_absent)
+      continue;
+    
+    // Clusters near the camera this frame stay
+    rku32 size = cluster -> triangle_count * 36;
+    while (pager -> committed + size > pager -> budget
+        && pager -> oldest && pager -> oldest -> used != frame)
+    {
+      pager_evict (pager);
+    }
+    
+    if (pager -> committed + size > pager -> budget)
+      break;
+    
+    cluster -> state = cluster_queued;
+    pager -> committed += size;
+    pager -> queue [pager -> queue_count++] = cluster;
+  }
+  
+  bool requested = pager -> queue_count != 0;
+  LeaveCriticalSection (&pager -> lock);
+  
+  pager -> wanted_count = 0;
+  
+  if (requested)
+    SetEvent (pager -> wake);
+}
+
+//
+// world_load
+// Plain and packed files load alike; see Source.
+//
+World* world_load (const char* filename)
+{
+  assert (filename);
+  
+  Source* source = source_open (filename);
+  if (!source)
+    return 0;
+  
+  World* world = world_open (source);
+  
+  for (rku32 i = 0; world && i != world -> cluster_count; i++)
+  {
+    Cluster& cluster = world -> clusters [i];
+    cluster.triangles = new rkf32 [cluster.triangle_count * 9];
+    cluster.state = cluster_resident;
+    
+    if (!cluster_read (source, &cluster, cluster.triangles))
+    {
+      world_free (world);
+      world = 0;
+    }
+  }
+  
+  source_close (source);
+  return world;
+}
+
+//
+// world_load_paged
+// Loads just the tree and cluster table; see Pager.
+//
+World* world_load_paged (const char* filename, unsigned budget, float radius)
+{
+  assert (filename);
+  
+  Source* source = source_open (filename);
+  if (!source)
+    return 0;
+  
+  World* world = world_open (source);
+  if (world)
+    world -> pager = pager_start (source, budget, radius);
+  
+  if (!world || !world -> pager)
+  {
+    world_free (world);
+    source_close (source);
+    return 0;
+  }
+  
+  return world;
+}
+
+//
+// world_free
+//
+void world_free (World* world)
+{
+  if (!world)
+    return;
+  
+  pager_stop (world -> pager);
+  world_close (world);
+}
+
+//
+// cluster_near
+// Whether the cluster's bounds come within Radius of Position.
+//
+static bool cluster_near (const Cluster* cluster, Vector3 position, rkf32 radius)
+{
+  rkf32 point [3] = { position.x, position.y, position.z };
+  rkf32 distance = 0.0f; // Squared
+  
+  for (rku32 i = 0; i != 3; i++)
+  {
+    rkf32 outside = 0.0f;
+    if (point [i] < cluster -> mins [i])
+      outside = cluster -> mins [i] - point [i];
+    else if (point [i] > cluster -> maxs [i])
+      outside = point [i] - cluster -> maxs [i];
+    
+    distance += outside * outside;
+  }
+  
+  return distance <= radius * radius;
+}
+
+//
+// clusters_render
+// Draws the clusters whose triangles are resident, in order. Given a
+//  pager, those near the camera are noted for it, so nearest first.
+//
+static void clusters_render (Cluster** clusters, rku32 count, rku32 frame, Pager* pager, Vector3 position)
+{
+  for (rku32 i = 0; i != count; i++)
+  {
+    Cluster* cluster = clusters [i];
+    
+    if (pager && cluster_near (cluster, position, pager -> radius))
+    {
+      if (cluster -> triangles)
+        pager_touch (pager, cluster, frame);
+      else if (pager -> wanted_count != pager_queue)
+        pager -> wanted [pager -> wanted_count++] = cluster;
+    }
+    
+    if (!cluster -> triangles)
+      continue;
+    
+    glVertexPointer (3, GL_FLOAT, 0, cluster -> triangles);
+    glDrawArrays (GL_TRIANGLES, 0, cluster -> triangle_count * 3);
+  }
+}
+
+//
+// world_render
+// Walks the tree again only when the cached order might have changed; see
+//  RenderCache.
+//
+void world_render (World* world, Vector3 position, Vector3 facing)
+{
+  assert (world);
+  
+  Node* root = world -> root;
+  Pager* pager = world -> pager;
+  RenderCache* cache = &world -> cache;
+  rku32 frame = ++world -> frame;
+  
+  if (pager)
+    pager_install (pager, frame);
+  
+  rkf32 moved [3] = {
+    position.x - cache -> position.x,
+    position.y - cache -> position.y,
+    position.z - cache -> position.z
+  };
+  
+  rkf32 distance = moved [0] * moved [0] + moved [1] * moved [1] + moved [2] * moved [2];
+  
+  if (!cache -> leaf
+   || node_locate (root, world -> planes, position) != cache -> leaf
+   || distance >= cache -> slack * cache -> slack)
+  {
+    node_order (root, world -> planes, frame, world -> render_stack, position, cache);
+  }
+  
+  glColor3f (1.0, 0.0, 0.0);
+  glPolygonMode (GL_FRONT, GL_LINE);
+  glEnable (GL_VERTEX_ARRAY);
+  clusters_render (cache -> clusters, cache -> count, frame, pager, position);
+  glDisable (GL_VERTEX_ARRAY);
+  
+  if (pager)
+    pager_request (pager, frame);
+}
+
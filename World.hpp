@@ -1,32 +1,33 @@
-//
-// Copyright (C) 2009 Roadkill Software
-//
-// This program is free software; you can redistribute it and/or
-// modify it under the terms of the GNU General Public License
-// as published by the Free Software Foundation; either version 2
-// of the License, or (at your option) any later version.
-//
-// This program is distributed in the hope that it will be useful,
-// but WITHOUT ANY WARRANTY; without even the implied warranty of
-// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
-//
-// See the GNU General Public License for more details.
-//
-// You should have received a copy of the GNU General Public License
-// along with this program; if not, write to the Free Software
-// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
-//
-
-#ifndef INDOORTEST_H_WORLD
-#define INDOORTEST_H_WORLD
-
-#include "Vector3.hpp"
-
-struct World;
-
-World* world_load (const char* filename);
-void   world_free (World* world);
-
-void world_render (World* world, Vector3 position, Vector3 facing);
-
-#endif
+//
+// Copyright (C) 2009 Roadkill Software
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+
+#ifndef INDOORTEST_H_WORLD
+#define INDOORTEST_H_WORLD
+
+#include "Vector3.hpp"
+
+struct World;
+
+World* world_load       (const char* filename);
+World* world_load_paged (const char* filename, unsigned budget, float radius);
+void   world_free       (World* world);
+
+void world_render (World* world, Vector3 position, Vector3 facing);
+
+#endif
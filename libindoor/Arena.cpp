@@ -0,0 +1,140 @@
+//
+// Copyright (C) 2009 Roadkill Software
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+
+
+#include "Arena.hpp"
+
+#include <cassert>
+
+namespace In
+{
+# define arena_min_chunk  64
+# define arena_classes    12 // 64 bytes to 128k
+# define arenablock_size  (512 * 1024)
+  
+  struct ArenaBlock
+  {
+    char chunks [arenablock_size];
+    char* cur_chunk;
+    ArenaBlock* next;
+    
+    ArenaBlock () :
+      cur_chunk (chunks)
+    {}
+    
+    inline unsigned remaining () const
+    {
+      return (chunks + arenablock_size) - cur_chunk;
+    }
+    
+  };
+  
+# define free_chunks_size 256
+  static indoor_thread_local void* free_chunks [arena_classes][free_chunks_size];
+  static indoor_thread_local unsigned free_chunk_count [arena_classes];
+  
+  static indoor_thread_local ArenaBlock* head_arena_block = 0;
+  
+  //
+  // chunk_class
+  // Returns the smallest class holding Size bytes, or arena_classes if none does.
+  //
+  static unsigned chunk_class (unsigned size)
+  {
+    unsigned cls = 0;
+    unsigned chunk = arena_min_chunk;
+    
+    while (chunk < size && cls != arena_classes)
+    {
+      chunk <<= 1;
+      cls++;
+    }
+    
+    return cls;
+  }
+  
+  unsigned arena_round (unsigned size)
+  {
+    unsigned cls = chunk_class (size);
+    if (cls == arena_classes)
+      return size;
+    
+    return arena_min_chunk << cls;
+  }
+  
+  void* arena_alloc (unsigned size)
+  {
+    assert (size);
+    
+    unsigned cls = chunk_class (size);
+    
+    // Oversized chunks go straight to the heap
+    if (cls == arena_classes)
+      return new char [size];
+    
+    if (free_chunk_count [cls])
+      return free_chunks [cls][--free_chunk_count [cls]];
+    
+    unsigned chunk = arena_min_chunk << cls;
+    
+    if (!head_arena_block || head_arena_block -> remaining () < chunk)
+    {
+      ArenaBlock* new_ab = new ArenaBlock;
+      new_ab -> next = head_arena_block;
+      head_arena_block = new_ab;
+    }
+    
+    void* result = head_arena_block -> cur_chunk;
+    head_arena_block -> cur_chunk += chunk;
+    return result;
+  }
+  
+  void arena_free (void* chunk, unsigned size)
+  {
+    if (!chunk)
+      return;
+    
+    unsigned cls = chunk_class (size);
+    
+    if (cls == arena_classes)
+    {
+      delete [] (char*) chunk;
+      return;
+    }
+    
+    if (free_chunk_count [cls] == free_chunks_size)
+      return; // Soft leak. Inefficient, but not deadly.
+    
+    free_chunks [cls][free_chunk_count [cls]++] = chunk;
+  }
+  
+  void arena_cleanup ()
+  {
+    while (head_arena_block)
+    {
+      ArenaBlock* next = head_arena_block -> next;
+      delete head_arena_block;
+      head_arena_block = next;
+    }
+    
+    for (unsigned cls = 0; cls != arena_classes; cls++)
+      free_chunk_count [cls] = 0;
+  }
+  
+}
@@ -0,0 +1,140 @@
+//
+// Copyright (C) 2009 Roadkill Software
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+
+
+#ifndef INDOOR_H_ARENA
+#define INDOOR_H_ARENA
+
+//
+// Pool state - the arena and the polygon and portal pools - is kept per
+//  thread, so maps compiled on different threads never share storage.
+//  Each thread must run the cleanup functions itself.
+//
+#if defined (_MSC_VER)
+# define indoor_thread_local __declspec (thread)
+#else
+# define indoor_thread_local __thread
+#endif
+
+namespace In
+{
+  //
+  // Arena
+  // Size-classed scratch storage for compile data that outgrows its inline
+  //  buffers. Chunks are carved from large blocks and recycled per class.
+  //
+  void*    arena_alloc   (unsigned size);
+  void     arena_free    (void* chunk, unsigned size);
+  unsigned arena_round   (unsigned size);
+  void     arena_cleanup ();
+  
+  //
+  // ArenaSpan
+  // Growable array of plain items in arena storage. Starts empty and
+  //  doubles on demand, so short spans cost a single small chunk.
+  //
+  template <typename T>
+  struct ArenaSpan
+  {
+    T* items;
+    T* items_end;
+    T* items_limit;
+    
+    inline ArenaSpan () :
+      items (0), items_end (0), items_limit (0)
+    {}
+    
+    inline ~ArenaSpan ()
+    {
+      release ();
+    }
+    
+    inline       T* begin ()       { return items;     }
+    inline       T* end   ()       { return items_end; }
+    inline const T* begin () const { return items;     }
+    inline const T* end   () const { return items_end; }
+    
+    inline unsigned size     () const { return items_end   - items; }
+    inline unsigned capacity () const { return items_limit - items; }
+    inline bool     empty    () const { return items_end == items;  }
+    
+    inline void push (const T& item)
+    {
+      if (items_end == items_limit)
+      {
+        const T copy = item; // item may live in the old storage
+        reserve (size () + 1);
+        *items_end++ = copy;
+        return;
+      }
+      
+      *items_end++ = item;
+    }
+    
+    inline T pop ()
+    {
+      return *--items_end;
+    }
+    
+    void reserve (unsigned count)
+    {
+      unsigned old_capacity = capacity ();
+      if (count <= old_capacity)
+        return;
+      
+      unsigned new_capacity = old_capacity * 2;
+      if (new_capacity < count)
+        new_capacity = count;
+      
+      unsigned bytes = arena_round (new_capacity * sizeof (T));
+      T* new_items = (T*) arena_alloc (bytes);
+      
+      unsigned count_now = size ();
+      for (unsigned i = 0; i != count_now; i++)
+        new_items [i] = items [i];
+      
+      arena_free (items, old_capacity * sizeof (T));
+      
+      items       = new_items;
+      items_end   = new_items + count_now;
+      items_limit = new_items + bytes / sizeof (T);
+    }
+    
+    inline void clear ()
+    {
+      items_end = items;
+    }
+    
+    inline void release ()
+    {
+      if (items)
+        arena_free (items, capacity () * sizeof (T));
+      
+      items = items_end = items_limit = 0;
+    }
+    
+  private:
+    ArenaSpan (const ArenaSpan&);
+    void operator = (const ArenaSpan&);
+    
+  };
+  
+}
+
+#endif
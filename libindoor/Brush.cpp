@@ -0,0 +1,352 @@
+//
+// Copyright (C) 2009 Roadkill Software
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+
+
+#include "Brush.hpp"
+#include "Arena.hpp"
+#include "Planes.hpp"
+
+#include <cassert>
+
+#include <Rk/Types.hpp>
+#include <Rk/Plane.hpp>
+
+using Rk::PlaneSide;
+
+namespace In
+{
+  // World.cpp
+  PlaneSide polygon_side    (const Plane& plane, const Polygon& poly);
+  bool      is_polygon_in   (const Polygon& poly, const Plane& plane);
+  void      split_poly      (const Polygon* poly, const Plane* split, Polygon* fore, Polygon* rear);
+  void      make_plane_poly (const Plane* plane, Polygon* poly);
+  
+# define brush_hull_margin 16.0
+  
+  //
+  // Bounds
+  //
+  struct Bounds
+  {
+    Vector3 mins, maxs;
+    
+    Bounds () :
+      mins ( 1E16,  1E16,  1E16),
+      maxs (-1E16, -1E16, -1E16)
+    {}
+    
+    void add (const Vector3& v)
+    {
+      if (v.x < mins.x) mins.x = v.x;
+      if (v.y < mins.y) mins.y = v.y;
+      if (v.z < mins.z) mins.z = v.z;
+      if (v.x > maxs.x) maxs.x = v.x;
+      if (v.y > maxs.y) maxs.y = v.y;
+      if (v.z > maxs.z) maxs.z = v.z;
+    }
+    
+    bool touches (const Bounds& other) const
+    {
+      return mins.x <= other.maxs.x + 0.00001 && maxs.x >= other.mins.x - 0.00001
+          && mins.y <= other.maxs.y + 0.00001 && maxs.y >= other.mins.y - 0.00001
+          && mins.z <= other.maxs.z + 0.00001 && maxs.z >= other.mins.z - 0.00001;
+    }
+    
+  };
+  
+  //
+  // make_brush_faces
+  // Cuts a face for each plane out of a huge polygon on it, keeping what is
+  //  behind every other plane. Planes the brush doesn't touch give no face.
+  //
+  static void make_brush_faces (const Brush& brush, ArenaSpan <Polygon*>* faces, Bounds* bounds)
+  {
+    for (unsigned i = 0; i != brush.plane_count; i++)
+    {
+      Plane plane (brush.planes [i].normal, brush.planes [i].distance);
+      
+      Polygon* face = polygon_alloc ();
+      make_plane_poly (&plane, face);
+      
+      for (unsigned j = 0; j != brush.plane_count && face; j++)
+      {
+        if (j == i)
+          continue;
+        
+        Plane clip (brush.planes [j].normal, brush.planes [j].distance);
+        if (is_polygon_in (*face, clip))
+          continue; // Repeated plane
+        
+        PlaneSide side = polygon_side (clip, *face);
+        if (side == plane_side_back)
+          continue;
+        
+        if (side == plane_side_front)
+        {
+          polygon_free (face);
+          face = 0;
+          break;
+        }
+        
+        Polygon* fore = polygon_alloc ();
+        Polygon* rear = polygon_alloc ();
+        split_poly (face, &clip, fore, rear);
+        polygon_free (fore);
+        polygon_free (face);
+        face = rear;
+      }
+      
+      if (!face)
+        continue;
+      
+      if (face -> size () < 3)
+      {
+        polygon_free (face);
+        continue;
+      }
+      
+      faces -> push (face);
+      
+      for (const Vector3* v = face -> begin (); v != face -> end (); v++)
+        bounds -> add (*v);
+    }
+  }
+  
+  //
+  // clip_to_brush
+  // Keeps the parts of Frag outside Brush in Kept and frees the rest. A part
+  //  lying on the brush's surface is kept if it faces the same way and
+  //  Keep_on says so; facing the other way, it is pressed between the two
+  //  and dropped.
+  //
+  static void clip_to_brush (Polygon* frag, const Brush& brush, bool keep_on, ArenaSpan <Polygon*>* kept)
+  {
+    Polygon* rest = frag;
+    
+    for (unsigned k = 0; k != brush.plane_count; k++)
+    {
+      Plane plane (brush.planes [k].normal, brush.planes [k].distance);
+      
+      if (is_polygon_in (*rest, plane))
+      {
+        if (keep_on && dot (rest -> normal (), plane.normal) > 0.0)
+        {
+          kept -> push (rest);
+          return;
+        }
+        
+        continue;
+      }
+      
+      PlaneSide side = polygon_side (plane, *rest);
+      
+      if (side == plane_side_front)
+      {
+        kept -> push (rest);
+        return;
+      }
+      
+      if (side == plane_side_back)
+        continue;
+      
+      Polygon* fore = polygon_alloc ();
+      Polygon* rear = polygon_alloc ();
+      split_poly (rest, &plane, fore, rear);
+      polygon_free (rest);
+      kept -> push (fore);
+      rest = rear;
+    }
+    
+    // Inside
+    polygon_free (rest);
+  }
+  
+  //
+  // add_hull
+  // Six faces of a box around Bounds, facing in.
+  //
+  static void add_hull (const Bounds& bounds, ArenaSpan <Polygon*>* polys)
+  {
+    Vector3 lo = bounds.mins - Vector3 (brush_hull_margin, brush_hull_margin, brush_hull_margin);
+    Vector3 hi = bounds.maxs + Vector3 (brush_hull_margin, brush_hull_margin, brush_hull_margin);
+    
+    const Vector3 corners [8] = {
+      Vector3 (lo.x, lo.y, lo.z), Vector3 (hi.x, lo.y, lo.z),
+      Vector3 (hi.x, hi.y, lo.z), Vector3 (lo.x, hi.y, lo.z),
+      Vector3 (lo.x, lo.y, hi.z), Vector3 (hi.x, lo.y, hi.z),
+      Vector3 (hi.x, hi.y, hi.z), Vector3 (lo.x, hi.y, hi.z)
+    };
+    
+    static const unsigned sides [6][4] = {
+      { 0, 1, 2, 3 }, { 4, 5, 6, 7 },
+      { 0, 1, 5, 4 }, { 2, 3, 7, 6 },
+      { 0, 4, 7, 3 }, { 1, 2, 6, 5 }
+    };
+    
+    Vector3 centre = (lo + hi) * 0.5;
+    
+    for (unsigned s = 0; s != 6; s++)
+    {
+      Polygon* side = polygon_alloc ();
+      for (unsigned c = 0; c != 4; c++)
+        side -> add_vertex (corners [sides [s][c]]);
+      
+      // Face into the box
+      if (dot (side -> normal (), centre - side -> begin () [0]) < 0.0)
+      {
+        side -> clear ();
+        for (unsigned c = 4; c != 0; c--)
+          side -> add_vertex (corners [sides [s][c - 1]]);
+      }
+      
+      polys -> push (side);
+    }
+  }
+  
+  //
+  // brush_polygons
+  //
+  Polygon* brush_polygons (const Brush* brushes, unsigned brush_count, unsigned* count, BrushStats* stats)
+  {
+    assert (brushes || !brush_count);
+    assert (count);
+    assert (stats);
+    
+    stats -> brushes = brush_count;
+    stats -> empty   = 0;
+    stats -> faces   = 0;
+    stats -> hidden  = 0;
+    
+    // Faces of each brush, at face_start [b] to face_start [b + 1]
+    ArenaSpan <Polygon*> faces;
+    unsigned* face_start = new unsigned [brush_count + 1];
+    Bounds* bounds = new Bounds [brush_count];
+    Bounds all;
+    
+    for (unsigned b = 0; b != brush_count; b++)
+    {
+      face_start [b] = faces.size ();
+      make_brush_faces (brushes [b], &faces, &bounds [b]);
+      
+      // Its bounds are still empty, and would stretch the hull to 1E16
+      if (face_start [b] == faces.size ())
+      {
+        stats -> empty++;
+        continue;
+      }
+      
+      all.add (bounds [b].mins);
+      all.add (bounds [b].maxs);
+    }
+    
+    face_start [brush_count] = faces.size ();
+    stats -> faces = faces.size ();
+    
+    ArenaSpan <Polygon*> result;
+    ArenaSpan <Polygon*> detail; // To follow Result
+    ArenaSpan <Polygon*> frags;
+    ArenaSpan <Polygon*> kept;
+    
+    for (unsigned b = 0; b != brush_count; b++)
+    {
+      for (unsigned f = face_start [b]; f != face_start [b + 1]; f++)
+      {
+        frags.clear ();
+        frags.push (faces.begin () [f]);
+        
+        for (unsigned other = 0; other != brush_count && !frags.empty (); other++)
+        {
+          if (other == b || !bounds [other].touches (bounds [b]))
+            continue;
+          
+          if (brushes [other].detail && !brushes [b].detail)
+            continue;
+          
+          // Where two brushes share a surface, the first one keeps it
+          bool keep_on = b < other;
+          
+          kept.clear ();
+          for (Polygon** frag = frags.begin (); frag != frags.end (); frag++)
+            clip_to_brush (*frag, brushes [other], keep_on, &kept);
+          
+          frags.clear ();
+          for (Polygon** frag = kept.begin (); frag != kept.end (); frag++)
+            frags.push (*frag);
+        }
+        
+        if (frags.empty ())
+          stats -> hidden++;
+        
+        ArenaSpan <Polygon*>* into = brushes [b].detail ? &detail : &result;
+        for (Polygon** frag = frags.begin (); frag != frags.end (); frag++)
+          into -> push (*frag);
+      }
+    }
+    
+    stats -> polys = result.size () + detail.size ();
+    stats -> detail = detail.size ();
+    
+    if (stats -> empty != brush_count)
+      add_hull (all, &result);
+    
+    for (Polygon** p = detail.begin (); p != detail.end (); p++)
+      result.push (*p);
+    
+    // Faces start out as squares on their planes, so anything reaching
+    //  their edge may have been cut short; see plane_poly_extent
+    stats -> too_far = 0;
+    for (Polygon** p = result.begin (); p != result.end (); p++)
+    {
+      for (const Vector3* v = (*p) -> begin (); v != (*p) -> end (); v++)
+      {
+        if (v -> length () >= plane_poly_extent)
+        {
+          stats -> too_far++;
+          break;
+        }
+      }
+    }
+    
+    if (stats -> too_far)
+    {
+      for (Polygon** p = result.begin (); p != result.end (); p++)
+        polygon_free (*p);
+      
+      delete [] bounds;
+      delete [] face_start;
+      
+      *count = 0;
+      return 0;
+    }
+    
+    *count = result.size ();
+    Polygon* polys = new Polygon [*count];
+    for (unsigned i = 0; i != *count; i++)
+    {
+      polys [i] = *result.begin () [i];
+      polygon_free (result.begin () [i]);
+    }
+    
+    delete [] bounds;
+    delete [] face_start;
+    
+    return polys;
+  }
+  
+}
@@ -0,0 +1,83 @@
+//
+// Copyright (C) 2009 Roadkill Software
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+
+
+#ifndef INDOOR_H_BRUSH
+#define INDOOR_H_BRUSH
+
+#include "Polygon.hpp"
+
+namespace In
+{
+  //
+  // Brush
+  // Convex solid, the intersection of the spaces behind its planes. Plane
+  //  normals point out of the brush.
+  //
+  struct BrushPlane
+  {
+    Vector3 normal;
+    double distance;
+    
+  };
+  
+  struct Brush
+  {
+    const BrushPlane* planes;
+    unsigned plane_count;
+    bool detail;
+    
+  };
+  
+  //
+  // BrushStats
+  //
+  struct BrushStats
+  {
+    unsigned brushes;
+    unsigned empty;  // Making no faces, so left out of the union and hull
+    unsigned faces;  // Of all the brushes, before the union
+    unsigned hidden; // Faces entirely inside other brushes
+    unsigned polys;  // Left after the union, the hull not included
+    unsigned detail; //  of which detail, returned last, after the hull
+    unsigned too_far; // Reaching plane_poly_extent; if any, there's no union
+    
+  };
+  
+  //
+  // brush_polygons
+  // Takes the CSG union of Brushes and returns its visible surface, ready
+  //  for world_compile, in an array of *Count polygons to be delete[]d.
+  //  Detail brushes' faces come last, as CompileOptions::detail_count has
+  //  them; BrushStats::detail counts them.
+  //  Faces inside other brushes, or pressed against them, are removed.
+  //  Structural faces are only clipped by structural brushes, so detail
+  //  never opens a hole. Brushes whose planes leave no space make no faces;
+  //  they're skipped, and BrushStats::empty counts them.
+  // Polygons can't reach plane_poly_extent from the origin; if any would,
+  //  there's no result and BrushStats::too_far counts them.
+  // A box enclosing everything is added as the convex hull world_compile
+  //  needs. The space between it and the brushes fills as outside, so the
+  //  brushes themselves can make any shape.
+  //
+  Polygon* brush_polygons (const Brush* brushes, unsigned brush_count, unsigned* count, BrushStats* stats);
+  
+}
+
+#endif
@@ -0,0 +1,434 @@
+//
+// Copyright (C) 2009 Roadkill Software
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+
+
+#include "Cache.hpp"
+#include "World.hpp"
+#include "Hash.hpp"
+
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+
+namespace In
+{
+  //
+  // CacheEntry
+  //
+  struct CacheEntry
+  {
+    rku64 key;
+    unsigned long size;
+    unsigned long stamp; // Larger is more recently used
+    
+  };
+  
+  //
+  // CompileCache
+  //
+# define cache_max_path 512
+  
+  struct CompileCache
+  {
+    char directory [cache_max_path];
+    
+    unsigned long max_bytes;
+    unsigned long total_bytes;
+    unsigned long clock;
+    
+    CacheEntry* entries;
+    unsigned entry_count;
+    unsigned entry_capacity;
+    
+    unsigned hits, misses;
+    
+  };
+  
+  //
+  // cache_path
+  //
+  static void cache_path (const CompileCache* cache, rku64 key, char* path)
+  {
+    sprintf (path, "%s/%016llx.indoor", cache -> directory, (unsigned long long) key);
+  }
+  
+  //
+  // cache_index_path
+  //
+  static void cache_index_path (const CompileCache* cache, char* path)
+  {
+    sprintf (path, "%s/index.txt", cache -> directory);
+  }
+  
+  //
+  // copy_file
+  // Returns the number of bytes copied, or -1 on failure.
+  //
+  static long copy_file (const char* from, const char* to)
+  {
+    FILE* in = fopen (from, "rb");
+    if (!in)
+      return -1;
+    
+    FILE* out = fopen (to, "wb");
+    if (!out)
+    {
+      fclose (in);
+      return -1;
+    }
+    
+    char buffer [65536];
+    long total = 0;
+    
+    for (;;)
+    {
+      size_t got = fread (buffer, 1, sizeof (buffer), in);
+      if (!got)
+        break;
+      
+      if (fwrite (buffer, 1, got, out) != got)
+      {
+        total = -1;
+        break;
+      }
+      
+      total += got;
+    }
+    
+    if (ferror (in))
+      total = -1;
+    
+    fclose (in);
+    if (fclose (out))
+      total = -1;
+    
+    return total;
+  }
+  
+  //
+  // cache_find
+  //
+  static CacheEntry* cache_find (CompileCache* cache, rku64 key)
+  {
+    for (CacheEntry*
+      e  = cache -> entries;
+      e != cache -> entries + cache -> entry_count;
+      e++)
+    {
+      if (e -> key == key)
+        return e;
+    }
+    
+    return 0;
+  }
+  
+  //
+  // cache_add
+  //
+  static CacheEntry* cache_add (CompileCache* cache, rku64 key, unsigned long size, unsigned long stamp)
+  {
+    if (cache -> entry_count == cache -> entry_capacity)
+    {
+      unsigned new_capacity = cache -> entry_capacity ? cache -> entry_capacity * 2 : 64;
+      CacheEntry* new_entries = new CacheEntry [new_capacity];
+      
+      for (unsigned i = 0; i != cache -> entry_count; i++)
+        new_entries [i] = cache -> entries [i];
+      
+      delete [] cache -> entries;
+      cache -> entries = new_entries;
+      cache -> entry_capacity = new_capacity;
+    }
+    
+    CacheEntry* entry = cache -> entries + cache -> entry_count++;
+    entry -> key   = key;
+    entry -> size  = size;
+    entry -> stamp = stamp;
+    
+    cache -> total_bytes += size;
+    if (stamp > cache -> clock)
+      cache -> clock = stamp;
+    
+    return entry;
+  }
+  
+  //
+  // cache_remove
+  // Deletes the entry's file as well.
+  //
+  static void cache_remove (CompileCache* cache, CacheEntry* entry)
+  {
+    char path [cache_max_path + 32];
+    cache_path (cache, entry -> key, path);
+    remove (path);
+    
+    cache -> total_bytes -= entry -> size;
+    *entry = cache -> entries [--cache -> entry_count];
+  }
+  
+  //
+  // cache_evict
+  // Drops least recently used entries until the cache fits.
+  //
+  static void cache_evict (CompileCache* cache)
+  {
+    while (cache -> total_bytes > cache -> max_bytes && cache -> entry_count)
+    {
+      CacheEntry* oldest = cache -> entries;
+      
+      for (CacheEntry*
+        e  = cache -> entries;
+        e != cache -> entries + cache -> entry_count;
+        e++)
+      {
+        if (e -> stamp < oldest -> stamp)
+          oldest = e;
+      }
+      
+      cache_remove (cache, oldest);
+    }
+  }
+  
+  //
+  // cache_save_index
+  //
+  static bool cache_save_index (const CompileCache* cache)
+  {
+    char path [cache_max_path + 32];
+    cache_index_path (cache, path);
+    
+    FILE* file = fopen (path, "w");
+    if (!file)
+      return false;
+    
+    fprintf (file, "indoorcache 1 %u %u\n", cache -> hits, cache -> misses);
+    
+    for (const CacheEntry*
+      e  = cache -> entries;
+      e != cache -> entries + cache -> entry_count;
+      e++)
+    {
+      fprintf (file, "%016llx %lu %lu\n", (unsigned long long) e -> key, e -> size, e -> stamp);
+    }
+    
+    bool ok = !ferror (file);
+    if (fclose (file))
+      ok = false;
+    
+    return ok;
+  }
+  
+  //
+  // cache_load_index
+  // A missing index is an empty cache. Entries are trusted; a missing file
+  //  shows up later as a miss. Hit and miss counts carry across runs.
+  //
+  static void cache_load_index (CompileCache* cache)
+  {
+    char path [cache_max_path + 32];
+    cache_index_path (cache, path);
+    
+    FILE* file = fopen (path, "r");
+    if (!file)
+      return;
+    
+    unsigned version, hits, misses;
+    if (fscanf (file, "indoorcache %u %u %u\n", &version, &hits, &misses) != 3 || version != 1)
+    {
+      fclose (file);
+      return;
+    }
+    
+    cache -> hits   = hits;
+    cache -> misses = misses;
+    
+    unsigned long long key;
+    unsigned long size, stamp;
+    
+    while (fscanf (file, "%llx %lu %lu\n", &key, &size, &stamp) == 3)
+      cache_add (cache, key, size, stamp);
+    
+    fclose (file);
+  }
+  
+  //
+  // cache_open
+  // The directory must already exist.
+  //
+  CompileCache* cache_open (const char* directory, unsigned long max_bytes)
+  {
+    assert (directory);
+    
+    if (strlen (directory) >= cache_max_path)
+      return 0;
+    
+    CompileCache* cache = new CompileCache;
+    strcpy (cache -> directory, directory);
+    cache -> max_bytes      = max_bytes;
+    cache -> total_bytes    = 0;
+    cache -> clock          = 0;
+    cache -> entries        = 0;
+    cache -> entry_count    = 0;
+    cache -> entry_capacity = 0;
+    cache -> hits           = 0;
+    cache -> misses         = 0;
+    
+    cache_load_index (cache);
+    cache_evict (cache);
+    
+    if (!cache_save_index (cache))
+    {
+      cache_close (cache);
+      return 0;
+    }
+    
+    return cache;
+  }
+  
+  //
+  // cache_close
+  //
+  void cache_close (CompileCache* cache)
+  {
+    if (!cache)
+      return;
+    
+    delete [] cache -> entries;
+    delete cache;
+  }
+  
+  //
+  // cache_key
+  // Options is whatever configuration the caller compiles with, as raw bytes.
+  //  The last Detail count polygons are detail, as in CompileOptions.
+  //
+  rku64 cache_key (const Polygon* polys, unsigned count, unsigned detail_count, const void* options, unsigned options_size)
+  {
+    assert (polys || !count);
+    
+    rku64 hash = hash_seed;
+    
+    rku32 version = indoor_compiler_version;
+    hash = hash_bytes (hash, &version, sizeof (version));
+    rku32 precision = sizeof (Scalar);
+    hash = hash_bytes (hash, &precision, sizeof (precision));
+    hash = hash_bytes (hash, &options_size, sizeof (options_size));
+    if (options)
+      hash = hash_bytes (hash, options, options_size);
+    
+    hash = hash_bytes (hash, &count, sizeof (count));
+    hash = hash_bytes (hash, &detail_count, sizeof (detail_count));
+    
+    for (const Polygon*
+      p  = polys;
+      p != polys + count;
+      p++)
+    {
+      unsigned size = p -> size ();
+      hash = hash_bytes (hash, &size, sizeof (size));
+      
+      for (const Vector3*
+        v  = p -> begin ();
+        v != p -> end   ();
+        v++)
+      {
+        hash = hash_bytes (hash, &v -> x, sizeof (v -> x));
+        hash = hash_bytes (hash, &v -> y, sizeof (v -> y));
+        hash = hash_bytes (hash, &v -> z, sizeof (v -> z));
+      }
+    }
+    
+    return hash;
+  }
+  
+  //
+  // cache_fetch
+  // Copies the stored output for Key to Filename. Returns false on a miss.
+  //
+  bool cache_fetch (CompileCache* cache, rku64 key, const char* filename)
+  {
+    assert (cache);
+    assert (filename);
+    
+    CacheEntry* entry = cache_find (cache, key);
+    
+    if (entry)
+    {
+      char path [cache_max_path + 32];
+      cache_path (cache, key, path);
+      
+      if (copy_file (path, filename) == long (entry -> size))
+      {
+        entry -> stamp = ++cache -> clock;
+        cache -> hits++;
+        cache_save_index (cache);
+        return true;
+      }
+      
+      // Stored file is gone or damaged
+      cache_remove (cache, entry);
+    }
+    
+    cache -> misses++;
+    cache_save_index (cache);
+    return false;
+  }
+  
+  //
+  // cache_store
+  // Copies Filename into the cache under Key.
+  //
+  bool cache_store (CompileCache* cache, rku64 key, const char* filename)
+  {
+    assert (cache);
+    assert (filename);
+    
+    CacheEntry* old = cache_find (cache, key);
+    if (old)
+      cache_remove (cache, old);
+    
+    char path [cache_max_path + 32];
+    cache_path (cache, key, path);
+    
+    long size = copy_file (filename, path);
+    if (size < 0)
+    {
+      remove (path);
+      return false;
+    }
+    
+    cache_add (cache, key, size, cache -> clock + 1);
+    cache_evict (cache);
+    
+    return cache_save_index (cache);
+  }
+  
+  //
+  // cache_stats
+  //
+  void cache_stats (const CompileCache* cache, unsigned* hits, unsigned* misses, unsigned long* bytes)
+  {
+    assert (cache);
+    
+    if (hits)   *hits   = cache -> hits;
+    if (misses) *misses = cache -> misses;
+    if (bytes)  *bytes  = cache -> total_bytes;
+  }
+  
+}
@@ -0,0 +1,50 @@
+//
+// Copyright (C) 2009 Roadkill Software
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+
+
+#ifndef INDOOR_H_CACHE
+#define INDOOR_H_CACHE
+
+#include "Polygon.hpp"
+
+#include <Rk/Types.hpp>
+
+namespace In
+{
+  //
+  // CompileCache
+  // Content-addressed store of compiled .indoor files in a local directory,
+  //  keyed on the input polygons, the compile options and the compiler
+  //  version. Least recently used entries are evicted past max_bytes.
+  //
+  struct CompileCache;
+  
+  CompileCache* cache_open  (const char* directory, unsigned long max_bytes);
+  void          cache_close (CompileCache* cache);
+  
+  rku64 cache_key (const Polygon* polys, unsigned count, unsigned detail_count, const void* options = 0, unsigned options_size = 0);
+  
+  bool cache_fetch (CompileCache* cache, rku64 key, const char* filename);
+  bool cache_store (CompileCache* cache, rku64 key, const char* filename);
+  
+  void cache_stats (const CompileCache* cache, unsigned* hits, unsigned* misses, unsigned long* bytes);
+  
+}
+
+#endif
@@ -0,0 +1,503 @@
+//
+// Copyright (C) 2009 Roadkill Software
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+
+
+#include "Clean.hpp"
+#include "Thread.hpp"
+
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+
+namespace In
+{
+# define clean_epsilon 0.00001
+  
+  //
+  // same_vertex
+  //
+  static inline bool same_vertex (const Vector3& a, const Vector3& b)
+  {
+    return a.x == b.x && a.y == b.y && a.z == b.z;
+  }
+  
+  //
+  // snap
+  // Adding 0.0 turns -0.0 into 0.0, so equal vertices hash equally.
+  //
+  static inline double snap (double x, double grid)
+  {
+    if (grid == 0.0)
+      return x + 0.0;
+    
+    return floor (x / grid + 0.5) * grid + 0.0;
+  }
+  
+  //
+  // newell_normal
+  // Unnormalized, and safe for polygons whose first vertices are collinear.
+  //
+  static Vector3 newell_normal (const Polygon& poly)
+  {
+    Vector3 n;
+    
+    const Vector3* prev = poly.end () - 1;
+    for (const Vector3* cur = poly.begin (); cur != poly.end (); prev = cur++)
+    {
+      n.x += (prev -> y - cur -> y) * (prev -> z + cur -> z);
+      n.y += (prev -> z - cur -> z) * (prev -> x + cur -> x);
+      n.z += (prev -> x - cur -> x) * (prev -> y + cur -> y);
+    }
+    
+    return n;
+  }
+  
+  //
+  // KeySet
+  // Open-addressed set of 64-bit keys, for counting distinct planes.
+  //
+  struct KeySet
+  {
+    rku64* keys;
+    rku8* used;
+    unsigned mask;
+    unsigned count;
+    
+    KeySet (unsigned capacity) :
+      count (0)
+    {
+      unsigned size = 16;
+      while (size < capacity * 2)
+        size <<= 1;
+      
+      keys = new rku64 [size];
+      used = new rku8  [size];
+      mask = size - 1;
+      
+      for (unsigned i = 0; i != size; i++)
+        used [i] = 0;
+    }
+    
+    ~KeySet ()
+    {
+      delete [] keys;
+      delete [] used;
+    }
+    
+    void insert (rku64 key)
+    {
+      unsigned slot = unsigned (key) & mask;
+      while (used [slot])
+      {
+        if (keys [slot] == key)
+          return;
+        slot = (slot + 1) & mask;
+      }
+      
+      keys [slot] = key;
+      used [slot] = 1;
+      count++;
+    }
+    
+  };
+  
+  //
+  // plane_key
+  // Quantized so that faces on the same plane, give or take rounding, agree.
+  //
+  static rku64 plane_key (const Polygon& poly)
+  {
+    Vector3 n = newell_normal (poly);
+    double length = sqrt (n.x * n.x + n.y * n.y + n.z * n.z);
+    if (length == 0.0)
+      return 0;
+    
+    n = n * (1.0 / length);
+    double d = n.x * poly.begin () -> x + n.y * poly.begin () -> y + n.z * poly.begin () -> z;
+    
+    rki64 q [4] = {
+      rki64 (floor (n.x * 10000.0 + 0.5)),
+      rki64 (floor (n.y * 10000.0 + 0.5)),
+      rki64 (floor (n.z * 10000.0 + 0.5)),
+      rki64 (floor (d   *  1000.0 + 0.5))
+    };
+    
+    return hash_bytes (hash_seed, q, sizeof (q));
+  }
+  
+  //
+  // count_planes
+  //
+  static unsigned count_planes (const Polygon* polys, unsigned count)
+  {
+    KeySet planes (count);
+    
+    for (unsigned i = 0; i != count; i++)
+    {
+      if (polys [i].size () >= 3)
+        planes.insert (plane_key (polys [i]));
+    }
+    
+    return planes.count;
+  }
+  
+  //
+  // clean_vertices
+  // Copies In to Out snapped, without repeated or collinear vertices.
+  //  Returns the number of vertices dropped.
+  //
+  static unsigned clean_vertices (const Polygon& in, double grid, Polygon& out)
+  {
+    out.clear ();
+    out.reserve (in.size ());
+    
+    for (const Vector3* v = in.begin (); v != in.end (); v++)
+    {
+      Vector3 p (snap (v -> x, grid), snap (v -> y, grid), snap (v -> z, grid));
+      if (out.empty () || !same_vertex (p, out.end () [-1]))
+        out.add_vertex (p);
+    }
+    
+    while (out.size () > 1 && same_vertex (out.begin () [0], out.end () [-1]))
+      out.pop_vertex ();
+    
+    // Collinear removal can expose more, so go until nothing changes
+    for (bool changed = true; changed && out.size () >= 3;)
+    {
+      changed = false;
+      
+      unsigned size = out.size ();
+      Vector3* verts = out.begin ();
+      
+      for (unsigned i = 0; i != size && size >= 3; i++)
+      {
+        const Vector3& prev = verts [(i + size - 1) % size];
+        const Vector3& cur  = verts [i];
+        const Vector3& next = verts [(i + 1) % size];
+        
+        Vector3 edge = next - prev;
+        double edge_length = edge.length ();
+        
+        bool collinear;
+        if (edge_length < clean_epsilon)
+          collinear = true; // Spike back onto prev
+        else
+          collinear = cross (cur - prev, edge).length () / edge_length < clean_epsilon;
+        
+        if (!collinear)
+          continue;
+        
+        for (unsigned j = i; j + 1 != size; j++)
+          verts [j] = verts [j + 1];
+        out.pop_vertex ();
+        size--;
+        i--;
+        changed = true;
+      }
+    }
+    
+    return in.size () - out.size ();
+  }
+  
+  //
+  // face_hash
+  // Independent of the starting vertex and of winding.
+  //
+  static rku64 face_hash (const Polygon& poly)
+  {
+    rku64 sum = 0;
+    for (const Vector3* v = poly.begin (); v != poly.end (); v++)
+    {
+      double xyz [3] = { v -> x, v -> y, v -> z };
+      sum += hash_bytes (hash_seed, xyz, sizeof (xyz));
+    }
+    
+    unsigned size = poly.size ();
+    return hash_bytes (sum, &size, sizeof (size));
+  }
+  
+  //
+  // face_match
+  // 1 if A and B are the same face, -1 if they are the same face wound the
+  //  other way, or 0.
+  //
+  static int face_match (const Polygon& a, const Polygon& b)
+  {
+    unsigned size = a.size ();
+    if (b.size () != size)
+      return 0;
+    
+    const Vector3* av = a.begin ();
+    const Vector3* bv = b.begin ();
+    
+    unsigned start = 0;
+    while (start != size && !same_vertex (bv [start], av [0]))
+      start++;
+    
+    if (start == size)
+      return 0;
+    
+    bool forward = true, backward = true;
+    for (unsigned i = 1; i != size; i++)
+    {
+      if (!same_vertex (av [i], bv [(start + i) % size]))
+        forward = false;
+      if (!same_vertex (av [i], bv [(start + size - i) % size]))
+        backward = false;
+    }
+    
+    return forward ? 1 : backward ? -1 : 0;
+  }
+  
+  //
+  // clean_run_begin
+  //
+  void clean_run_begin (CleanRun* run, const Polygon* polys, unsigned count, unsigned detail_count, double grid, Polygon* out)
+  {
+    assert (run);
+    assert (polys || !count);
+    assert (out || !count);
+    assert (detail_count <= count);
+    
+    run -> polys     = polys;
+    run -> count     = count;
+    run -> detail_from = count - detail_count;
+    run -> next      = 0;
+    run -> grid      = grid;
+    run -> out       = out;
+    run -> out_count = 0;
+    
+    CleanStats& stats = run -> stats;
+    stats.faces_in     = count;
+    stats.faces_out    = 0;
+    stats.detail_out   = 0;
+    stats.duplicates   = 0;
+    stats.back_to_back = 0;
+    stats.degenerate   = 0;
+    stats.vertices     = 0;
+    stats.planes_in    = count_planes (polys, count);
+    stats.planes_out   = 0;
+    
+    unsigned size = 16;
+    while (size < count * 2)
+      size <<= 1;
+    
+    run -> size   = size;
+    run -> slots  = new unsigned [size];
+    run -> hashes = new rku64 [count];
+    run -> dead   = new bool [count];
+    run -> detail = new bool [count];
+    for (unsigned i = 0; i != size; i++)
+      run -> slots [i] = ~0u;
+  }
+  
+  //
+  // clean_run_step
+  // Cleans faces until all are done, returning true, or until thread_clock
+  //  passes Deadline, if it isn't 0.
+  //
+  bool clean_run_step (CleanRun* run, double deadline)
+  {
+    assert (run);
+    assert (run -> slots);
+    
+    const Polygon* polys = run -> polys;
+    Polygon* out = run -> out;
+    CleanStats* stats = &run -> stats;
+    
+    unsigned  size   = run -> size;
+    unsigned* slots  = run -> slots;
+    rku64*    hashes = run -> hashes;
+    bool*     dead   = run -> dead;
+    bool*     detail = run -> detail;
+    
+    unsigned done = 0;
+    
+    for (; run -> next != run -> count; run -> next++)
+    {
+      // Always at least one, so every step gets somewhere
+      if (done++ && deadline != 0.0 && thread_clock () > deadline)
+        return false;
+      
+      Polygon& poly = out [run -> out_count];
+      bool poly_detail = run -> next >= run -> detail_from;
+      stats -> vertices += clean_vertices (polys [run -> next], run -> grid, poly);
+      
+      if (poly.size () < 3 || newell_normal (poly).length () < clean_epsilon)
+      {
+        stats -> degenerate++;
+        poly.clear ();
+        continue;
+      }
+      
+      rku64 hash = face_hash (poly);
+      
+      unsigned slot = unsigned (hash) & (size - 1);
+      bool drop = false;
+      
+      // Where one of a pair is detail, the structural one is what seals
+      //  the map, so it's the one kept
+      for (; slots [slot] != ~0u; slot = (slot + 1) & (size - 1))
+      {
+        unsigned other = slots [slot];
+        if (hashes [other] != hash || dead [other])
+          continue;
+        
+        int match = face_match (out [other], poly);
+        if (!match)
+          continue;
+        
+        if (match > 0)
+        {
+          // Same face; it stays structural if either copy was
+          if (!poly_detail)
+            detail [other] = false;
+          
+          stats -> duplicates++;
+          drop = true;
+        }
+        else if (detail [other] == poly_detail)
+        {
+          // A zero-thickness wall; neither side can be seen
+          dead [other] = true;
+          stats -> back_to_back += 2;
+          drop = true;
+        }
+        else if (poly_detail)
+        {
+          // Detail flush against a wall
+          stats -> back_to_back++;
+          drop = true;
+        }
+        else
+        {
+          dead [other] = true;
+          stats -> back_to_back++;
+          continue;
+        }
+        
+        break;
+      }
+      
+      if (drop)
+      {
+        poly.clear ();
+        continue;
+      }
+      
+      slots  [slot] = run -> out_count;
+      hashes [run -> out_count] = hash;
+      dead   [run -> out_count] = false;
+      detail [run -> out_count] = poly_detail;
+      run -> out_count++;
+    }
+    
+    // Close up the gaps left by back-to-back pairs, and hold the detail
+    //  back to follow the structural faces, each in their order
+    unsigned held_count = 0;
+    for (unsigned i = 0; i != run -> out_count; i++)
+    {
+      if (!dead [i] && detail [i])
+        held_count++;
+    }
+    
+    Polygon* held = new Polygon [held_count];
+    held_count = 0;
+    
+    unsigned kept = 0;
+    for (unsigned i = 0; i != run -> out_count; i++)
+    {
+      if (dead [i])
+        continue;
+      
+      if (detail [i])
+      {
+        held [held_count++] = out [i];
+        continue;
+      }
+      
+      if (kept != i)
+        out [kept] = out [i];
+      kept++;
+    }
+    
+    for (unsigned i = 0; i != held_count; i++)
+      out [kept++] = held [i];
+    
+    delete [] held;
+    
+    for (unsigned i = kept; i != run -> count; i++)
+      out [i].release ();
+    
+    clean_run_free (run);
+    
+    stats -> faces_out  = kept;
+    stats -> detail_out = held_count;
+    stats -> planes_out = count_planes (out, kept);
+    
+    return true;
+  }
+  
+  //
+  // clean_run_free
+  //
+  void clean_run_free (CleanRun* run)
+  {
+    assert (run);
+    
+    delete [] run -> detail;
+    delete [] run -> dead;
+    delete [] run -> hashes;
+    delete [] run -> slots;
+    run -> detail = 0;
+    run -> dead   = 0;
+    run -> hashes = 0;
+    run -> slots  = 0;
+  }
+  
+  //
+  // clean_polygons
+  //
+  unsigned clean_polygons (const Polygon* polys, unsigned count, unsigned detail_count, double grid, Polygon* out, CleanStats* stats)
+  {
+    assert (stats);
+    
+    CleanRun run;
+    clean_run_begin (&run, polys, count, detail_count, grid, out);
+    clean_run_step (&run, 0.0);
+    
+    *stats = run.stats;
+    return stats -> faces_out;
+  }
+  
+  //
+  // clean_describe
+  //
+  void clean_describe (const CleanStats* stats, char* message)
+  {
+    assert (stats);
+    assert (message);
+    
+    sprintf (message, "Removed %u of %u faces (%u duplicate, %u back-to-back, %u degenerate), %u vertices and %u of %u planes",
+      stats -> faces_in - stats -> faces_out, stats -> faces_in,
+      stats -> duplicates, stats -> back_to_back, stats -> degenerate,
+      stats -> vertices, stats -> planes_in - stats -> planes_out, stats -> planes_in);
+  }
+  
+}
@@ -0,0 +1,97 @@
+//
+// Copyright (C) 2009 Roadkill Software
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+
+
+#ifndef INDOOR_H_CLEAN
+#define INDOOR_H_CLEAN
+
+#include "Polygon.hpp"
+#include "Hash.hpp"
+
+namespace In
+{
+  //
+  // CleanStats
+  //
+  struct CleanStats
+  {
+    unsigned faces_in, faces_out;
+    unsigned detail_out;   // Of faces_out, the last this many are detail
+    unsigned duplicates;   // Faces repeated exactly
+    unsigned back_to_back; // Coincident faces of opposite winding dropped
+    unsigned degenerate;   // Under three vertices or no area
+    unsigned vertices;     // Repeated or collinear vertices dropped
+    unsigned planes_in, planes_out;
+    
+  };
+  
+  //
+  // clean_polygons
+  // Snaps vertices to Grid, if it isn't 0, then drops repeated and collinear
+  //  vertices, degenerate faces, duplicate faces and back-to-back pairs.
+  //  The last Detail_count of Polys are detail, and those kept are written
+  //  last in turn; CleanStats::detail_out counts them. A structural face is
+  //  never dropped for a detail one: of duplicates the copy kept is
+  //  structural if either was, and a detail face back to back with a
+  //  structural one goes alone. Out must have room for Count polygons.
+  //  Returns the number written.
+  //
+  unsigned clean_polygons (const Polygon* polys, unsigned count, unsigned detail_count, double grid, Polygon* out, CleanStats* stats);
+  
+  //
+  // CleanRun
+  // clean_polygons a slice at a time, for compile_step. Polys and Out must
+  //  stay valid until clean_run_step returns true, when Stats is complete
+  //  and Stats.faces_out polygons have been written. clean_run_free drops
+  //  a run that won't be finished.
+  //
+  struct CleanRun
+  {
+    const Polygon* polys;
+    unsigned count;
+    unsigned detail_from; // The first detail face of Polys
+    unsigned next; // Face to clean next
+    double grid;
+    Polygon* out;
+    unsigned out_count;
+    
+    // Faces by hash, for spotting duplicates; ~0u is an empty slot
+    unsigned* slots;
+    unsigned size;
+    rku64* hashes;
+    bool* dead;
+    bool* detail;
+    
+    CleanStats stats;
+    
+  };
+  
+  void clean_run_begin (CleanRun* run, const Polygon* polys, unsigned count, unsigned detail_count, double grid, Polygon* out);
+  bool clean_run_step  (CleanRun* run, double deadline);
+  void clean_run_free  (CleanRun* run);
+  
+  //
+  // clean_describe
+  // One line for a status callback. Message needs 192 bytes.
+  //
+  void clean_describe (const CleanStats* stats, char* message);
+  
+}
+
+#endif
@@ -0,0 +1,219 @@
+//
+// Copyright (C) 2009 Roadkill Software
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+
+
+#include "Distribute.hpp"
+
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+# define WIN32_LEAN_AND_MEAN 1
+# include <windows.h>
+#else
+# include <sys/types.h>
+# include <sys/wait.h>
+# include <unistd.h>
+#endif
+
+namespace In
+{
+  //
+  // WorkerProcess
+  //
+#ifdef _WIN32
+  typedef HANDLE WorkerProcess;
+#else
+  typedef pid_t WorkerProcess;
+#endif
+  
+  //
+  // worker_spawn
+  //
+  static bool worker_spawn (const char* exe, const char* job, const char* subtree, WorkerProcess* process)
+  {
+#ifdef _WIN32
+    char command [2048];
+    _snprintf (command, sizeof (command), "\"%s\" --worker \"%s\" \"%s\"", exe, job, subtree);
+    command [sizeof (command) - 1] = 0;
+    
+    STARTUPINFOA startup;
+    memset (&startup, 0, sizeof (startup));
+    startup.cb = sizeof (startup);
+    
+    PROCESS_INFORMATION info;
+    if (!CreateProcessA (0, command, 0, 0, FALSE, 0, 0, 0, &startup, &info))
+      return false;
+    
+    CloseHandle (info.hThread);
+    *process = info.hProcess;
+    return true;
+#else
+    pid_t pid = fork ();
+    if (pid < 0)
+      return false;
+    
+    // Searching PATH as the shell did, should Exe be a bare argv [0]
+    if (pid == 0)
+    {
+      char* args [] = { (char*) exe, (char*) "--worker", (char*) job, (char*) subtree, 0 };
+      execvp (exe, args);
+      _exit (127);
+    }
+    
+    *process = pid;
+    return true;
+#endif
+  }
+  
+  //
+  // worker_wait
+  // Blocks until one of the running processes exits and returns its index.
+  //
+  static unsigned worker_wait (const WorkerProcess* running, unsigned count)
+  {
+    assert (count);
+    
+#ifdef _WIN32
+    DWORD result = WaitForMultipleObjects (count, running, FALSE, INFINITE);
+    unsigned index = result - WAIT_OBJECT_0;
+    if (index >= count)
+      index = 0;
+    
+    WaitForSingleObject (running [index], INFINITE);
+    CloseHandle (running [index]);
+    return index;
+#else
+    for (;;)
+    {
+      pid_t pid = waitpid (-1, 0, 0);
+      if (pid < 0)
+        return 0; // No children left; treat the first as done
+      
+      for (unsigned i = 0; i != count; i++)
+        if (running [i] == pid)
+          return i;
+    }
+#endif
+  }
+  
+  //
+  // world_compile_distributed
+  // This process partitions the top levels and grafts the workers' subtrees
+  //  under them; everything after partitioning runs once, on the whole tree.
+  //
+  World* world_compile_distributed (const Polygon* polys, unsigned count, unsigned workers, const char* worker_exe, const char* scratch_prefix, const CompileOptions& options)
+  {
+    assert (polys);
+    assert (worker_exe);
+    assert (scratch_prefix);
+    
+    if (workers < 1)
+      workers = 1;
+    
+#ifdef _WIN32
+    // worker_wait waits on them all at once
+    if (workers > MAXIMUM_WAIT_OBJECTS)
+      workers = MAXIMUM_WAIT_OBJECTS;
+#endif
+    
+    if (strlen (scratch_prefix) > 400)
+      return world_compile (polys, count, options);
+    
+    // About two jobs per worker evens out uneven subtrees
+    unsigned split_depth = 1;
+    while ((1u << split_depth) < workers * 2 && split_depth < 8)
+      split_depth++;
+    
+    char job_format     [512];
+    char subtree_format [512];
+    sprintf (job_format,     "%s%%u.job",  scratch_prefix);
+    sprintf (subtree_format, "%s%%u.tree", scratch_prefix);
+    
+    void (*status) (const char*) = options.status;
+    
+    CompileContext* context = compile_begin (polys, count, options);
+    unsigned job_count = compile_export_jobs (context, split_depth, job_format);
+    
+    if (job_count)
+    {
+      if (status)
+      {
+        char message [96];
+        sprintf (message, "Distributing %u jobs over %u workers", job_count, workers);
+        status (message);
+      }
+      
+      // Run the pool
+      WorkerProcess* running = new WorkerProcess [workers];
+      unsigned running_count = 0;
+      unsigned next_job = 0;
+      
+      while (next_job != job_count || running_count)
+      {
+        if (next_job != job_count && running_count != workers)
+        {
+          char job     [512];
+          char subtree [512];
+          sprintf (job,     job_format,     next_job);
+          sprintf (subtree, subtree_format, next_job);
+          next_job++;
+          
+          // Not one left from an earlier run. A job that won't start is
+          //  just partitioned here.
+          remove (subtree);
+          if (worker_spawn (worker_exe, job, subtree, &running [running_count]))
+            running_count++;
+          
+          continue;
+        }
+        
+        unsigned done = worker_wait (running, running_count);
+        running [done] = running [--running_count];
+      }
+      
+      delete [] running;
+      
+      unsigned grafted = compile_import_jobs (context, subtree_format);
+      
+      if (status)
+      {
+        char message [96];
+        sprintf (message, "Grafted %u of %u subtrees from workers", grafted, job_count);
+        status (message);
+      }
+      
+      for (unsigned i = 0; i != job_count; i++)
+      {
+        char name [512];
+        sprintf (name, job_format, i);
+        remove (name);
+        sprintf (name, subtree_format, i);
+        remove (name);
+      }
+    }
+    
+    while (compile_step (context, compile_unbounded) == compile_running)
+      ;
+    
+    return compile_end (context);
+  }
+  
+}
@@ -0,0 +1,45 @@
+//
+// Copyright (C) 2009 Roadkill Software
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+
+
+#ifndef INDOOR_H_DISTRIBUTE
+#define INDOOR_H_DISTRIBUTE
+
+#include "World.hpp"
+
+namespace In
+{
+  //
+  // world_compile_distributed
+  // Compiles as world_compile does, with the subtrees below the top few
+  //  partitions built by up to Workers processes running Worker_exe, which
+  //  is looked for on the PATH if it has no directory. Worker_exe must call
+  //  world_run_job on its --worker arguments. Scratch files are named from
+  //  Scratch_prefix and removed afterwards.
+  //
+  World* world_compile_distributed (
+    const Polygon* polys, unsigned count,
+    unsigned workers, const char* worker_exe,
+    const char* scratch_prefix,
+    const CompileOptions& options = CompileOptions ()
+  );
+  
+}
+
+#endif
@@ -0,0 +1,49 @@
+//
+// Copyright (C) 2009 Roadkill Software
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+
+
+#ifndef INDOOR_H_HASH
+#define INDOOR_H_HASH
+
+#include <Rk/Types.hpp>
+
+namespace In
+{
+  //
+  // hash_bytes
+  // 64-bit FNV-1a. Start from hash_seed.
+  //
+# define hash_seed 14695981039346656037ull
+  
+  inline rku64 hash_bytes (rku64 hash, const void* data, unsigned size)
+  {
+    const rku8* bytes = (const rku8*) data;
+    
+    while (size--)
+    {
+      hash ^= *bytes++;
+      hash *= 1099511628211ull;
+    }
+    
+    return hash;
+  }
+  
+}
+
+#endif
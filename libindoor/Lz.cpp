@@ -0,0 +1,244 @@
+//
+// Copyright (C) 2009 Roadkill Software
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+
+#include "Lz.hpp"
+
+#include <cstring>
+
+namespace In
+{
+# define lz_min_match  4
+# define lz_max_offset 65535
+# define lz_hash_bits  12
+  
+  //
+  // lz_read32
+  //
+  static inline rku32 lz_read32 (const rku8* p)
+  {
+    rku32 value;
+    memcpy (&value, p, 4);
+    return value;
+  }
+  
+  //
+  // lz_hash
+  //
+  static inline unsigned lz_hash (rku32 value)
+  {
+    return (value * 2654435761u) >> (32 - lz_hash_bits);
+  }
+  
+  //
+  // lz_put_length
+  // Writes what of Length the token's nibble couldn't hold. Returns the
+  //  new output position, or 0 if Out_end came first.
+  //
+  static rku8* lz_put_length (rku8* out, rku8* out_end, unsigned length)
+  {
+    for (length -= 15; ; length -= 255)
+    {
+      if (out == out_end)
+        return 0;
+      
+      if (length < 255)
+      {
+        *out++ = rku8 (length);
+        return out;
+      }
+      
+      *out++ = 255;
+    }
+  }
+  
+  //
+  // lz_put_sequence
+  // Writes a token, Literals and, if Match_length isn't 0, the match.
+  //  Returns the new output position, or 0 if it wouldn't fit.
+  //
+  static rku8* lz_put_sequence (rku8* out, rku8* out_end, const rku8* literals, unsigned literal_count,
+    unsigned offset, unsigned match_length)
+  {
+    if (out == out_end)
+      return 0;
+    
+    unsigned match_code = match_length ? match_length - lz_min_match : 0;
+    
+    rku8* token = out++;
+    *token = rku8 (
+      ((literal_count < 15 ? literal_count : 15) << 4)
+    | (match_code < 15 ? match_code : 15)
+    );
+    
+    if (literal_count >= 15 && !(out = lz_put_length (out, out_end, literal_count)))
+      return 0;
+    
+    if (unsigned (out_end - out) < literal_count)
+      return 0;
+    
+    memcpy (out, literals, literal_count);
+    out += literal_count;
+    
+    if (!match_length)
+      return out;
+    
+    if (out_end - out < 2)
+      return 0;
+    
+    *out++ = rku8 (offset);
+    *out++ = rku8 (offset >> 8);
+    
+    if (match_code >= 15 && !(out = lz_put_length (out, out_end, match_code)))
+      return 0;
+    
+    return out;
+  }
+  
+  //
+  // lz_bound
+  // Most that lz_compress can write for Size bytes.
+  //
+  unsigned lz_bound (unsigned size)
+  {
+    return size + size / 255 + 16;
+  }
+  
+  //
+  // lz_compress
+  // Greedy, with one candidate per hash. Returns the compressed size, or 0
+  //  if it wouldn't fit in Capacity.
+  //
+  unsigned lz_compress (const rku8* in, unsigned size, rku8* out, unsigned capacity)
+  {
+    rku32 table [1 << lz_hash_bits];
+    for (unsigned i = 0; i != (1 << lz_hash_bits); i++)
+      table [i] = ~0u;
+    
+    rku8* out_begin = out;
+    rku8* out_end = out + capacity;
+    
+    unsigned anchor = 0;
+    unsigned pos = 0;
+    
+    while (pos + lz_min_match <= size)
+    {
+      rku32 value = lz_read32 (in + pos);
+      unsigned hash = lz_hash (value);
+      rku32 candidate = table [hash];
+      table [hash] = pos;
+      
+      if (candidate == ~0u || pos - candidate > lz_max_offset || lz_read32 (in + candidate) != value)
+      {
+        pos++;
+        continue;
+      }
+      
+      unsigned length = lz_min_match;
+      while (pos + length != size && in [candidate + length] == in [pos + length])
+        length++;
+      
+      out = lz_put_sequence (out, out_end, in + anchor, pos - anchor, pos - candidate, length);
+      if (!out)
+        return 0;
+      
+      pos += length;
+      anchor = pos;
+    }
+    
+    out = lz_put_sequence (out, out_end, in + anchor, size - anchor, 0, 0);
+    if (!out)
+      return 0;
+    
+    return out - out_begin;
+  }
+  
+  //
+  // lz_get_length
+  // Reads the bytes extending a nibble of 15. Returns false if In_end came
+  //  first.
+  //
+  static bool lz_get_length (const rku8*& in, const rku8* in_end, unsigned& length)
+  {
+    for (;;)
+    {
+      if (in == in_end)
+        return false;
+      
+      rku8 extra = *in++;
+      length += extra;
+      
+      if (extra != 255)
+        return true;
+    }
+  }
+  
+  //
+  // lz_decompress
+  // Returns true if In decodes to exactly Out_size bytes, never reading or
+  //  writing out of bounds on the way.
+  //
+  bool lz_decompress (const rku8* in, unsigned size, rku8* out, unsigned out_size)
+  {
+    const rku8* in_end = in + size;
+    rku8* out_begin = out;
+    rku8* out_end = out + out_size;
+    
+    while (in != in_end)
+    {
+      rku8 token = *in++;
+      
+      unsigned literal_count = token >> 4;
+      if (literal_count == 15 && !lz_get_length (in, in_end, literal_count))
+        return false;
+      
+      if (unsigned (in_end - in) < literal_count || unsigned (out_end - out) < literal_count)
+        return false;
+      
+      memcpy (out, in, literal_count);
+      in  += literal_count;
+      out += literal_count;
+      
+      // Only the last sequence has no match
+      if (in == in_end)
+        break;
+      
+      if (in_end - in < 2)
+        return false;
+      
+      unsigned offset = in [0] | (in [1] << 8);
+      in += 2;
+      
+      unsigned length = token & 15;
+      if (length == 15 && !lz_get_length (in, in_end, length))
+        return false;
+      length += lz_min_match;
+      
+      if (offset == 0 || unsigned (out - out_begin) < offset || unsigned (out_end - out) < length)
+        return false;
+      
+      // Byte by byte; matches may overlap what they write
+      const rku8* from = out - offset;
+      while (length--)
+        *out++ = *from++;
+    }
+    
+    return out == out_end;
+  }
+  
+}
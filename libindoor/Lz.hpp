@@ -0,0 +1,42 @@
+//
+// Copyright (C) 2009 Roadkill Software
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+
+#ifndef INDOOR_H_LZ
+#define INDOOR_H_LZ
+
+#include <Rk/Types.hpp>
+
+namespace In
+{
+  //
+  // LZ
+  // A small byte-oriented LZ77 codec, after LZ4's block format. A block is
+  //  a run of sequences, each a token byte - literal count in the high
+  //  nibble, match length less 4 in the low - then the literals, then a
+  //  u16 offset back into the output and the match. A nibble of 15 is
+  //  extended by bytes added on until one is under 255. The last sequence
+  //  is literals alone, and ends the block.
+  //
+  unsigned lz_bound      (unsigned size);
+  unsigned lz_compress   (const rku8* in, unsigned size, rku8* out, unsigned capacity);
+  bool     lz_decompress (const rku8* in, unsigned size, rku8* out, unsigned out_size);
+  
+}
+
+#endif
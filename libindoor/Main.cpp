@@ -1,231 +1,1350 @@
-//
-// Copyright (C) 2009 Roadkill Software
-//
-// This program is free software; you can redistribute it and/or
-// modify it under the terms of the GNU General Public License
-// as published by the Free Software Foundation; either version 2
-// of the License, or (at your option) any later version.
-//
-// This program is distributed in the hope that it will be useful,
-// but WITHOUT ANY WARRANTY; without even the implied warranty of
-// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
-//
-// See the GNU General Public License for more details.
-//
-// You should have received a copy of the GNU General Public License
-// along with this program; if not, write to the Free Software
-// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
-//
-
-#if 1
-
-#include "World.hpp"
-#include "Polygon.hpp"
-#include "Portal.hpp"
-
-#include <cstdio>
-#include <cassert>
-
-using namespace In;
-
-//
-// load_poly_file
-//
-static unsigned load_poly_file (const char* filename, Polygon* polys, unsigned size)
-{
-  FILE* file = fopen (filename, "r");
-  if (!file)
-    return 0;
-  
-  unsigned line = 1;
-  
-  double coord [3];
-  int cur_coord = 0;
-  
-  char coord_buf [64];
-  char* cur_buf = coord_buf;
-  
-  Polygon* cur_poly = polys;
-  
-  char c;
-  bool need_char = true;
-  
-  for (bool done = false; !done;)
-  {
-    if (need_char)
-    {
-      c = fgetc (file);
-      if (c == -1)
-      {
-        c = '\n';
-        done = true;
-      }
-      
-      need_char = false;
-    }
-    
-    switch (c)
-    {
-      // Terminate polygon
-      case '\n':
-        if (cur_buf > coord_buf)
-        {
-          printf ("Parse error on line %u - expected \';\'\n", line);
-          fclose (file);
-          return 0;
-        }
-        
-        if (!cur_poly -> empty ())
-        {
-          if (cur_poly -> size () < 3)
-          {
-            printf ("Degenerate polygon on line %u\n", line);
-            fclose (file);
-            return 0;
-          }
-          
-          cur_poly++;
-          
-          if (cur_poly == polys + size)
-          {
-            printf ("Out of polys\n");
-            fclose (file);
-            return 0;
-          }
-        }
-        
-        line++;
-      break;
-      
-      // Skip whitespace or terminate coordinate
-      case ' ':
-      case '\t':
-        if (cur_buf > coord_buf)
-        {
-          *cur_buf = '\0';
-          coord [cur_coord++] = atof (coord_buf);
-          cur_buf = coord_buf;
-        }
-      break;
-      
-      // Skip comments
-      case '/':
-        c = fgetc (file);
-        
-        if (c == '*')
-        {
-          c = 0;
-          
-          while (c != '/');
-          {
-            while (c != '*')
-              c = fgetc (file);
-            
-            c = fgetc (file);
-          }
-          
-          break;
-        }
-        else if (c != '/')
-        {
-          printf ("Parse error on line %u - expected \'/\' after \'/\'\n", line);
-          fclose (file);
-          return 0;
-        }
-      case '#':
-        do { c = fgetc (file); } while (c != '\n');
-        continue; // Keep the \n for parsing
-      break;
-      
-      // Read coordinate
-      case '-':
-        if (cur_buf > coord_buf)
-        {
-          printf ("Parse error on line %u - expected digit\n", line);
-          fclose (file);
-          return 0;
-        }
-      case '0': case '.': 
-      case '1': case '2': case '3':
-      case '4': case '5': case '6':
-      case '7': case '8': case '9':
-        if (cur_coord > 2)
-        {
-          printf ("Parse error on line %u - expected \';\'\n", line);
-          fclose (file);
-          return 0;
-        }
-        
-        if (cur_buf < coord_buf + 63)
-          *cur_buf++ = c;
-      break;
-      
-      // Terminate vector
-      case ';':
-        if (cur_buf > coord_buf)
-        {
-          *cur_buf = '\0';
-          coord [cur_coord++] = atof (coord_buf);
-          cur_buf = coord_buf;
-        }
-        
-        if (cur_coord < 3)
-        {
-          printf ("Parse error on line %u - expected coordinate\n", line);
-          fclose (file);
-          return 0;
-        }
-        
-        cur_poly -> add_vertex (Vector3 (coord [0], coord [1], coord [2]));
-        
-        cur_coord = 0;
-      break;
-      
-      default:
-        printf ("Parse error on line %u - unrecognized character \'%c\'\n", line, c);
-        fclose (file);
-      return 0;
-    }
-    // switch (c)
-    
-    need_char = true;
-  }
-  // for (;;)
-  
-  fclose (file);
-  return cur_poly - polys;
-}
-
-//
-// print_status
-//
-static void print_status (const char* status)
-{
-  printf ("%s\n", status);
-}
-
-//
-// main
-//
-int main ()
-{
-  Polygon polys [1024];
-  
-  unsigned count = load_poly_file ("Polys.txt", polys, 1024);
-  if (!count)
-    return 1;
-  
-  World* world = world_compile (polys, count, print_status);
-  
-  print_status ("world_save...");
-  world_save (world, "Test.indoor");
-  
-  world_free (world);
-  
-  polygon_cleanup ();
-  portal_cleanup ();
-  
-  return 0;
-}
-
-#endif
+//
+// Copyright (C) 2009 Roadkill Software
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+
+#if 1
+
+#include "World.hpp"
+#include "Polygon.hpp"
+#include "Portal.hpp"
+#include "Planes.hpp"
+#include "Arena.hpp"
+#include "Cache.hpp"
+#include "Distribute.hpp"
+#include "Brush.hpp"
+#include "Thread.hpp"
+#include "Hash.hpp"
+#include "../TreeCheck.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <cassert>
+#include <ctime>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+# define WIN32_LEAN_AND_MEAN 1
+# include <windows.h>
+#else
+# include <pthread.h>
+# include <sys/time.h>
+# include <unistd.h>
+# include <glob.h>
+#endif
+
+using namespace In;
+
+//
+// load_poly_file
+// One polygon per line, as "x y z;" vertices. A leading '*' marks a detail
+//  polygon, noted in Detail.
+//
+static unsigned load_poly_file (const char* filename, Polygon* polys, bool* detail, unsigned size)
+{
+  FILE* file = fopen (filename, "r");
+  if (!file)
+    return 0;
+  
+  unsigned line = 1;
+  
+  double coord [3];
+  int cur_coord = 0;
+  
+  char coord_buf [64];
+  char* cur_buf = coord_buf;
+  
+  Polygon* cur_poly = polys;
+  detail [0] = false;
+  
+  char c;
+  bool need_char = true;
+  
+  for (bool done = false; !done;)
+  {
+    if (need_char)
+    {
+      c = fgetc (file);
+      if (c == -1)
+      {
+        c = '\n';
+        done = true;
+      }
+      
+      need_char = false;
+    }
+    
+    switch (c)
+    {
+      // Terminate polygon
+      case '\n':
+        if (cur_buf > coord_buf)
+        {
+          printf ("Parse error on line %u - expected \';\'\n", line);
+          fclose (file);
+          return 0;
+        }
+        
+        if (!cur_poly -> empty ())
+        {
+          if (cur_poly -> size () < 3)
+          {
+            printf ("Degenerate polygon on line %u\n", line);
+            fclose (file);
+            return 0;
+          }
+          
+          cur_poly++;
+          
+          if (cur_poly == polys + size)
+          {
+            printf ("Out of polys\n");
+            fclose (file);
+            return 0;
+          }
+          
+          detail [cur_poly - polys] = false;
+        }
+        
+        line++;
+      break;
+      
+      // Skip whitespace or terminate coordinate
+      case ' ':
+      case '\t':
+        if (cur_buf > coord_buf)
+        {
+          *cur_buf = '\0';
+          coord [cur_coord++] = atof (coord_buf);
+          cur_buf = coord_buf;
+        }
+      break;
+      
+      // Skip comments
+      case '/':
+        c = fgetc (file);
+        
+        if (c == '*')
+        {
+          c = 0;
+          
+          while (c != '/');
+          {
+            while (c != '*')
+              c = fgetc (file);
+            
+            c = fgetc (file);
+          }
+          
+          break;
+        }
+        else if (c != '/')
+        {
+          printf ("Parse error on line %u - expected \'/\' after \'/\'\n", line);
+          fclose (file);
+          return 0;
+        }
+      case '#':
+        do { c = fgetc (file); } while (c != '\n');
+        continue; // Keep the \n for parsing
+      break;
+      
+      // Detail polygon
+      case '*':
+        if (!cur_poly -> empty ())
+        {
+          printf ("Parse error on line %u - \'*\' must start the polygon\n", line);
+          fclose (file);
+          return 0;
+        }
+        
+        detail [cur_poly - polys] = true;
+      break;
+      
+      // Read coordinate
+      case '-':
+        if (cur_buf > coord_buf)
+        {
+          printf ("Parse error on line %u - expected digit\n", line);
+          fclose (file);
+          return 0;
+        }
+      case '0': case '.': 
+      case '1': case '2': case '3':
+      case '4': case '5': case '6':
+      case '7': case '8': case '9':
+        if (cur_coord > 2)
+        {
+          printf ("Parse error on line %u - expected \';\'\n", line);
+          fclose (file);
+          return 0;
+        }
+        
+        if (cur_buf < coord_buf + 63)
+          *cur_buf++ = c;
+      break;
+      
+      // Terminate vector
+      case ';':
+        if (cur_buf > coord_buf)
+        {
+          *cur_buf = '\0';
+          coord [cur_coord++] = atof (coord_buf);
+          cur_buf = coord_buf;
+        }
+        
+        if (cur_coord < 3)
+        {
+          printf ("Parse error on line %u - expected coordinate\n", line);
+          fclose (file);
+          return 0;
+        }
+        
+        cur_poly -> add_vertex (Vector3 (coord [0], coord [1], coord [2]));
+        
+        cur_coord = 0;
+      break;
+      
+      default:
+        printf ("Parse error on line %u - unrecognized character \'%c\'\n", line, c);
+        fclose (file);
+      return 0;
+    }
+    // switch (c)
+    
+    need_char = true;
+  }
+  // for (;;)
+  
+  fclose (file);
+  return cur_poly - polys;
+}
+
+//
+// load_entity_file
+// Entity positions, one "x y z;" per line. Returns 0 if the file isn't there.
+//
+static unsigned load_entity_file (const char* filename, Vector3* entities, unsigned size)
+{
+  FILE* file = fopen (filename, "r");
+  if (!file)
+    return 0;
+  
+  unsigned count = 0;
+  
+  char line [256];
+  while (count != size && fgets (line, sizeof (line), file))
+  {
+    if (line [0] == '/' || line [0] == '#')
+      continue;
+    
+    double x, y, z;
+    if (sscanf (line, "%lf %lf %lf", &x, &y, &z) == 3)
+      entities [count++] = Vector3 (x, y, z);
+  }
+  
+  fclose (file);
+  return count;
+}
+
+//
+// load_brush_file
+// One brush per line, as "nx ny nz d;" planes with normals facing out. A
+//  leading '*' marks a detail brush.
+//
+static unsigned load_brush_file (const char* filename, BrushPlane* planes, unsigned max_planes, Brush* brushes, unsigned max_brushes)
+{
+  FILE* file = fopen (filename, "r");
+  if (!file)
+    return 0;
+  
+  unsigned plane_count = 0;
+  unsigned brush_count = 0;
+  unsigned line_number = 0;
+  
+  char line [4096];
+  while (fgets (line, sizeof (line), file))
+  {
+    line_number++;
+    
+    char* cur = line;
+    while (*cur == ' ' || *cur == '\t')
+      cur++;
+    
+    if (*cur == '/' || *cur == '#' || *cur == '\n' || *cur == '\r' || !*cur)
+      continue;
+    
+    if (brush_count == max_brushes)
+    {
+      printf ("Out of brushes\n");
+      fclose (file);
+      return 0;
+    }
+    
+    Brush& brush = brushes [brush_count];
+    brush.planes = planes + plane_count;
+    brush.plane_count = 0;
+    brush.detail = false;
+    
+    if (*cur == '*')
+    {
+      brush.detail = true;
+      cur++;
+    }
+    
+    for (;;)
+    {
+      double n [4];
+      int used = 0;
+      if (sscanf (cur, " %lf %lf %lf %lf ;%n", &n [0], &n [1], &n [2], &n [3], &used) != 4 || !used)
+        break;
+      
+      if (plane_count == max_planes)
+      {
+        printf ("Out of brush planes\n");
+        fclose (file);
+        return 0;
+      }
+      
+      // Normals needn't come normalized
+      Vector3 normal (n [0], n [1], n [2]);
+      double length = normal.length ();
+      if (length == 0.0)
+      {
+        printf ("Bad plane on line %u\n", line_number);
+        fclose (file);
+        return 0;
+      }
+      
+      planes [plane_count].normal = normal * (1.0 / length);
+      planes [plane_count].distance = n [3] / length;
+      plane_count++;
+      brush.plane_count++;
+      
+      cur += used;
+    }
+    
+    if (brush.plane_count < 4)
+    {
+      printf ("Parse error on line %u - a brush needs at least four planes\n", line_number);
+      fclose (file);
+      return 0;
+    }
+    
+    brush_count++;
+  }
+  
+  fclose (file);
+  return brush_count;
+}
+
+//
+// detail_last
+// Moves the polygons flagged in Detail after the rest, keeping each
+//  group's order, and returns how many there are.
+//
+static unsigned detail_last (Polygon* polys, const bool* detail, unsigned count)
+{
+  Polygon* held = new Polygon [count];
+  unsigned structural = 0, held_count = 0;
+  
+  for (unsigned p = 0; p < count; p++)
+  {
+    if (detail [p])
+      held [held_count++] = polys [p];
+    else
+      polys [structural++] = polys [p];
+  }
+  
+  for (unsigned p = 0; p < held_count; p++)
+    polys [structural + p] = held [p];
+  
+  delete [] held;
+  return held_count;
+}
+
+//
+// load_map
+// Reads polygons, or brushes whose union is returned, detail last with
+//  their number in Detail count. The array returned is to be delete[]d.
+//
+static Polygon* load_map (const char* filename, bool brush_file, unsigned* count, unsigned* detail_count)
+{
+  *count = 0;
+  *detail_count = 0;
+  
+  if (brush_file)
+  {
+    BrushPlane* planes = new BrushPlane [16384];
+    Brush* brushes = new Brush [2048];
+    
+    Polygon* polys = 0;
+    
+    unsigned brush_count = load_brush_file (filename, planes, 16384, brushes, 2048);
+    if (brush_count)
+    {
+      BrushStats stats;
+      polys = brush_polygons (brushes, brush_count, count, &stats);
+      
+      if (stats.too_far)
+      {
+        printf ("%s: %u polygons reach %g units from the origin, as far as this build handles\n",
+          filename, stats.too_far, double (plane_poly_extent));
+      }
+      else
+      {
+        printf ("%s: %u brushes (%u empty), %u faces, %u hidden, %u polygons after union\n",
+          filename, stats.brushes, stats.empty, stats.faces, stats.hidden, stats.polys);
+        *detail_count = stats.detail;
+      }
+    }
+    
+    delete [] brushes;
+    delete [] planes;
+    return polys;
+  }
+  
+  Polygon* polys = new Polygon [1024];
+  bool* detail = new bool [1024];
+  *count = load_poly_file (filename, polys, detail, 1024);
+  *detail_count = detail_last (polys, detail, *count);
+  delete [] detail;
+  return polys;
+}
+
+//
+// print_status
+//
+static void print_status (const char* status)
+{
+  printf ("%s\n", status);
+}
+
+//
+// cleanup
+//
+static void cleanup ()
+{
+  polygon_cleanup ();
+  portal_cleanup ();
+  plane_cleanup ();
+  arena_cleanup ();
+}
+
+//
+// wall_seconds
+//
+static double wall_seconds ()
+{
+#ifdef _WIN32
+  return GetTickCount () / 1000.0;
+#else
+  timeval now;
+  gettimeofday (&now, 0);
+  return now.tv_sec + now.tv_usec / 1000000.0;
+#endif
+}
+
+//
+// compile_map
+// Compiles Input, polygons or a .brushes file, to the same name with an
+//  .indoor extension, flooding from the entities in the same name with
+//  .ent, if there is one. The input is cleaned first, snapping to
+//  Snap_grid. Frees this thread's pools afterwards, so no map sees
+//  another's storage.
+//
+static bool compile_map (const char* input, double snap_grid)
+{
+  char output [1024];
+  strncpy (output, input, sizeof (output) - 8);
+  output [sizeof (output) - 8] = 0;
+  
+  char* dot = strrchr (output, '.');
+  char* slash = strrchr (output, '/');
+  if (dot && dot > slash && dot > strrchr (output, '\\'))
+    *dot = 0;
+  
+  char entity_file [1024];
+  strcpy (entity_file, output);
+  strcat (entity_file, ".ent");
+  strcat (output, ".indoor");
+  
+  bool ok = false;
+  
+  {
+    const char* extension = strrchr (input, '.');
+    bool brush_file = extension && !strcmp (extension, ".brushes");
+    
+    unsigned count, detail_count;
+    Polygon* polys = load_map (input, brush_file, &count, &detail_count);
+    
+    if (count)
+    {
+      Vector3 entities [256];
+      
+      // Batches already keep every processor busy with a map each
+      CompileOptions options;
+      options.clean = true;
+      options.snap_grid = snap_grid;
+      options.threads = 1;
+      options.detail_count = detail_count;
+      options.entity_count = load_entity_file (entity_file, entities, 256);
+      if (options.entity_count)
+        options.entities = entities;
+      
+      World* world = world_compile (polys, count, options);
+      if (world)
+      {
+        ok = world_save (world, output);
+        world_free (world);
+      }
+    }
+    
+    delete [] polys;
+  }
+  
+  cleanup ();
+  return ok;
+}
+
+//
+// Batch
+// Maps shared out to the batch threads. Next and the counts are guarded by
+//  Lock.
+//
+struct Batch
+{
+#ifdef _WIN32
+  CRITICAL_SECTION lock;
+#else
+  pthread_mutex_t lock;
+#endif
+  
+  char** inputs;
+  unsigned count;
+  double snap_grid;
+  unsigned next;
+  unsigned compiled;
+  
+};
+
+static void batch_lock (Batch* batch)
+{
+#ifdef _WIN32
+  EnterCriticalSection (&batch -> lock);
+#else
+  pthread_mutex_lock (&batch -> lock);
+#endif
+}
+
+static void batch_unlock (Batch* batch)
+{
+#ifdef _WIN32
+  LeaveCriticalSection (&batch -> lock);
+#else
+  pthread_mutex_unlock (&batch -> lock);
+#endif
+}
+
+//
+// batch_thread
+//
+static void batch_thread (void* param)
+{
+  Batch* batch = (Batch*) param;
+  
+  for (;;)
+  {
+    batch_lock (batch);
+    unsigned index = batch -> next;
+    if (index != batch -> count)
+      batch -> next++;
+    batch_unlock (batch);
+    
+    if (index == batch -> count)
+      break;
+    
+    const char* input = batch -> inputs [index];
+    bool ok = compile_map (input, batch -> snap_grid);
+    
+    batch_lock (batch);
+    if (ok)
+      batch -> compiled++;
+    printf ("%s: %s\n", input, ok ? "ok" : "failed");
+    batch_unlock (batch);
+  }
+}
+
+//
+// add_path
+//
+static void add_path (const char* input, char**& inputs, unsigned& count, unsigned& size)
+{
+  if (count == size)
+  {
+    size = size ? size * 2 : 64;
+    char** grown = new char* [size];
+    for (unsigned i = 0; i != count; i++)
+      grown [i] = inputs [i];
+    delete [] inputs;
+    inputs = grown;
+  }
+  
+  inputs [count] = new char [strlen (input) + 1];
+  strcpy (inputs [count], input);
+  count++;
+}
+
+//
+// add_input
+// Appends Input, or the files its wildcards match. They're expanded here,
+//  as cmd.exe leaves them to the program.
+//
+static void add_input (const char* input, char**& inputs, unsigned& count, unsigned& size)
+{
+  if (!strpbrk (input, "*?"))
+  {
+    add_path (input, inputs, count, size);
+    return;
+  }
+  
+  unsigned matched = count;
+  
+#ifdef _WIN32
+  // Matches are bare names, in the pattern's directory
+  const char* name = input;
+  for (const char* c = input; *c; c++)
+  {
+    if (*c == '\\' || *c == '/' || *c == ':')
+      name = c + 1;
+  }
+  
+  WIN32_FIND_DATAA found;
+  HANDLE find = FindFirstFileA (input, &found);
+  if (find != INVALID_HANDLE_VALUE)
+  {
+    do
+    {
+      if (found.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+        continue;
+      
+      unsigned directory = name - input;
+      char* path = new char [directory + strlen (found.cFileName) + 1];
+      memcpy (path, input, directory);
+      strcpy (path + directory, found.cFileName);
+      add_path (path, inputs, count, size);
+      delete [] path;
+    }
+    while (FindNextFileA (find, &found));
+    
+    FindClose (find);
+  }
+#else
+  // Directories are marked with a trailing slash
+  glob_t found;
+  if (glob (input, GLOB_MARK, 0, &found) == 0)
+  {
+    for (size_t i = 0; i != found.gl_pathc; i++)
+    {
+      const char* path = found.gl_pathv [i];
+      if (path [strlen (path) - 1] != '/')
+        add_path (path, inputs, count, size);
+    }
+    
+    globfree (&found);
+  }
+#endif
+  
+  if (count == matched)
+    printf ("No maps match %s\n", input);
+}
+
+//
+// add_list_file
+// Appends the paths in a list file, one per line, to Inputs.
+//
+static bool add_list_file (const char* filename, char**& inputs, unsigned& count, unsigned& size)
+{
+  FILE* file = fopen (filename, "r");
+  if (!file)
+    return false;
+  
+  char line [1024];
+  while (fgets (line, sizeof (line), file))
+  {
+    unsigned length = strlen (line);
+    while (length && (line [length - 1] == '\n' || line [length - 1] == '\r' || line [length - 1] == ' '))
+      line [--length] = 0;
+    
+    if (!length || line [0] == '#')
+      continue;
+    
+    add_input (line, inputs, count, size);
+  }
+  
+  fclose (file);
+  return true;
+}
+
+//
+// batch_main
+//  indoor --batch [-j threads] [-s grid] <input | @list>...
+// Compiles each input on a pool of threads in this process. Wildcards are
+//  expanded here, not left to the shell; @list reads paths from a file,
+//  one per line, which may have wildcards too.
+//
+static int batch_main (int argc, char** argv)
+{
+  unsigned threads = thread_processors ();
+  
+  double snap_grid = 0.0;
+  
+  int arg = 2;
+  for (; arg + 1 < argc; arg += 2)
+  {
+    if (!strcmp (argv [arg], "-j"))
+      threads = atoi (argv [arg + 1]);
+    else if (!strcmp (argv [arg], "-s"))
+      snap_grid = atof (argv [arg + 1]);
+    else
+      break;
+  }
+  
+  char** inputs = 0;
+  unsigned count = 0;
+  unsigned size = 0;
+  
+  for (; arg != argc; arg++)
+  {
+    if (argv [arg][0] == '@')
+    {
+      if (!add_list_file (argv [arg] + 1, inputs, count, size))
+        printf ("Can't read list %s\n", argv [arg] + 1);
+      continue;
+    }
+    
+    add_input (argv [arg], inputs, count, size);
+  }
+  
+  if (!count)
+  {
+    printf ("No maps to compile\n");
+    return 1;
+  }
+  
+  if (threads == 0)
+    threads = 1;
+  if (threads > count)
+    threads = count;
+  
+  Batch batch;
+  batch.inputs    = inputs;
+  batch.count     = count;
+  batch.snap_grid = snap_grid;
+  batch.next      = 0;
+  batch.compiled  = 0;
+  
+  double start = wall_seconds ();
+  
+#ifdef _WIN32
+  InitializeCriticalSection (&batch.lock);
+#else
+  pthread_mutex_init (&batch.lock, 0);
+#endif
+  
+  Thread** handles = new Thread* [threads];
+  for (unsigned i = 0; i != threads; i++)
+    handles [i] = thread_start (batch_thread, &batch);
+  
+  // Any thread that couldn't start leaves its share to the others, but
+  //  with none at all this thread does the lot
+  bool started = false;
+  for (unsigned i = 0; i != threads; i++)
+  {
+    if (handles [i])
+    {
+      thread_join (handles [i]);
+      started = true;
+    }
+  }
+  
+  if (!started)
+    batch_thread (&batch);
+  
+  delete [] handles;
+  
+#ifdef _WIN32
+  DeleteCriticalSection (&batch.lock);
+#else
+  pthread_mutex_destroy (&batch.lock);
+#endif
+  
+  double seconds = wall_seconds () - start;
+  if (seconds <= 0.0)
+    seconds = 0.001;
+  
+  printf ("Compiled %u of %u maps in %.2f s on %u threads - %.1f maps/s\n",
+    batch.compiled, count, seconds, threads, batch.compiled / seconds);
+  
+  for (unsigned i = 0; i != count; i++)
+    delete [] inputs [i];
+  delete [] inputs;
+  
+  return batch.compiled == count ? 0 : 1;
+}
+
+//
+// bench_main
+//  indoor --bench [-n runs] [-s grid] <input>
+// Compiles Input Runs times without saving and reports the average time
+//  with the plane misses, so float and double builds can be compared on
+//  the same map.
+//
+static int bench_main (int argc, char** argv)
+{
+  unsigned runs = 5;
+  double snap_grid = 0.0;
+  
+  int arg = 2;
+  for (; arg + 1 < argc; arg += 2)
+  {
+    if (!strcmp (argv [arg], "-n"))
+      runs = atoi (argv [arg + 1]);
+    else if (!strcmp (argv [arg], "-s"))
+      snap_grid = atof (argv [arg + 1]);
+    else
+      break;
+  }
+  
+  if (arg + 1 != argc)
+  {
+    printf ("indoor --bench [-n runs] [-s grid] <input>\n");
+    return 1;
+  }
+  
+  if (runs == 0)
+    runs = 1;
+  
+  const char* input = argv [arg];
+  const char* extension = strrchr (input, '.');
+  bool brush_file = extension && !strcmp (extension, ".brushes");
+  
+  WorldStats stats = { 0, 0, 0, 0, 0, 0, 0 };
+  double total = 0.0;
+  unsigned compiled = 0;
+  
+  for (unsigned run = 0; run != runs; run++)
+  {
+    unsigned count, detail_count;
+    Polygon* polys = load_map (input, brush_file, &count, &detail_count);
+    
+    if (count)
+    {
+      CompileOptions options;
+      options.clean = true;
+      options.snap_grid = snap_grid;
+      options.detail_count = detail_count;
+      
+      double start = wall_seconds ();
+      World* world = world_compile (polys, count, options);
+      total += wall_seconds () - start;
+      
+      if (world)
+      {
+        world_stats (world, &stats);
+        world_free (world);
+        compiled++;
+      }
+    }
+    
+    delete [] polys;
+    cleanup ();
+  }
+  
+  if (!compiled)
+  {
+    printf ("Can't compile %s\n", input);
+    return 1;
+  }
+  
+  printf ("%s: %u-bit, %u runs, %.3f s per compile\n",
+    input, unsigned (sizeof (Scalar) * 8), compiled, total / compiled);
+  printf ("%u leaves, %u clusters, depth %u, %u vertices off their plane\n",
+    stats.leaves, stats.clusters, stats.depth, stats.plane_misses);
+  
+  return 0;
+}
+
+//
+// add_face
+// Fills Poly with the quad Corners, wound to face Facing.
+//
+static void add_face (Polygon* poly, const Vector3* corners, Vector3 facing)
+{
+  for (unsigned c = 0; c != 4; c++)
+    poly -> add_vertex (corners [c]);
+  
+  if (dot (poly -> normal (), facing) < 0.0)
+  {
+    poly -> clear ();
+    for (unsigned c = 4; c != 0; c--)
+      poly -> add_vertex (corners [c - 1]);
+  }
+}
+
+//
+// add_box
+// Fills six polygons from Poly with the faces of a box about the origin,
+//  facing in, and returns the one after.
+//
+static Polygon* add_box (Polygon* poly, double across, double high)
+{
+  double extent [3] = { across, across, high };
+  
+  for (unsigned axis = 0; axis != 3; axis++)
+  {
+    for (int sign = -1; sign <= 1; sign += 2)
+    {
+      Vector3 corners [4];
+      for (unsigned c = 0; c != 4; c++)
+      {
+        double corner [3];
+        corner [axis] = sign * extent [axis];
+        corner [(axis + 1) % 3] = (c == 1 || c == 2 ? 1 : -1) * extent [(axis + 1) % 3];
+        corner [(axis + 2) % 3] = (c >= 2 ? 1 : -1) * extent [(axis + 2) % 3];
+        corners [c] = Vector3 (corner [0], corner [1], corner [2]);
+      }
+      
+      Vector3 facing (0, 0, 0);
+      (&facing.x) [axis] = -sign;
+      add_face (poly++, corners, facing);
+    }
+  }
+  
+  return poly;
+}
+
+//
+// deep_map
+// A round room of Sides walls, enclosed by a box as the hull world_compile
+//  needs, as brush_polygons adds. Like a corridor winding one way, no
+//  face's plane cuts another, so each partition splits off one leaf and
+//  the tree comes out about Sides deep. The array returned is to be
+//  delete[]d.
+//
+# define deep_radius 4000.0
+# define deep_height 64.0
+
+static Polygon* deep_map (unsigned sides, unsigned* count)
+{
+  *count = sides + 8;
+  Polygon* polys = new Polygon [*count];
+  Polygon* poly = polys;
+  
+  Vector3* rim = new Vector3 [sides];
+  for (unsigned i = 0; i != sides; i++)
+  {
+    double angle = 6.283185307179586 * i / sides;
+    rim [i] = Vector3 (deep_radius * cos (angle), deep_radius * sin (angle), 0);
+  }
+  
+  // The walls, facing in
+  Vector3 up (0, 0, deep_height / 2);
+  for (unsigned i = 0; i != sides; i++)
+  {
+    const Vector3& a = rim [i];
+    const Vector3& b = rim [(i + 1) % sides];
+    
+    Vector3 corners [4] = { a - up, b - up, b + up, a + up };
+    add_face (poly++, corners, -(a + b));
+  }
+  
+  // Floor and ceiling, facing in; the rim turns to face up
+  poly -> reserve (sides);
+  for (unsigned i = 0; i != sides; i++)
+    poly -> add_vertex (rim [i] - up);
+  poly++;
+  
+  poly -> reserve (sides);
+  for (unsigned i = 0; i != sides; i++)
+    poly -> add_vertex (rim [sides - 1 - i] + up);
+  poly++;
+  
+  add_box (poly, deep_radius + deep_height, deep_height);
+  
+  delete [] rim;
+  return polys;
+}
+
+//
+// deep_main
+//  indoor --deep <sides> <output>
+// Compiles deep_map's room, saves it to Output, then loads it and walks
+//  it from the middle of the room with the viewer's own code, so every
+//  walk of the tree runs at the depth degenerate maps reach. Fails if the
+//  viewer's tree doesn't match the compiled one, or it wouldn't draw every
+//  cluster from inside the room.
+//
+static int deep_main (int argc, char** argv)
+{
+  if (argc != 4 || atoi (argv [2]) < 3)
+  {
+    printf ("indoor --deep <sides> <output>\n");
+    return 1;
+  }
+  
+  unsigned sides = atoi (argv [2]);
+  const char* output = argv [3];
+  
+  unsigned count;
+  Polygon* polys = deep_map (sides, &count);
+  
+  // In the room, so unreachable leaves are removed as well
+  Vector3 entity (0, 0, 0);
+  
+  // Quiet, as partitioning reports on every plane at every level
+  CompileOptions options;
+  options.entities = &entity;
+  options.entity_count = 1;
+  
+  double start = wall_seconds ();
+  World* world = world_compile (polys, count, options);
+  double compiled = wall_seconds ();
+  delete [] polys;
+  
+  if (!world)
+  {
+    cleanup ();
+    return 1;
+  }
+  
+  WorldStats stats;
+  world_stats (world, &stats);
+  
+  bool saved = world_save (world, output);
+  double written = wall_seconds ();
+  world_free (world);
+  double freed = wall_seconds ();
+  cleanup ();
+  
+  TreeCheck check;
+  bool loaded = saved && tree_check (output, entity.x, entity.y, entity.z, &check);
+  double checked = wall_seconds ();
+  
+  printf ("%u sides: depth %u, %u leaves; compile %.2f s, save %.2f s, free %.2f s, view %.2f s\n",
+    sides, stats.depth, stats.leaves, compiled - start, written - compiled, freed - written, checked - freed);
+  
+  if (!loaded)
+  {
+    printf ("The viewer can't load %s\n", output);
+    return 1;
+  }
+  
+  // Neither counts the outside, which has no place in the tree
+  if (check.depth != stats.depth || check.leaves != stats.leaves)
+  {
+    printf ("The viewer found depth %u, %u leaves\n", check.depth, check.leaves);
+    return 1;
+  }
+  
+  if (!check.clusters || check.listed != check.clusters)
+  {
+    printf ("The viewer drew %u of %u clusters\n", check.listed, check.clusters);
+    return 1;
+  }
+  
+  printf ("The viewer drew all %u clusters, %u triangles\n", check.listed, check.triangles);
+  return 0;
+}
+
+//
+// file_modified
+// When Filename was last written, or 0 if it can't be read.
+//
+static time_t file_modified (const char* filename)
+{
+  struct stat info;
+  if (stat (filename, &info) != 0)
+    return 0;
+  
+  return info.st_mtime;
+}
+
+//
+// sleep_ms
+//
+static void sleep_ms (unsigned ms)
+{
+#ifdef _WIN32
+  Sleep (ms);
+#else
+  usleep (ms * 1000);
+#endif
+}
+
+//
+// watch_main
+//  indoor --watch [-s grid] [-q error]
+// Compiles Polys.txt, or Brushes.txt, to Test.indoor each time it changes,
+//  flooding from Entities.txt. Each world is kept as CompileOptions::
+//  previous for the next, so an edit only recompiles what it reaches; see
+//  world_compile. Runs until killed.
+//
+# define watch_poll_ms 500
+
+static int watch_main (int argc, char** argv)
+{
+  double snap_grid = 0.0;
+  double quantize_error = 0.0;
+  
+  for (int arg = 2; arg + 1 < argc; arg += 2)
+  {
+    if (!strcmp (argv [arg], "-s"))
+      snap_grid = atof (argv [arg + 1]);
+    else if (!strcmp (argv [arg], "-q"))
+      quantize_error = atof (argv [arg + 1]);
+  }
+  
+  const char* input = "Polys.txt";
+  bool brush_file = false;
+  
+  if (file_modified ("Brushes.txt"))
+  {
+    input = "Brushes.txt";
+    brush_file = true;
+  }
+  
+  // Planes, polygons and the previous world all stay in this thread's
+  //  pools, so they're never cleaned up between compiles
+  World* previous = 0;
+  time_t compiled = 0;
+  
+  for (;;)
+  {
+    time_t modified = file_modified (input);
+    if (!modified || modified == compiled)
+    {
+      sleep_ms (watch_poll_ms);
+      continue;
+    }
+    
+    // Give the editor a moment to finish writing
+    sleep_ms (watch_poll_ms);
+    compiled = modified;
+    
+    unsigned count, detail_count;
+    Polygon* polys = load_map (input, brush_file, &count, &detail_count);
+    if (!count)
+    {
+      delete [] polys;
+      continue;
+    }
+    
+    Vector3 entities [256];
+    unsigned entity_count = load_entity_file ("Entities.txt", entities, 256);
+    
+    CompileOptions options;
+    options.status = print_status;
+    options.previous = previous;
+    options.clean = true;
+    options.snap_grid = snap_grid;
+    options.quantize_error = quantize_error;
+    options.detail_count = detail_count;
+    if (entity_count)
+    {
+      options.entities = entities;
+      options.entity_count = entity_count;
+    }
+    
+    double start = wall_seconds ();
+    World* world = world_compile (polys, count, options);
+    delete [] polys;
+    
+    if (!world)
+      continue;
+    
+    print_status ("world_save...");
+    if (world_save (world, "Test.indoor"))
+      printf ("Compiled %s in %.2f s\n", input, wall_seconds () - start);
+    fflush (stdout);
+    
+    world_free (previous);
+    previous = world;
+  }
+}
+
+//
+// main
+//  indoor [-j workers] [-s grid] [-q error] [-t] [-z]
+//  indoor --batch [-j threads] [-s grid] <input | @list>...
+//  indoor --bench [-n runs] [-s grid] <input>
+//  indoor --deep <sides> <output>
+//  indoor --watch [-s grid] [-q error]
+//  indoor --worker <job> <subtree>
+//
+int main (int argc, char** argv)
+{
+  if (argc >= 2 && !strcmp (argv [1], "--batch"))
+    return batch_main (argc, argv);
+  
+  if (argc >= 2 && !strcmp (argv [1], "--bench"))
+    return bench_main (argc, argv);
+  
+  if (argc >= 2 && !strcmp (argv [1], "--deep"))
+    return deep_main (argc, argv);
+  
+  if (argc >= 2 && !strcmp (argv [1], "--watch"))
+    return watch_main (argc, argv);
+  
+  if (argc == 4 && !strcmp (argv [1], "--worker"))
+  {
+    bool ok = world_run_job (argv [2], argv [3]);
+    cleanup ();
+    return ok ? 0 : 1;
+  }
+  
+  unsigned workers = 0;
+  double snap_grid = 0.0;
+  double quantize_error = 0.0;
+  bool compress = false;
+  bool stream = false;
+  
+  for (int arg = 1; arg < argc; arg++)
+  {
+    if (!strcmp (argv [arg], "-z"))
+      compress = true;
+    else if (!strcmp (argv [arg], "-t")) // Stream leaves out as they're done
+      stream = true;
+    else if (arg + 1 == argc)
+      break;
+    else if (!strcmp (argv [arg], "-j"))
+      workers = atoi (argv [++arg]);
+    else if (!strcmp (argv [arg], "-s"))
+      snap_grid = atof (argv [++arg]);
+    else if (!strcmp (argv [arg], "-q"))
+      quantize_error = atof (argv [++arg]);
+  }
+  
+  {
+    // Brushes.txt is read as brushes in place of Polys.txt, if it's there
+    const char* input = "Polys.txt";
+    bool brush_file = false;
+    
+    if (FILE* file = fopen ("Brushes.txt", "r"))
+    {
+      fclose (file);
+      input = "Brushes.txt";
+      brush_file = true;
+    }
+    
+    unsigned count, detail_count;
+    Polygon* polys = load_map (input, brush_file, &count, &detail_count);
+    if (!count)
+    {
+      delete [] polys;
+      return 1;
+    }
+    
+    Vector3 entities [256];
+    unsigned entity_count = load_entity_file ("Entities.txt", entities, 256);
+    
+    // Optional; compiles as normal if the directory isn't there
+    CompileCache* cache = cache_open ("IndoorCache", 256ul * 1024 * 1024);
+    rku64 key = cache_key (polys, count, detail_count, entities, entity_count * sizeof (Vector3));
+    key = hash_bytes (key, &snap_grid, sizeof (snap_grid));
+    key = hash_bytes (key, &quantize_error, sizeof (quantize_error));
+    key = hash_bytes (key, &compress, sizeof (compress));
+    
+    if (cache && cache_fetch (cache, key, "Test.indoor"))
+    {
+      print_status ("Cached");
+    }
+    else
+    {
+      CompileOptions options;
+      options.status = print_status;
+      options.clean = true;
+      options.snap_grid = snap_grid;
+      options.quantize_error = quantize_error;
+      options.detail_count = detail_count;
+      if (stream)
+        options.stream = "Test.indoor";
+      if (entity_count)
+      {
+        options.entities = entities;
+        options.entity_count = entity_count;
+      }
+      
+      World* world;
+      if (workers)
+        world = world_compile_distributed (polys, count, workers, argv [0], "Test.indoor.", options);
+      else
+        world = world_compile (polys, count, options);
+      
+      if (world)
+      {
+        print_status ("world_save...");
+        bool saved = world_save (world, "Test.indoor");
+        
+        if (saved && compress)
+        {
+          print_status ("world_compress...");
+          saved = world_compress ("Test.indoor");
+        }
+        
+        if (saved && cache)
+          cache_store (cache, key, "Test.indoor");
+        
+        if (quantize_error > 0.0)
+        {
+          WorldStats stats;
+          world_stats (world, &stats);
+          
+          // Each leaf's block is read whole, so the load is the file's saving
+          unsigned long bytes_saved = stats.float_bytes - stats.triangle_bytes;
+          printf ("Quantized %u leaves: triangles take %lu bytes for %lu, %lu (%.1f%%) less to store and load\n",
+            stats.quantized, stats.triangle_bytes, stats.float_bytes, bytes_saved,
+            stats.float_bytes ? 100.0 * bytes_saved / stats.float_bytes : 0.0);
+        }
+        
+        world_free (world);
+      }
+    }
+    
+    if (cache)
+    {
+      unsigned hits, misses;
+      unsigned long bytes;
+      cache_stats (cache, &hits, &misses, &bytes);
+      printf ("Cache: %u hits, %u misses, %lu bytes\n", hits, misses, bytes);
+      
+      cache_close (cache);
+    }
+    
+    delete [] polys;
+  }
+  
+  cleanup ();
+  
+  return 0;
+}
+
+#endif
@@ -0,0 +1,240 @@
+//
+// Copyright (C) 2009 Roadkill Software
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+
+#include "Planes.hpp"
+#include "Predicates.hpp"
+
+#include <cassert>
+#include <cmath>
+#include <cstring>
+
+namespace In
+{
+  //
+  // Plane table
+  // Blocks never move, so a plane_get reference survives later finds; only
+  //  the list of them grows. Chains hash on the unit cell of the distance
+  //  and the cell of each normal component, so planes at one distance
+  //  facing different ways rarely share one. A plane within epsilon of a
+  //  cell edge may have been filed under its neighbour, so that cell is
+  //  searched too.
+  //
+# define plane_buckets 4096
+# define normal_cells  1024 // Per unit of each normal component
+# define normal_epsilon (plane_epsilon / 1024.0)
+  
+  indoor_thread_local Plane** plane_blocks = 0;
+  static indoor_thread_local PlaneIndex** next_blocks = 0;
+  static indoor_thread_local unsigned     block_room  = 0;
+  static indoor_thread_local PlaneIndex   plane_heads [plane_buckets]; // Index + 1, 0 for none
+  static indoor_thread_local unsigned     plane_total = 0;
+  
+  //
+  // PlaneKey
+  // The cells a plane falls in, distance first, and for each the
+  //  neighbour it is within epsilon of: -1 or 1, or 0 for none.
+  //
+  struct PlaneKey
+  {
+    int cells [4];
+    int edges [4];
+    
+  };
+  
+  //
+  // plane_key
+  //
+  static void plane_key (const Plane& plane, PlaneKey* key)
+  {
+    const double values [4] = {
+      plane.distance,
+      plane.normal.x * normal_cells,
+      plane.normal.y * normal_cells,
+      plane.normal.z * normal_cells
+    };
+    
+    const double slack [4] = {
+      plane_epsilon,
+      normal_epsilon * normal_cells,
+      normal_epsilon * normal_cells,
+      normal_epsilon * normal_cells
+    };
+    
+    for (unsigned i = 0; i != 4; i++)
+    {
+      double cell = floor (values [i]);
+      double offset = values [i] - cell;
+      
+      key -> cells [i] = int (cell);
+      key -> edges [i] = offset <= slack [i] ? -1 : offset >= 1.0 - slack [i] ? 1 : 0;
+    }
+  }
+  
+  //
+  // plane_bucket
+  //
+  static inline unsigned plane_bucket (const int cells [4])
+  {
+    unsigned hash = unsigned (cells [0]) * 73856093u
+                  ^ unsigned (cells [1]) * 19349663u
+                  ^ unsigned (cells [2]) * 83492791u
+                  ^ unsigned (cells [3]) * 2654435761u;
+    
+    return (hash ^ (hash >> 16)) & (plane_buckets - 1);
+  }
+  
+  //
+  // plane_equal
+  //
+  static inline bool plane_equal (const Plane& a, const Plane& b)
+  {
+    return fabs (a.normal.x - b.normal.x) < normal_epsilon
+        && fabs (a.normal.y - b.normal.y) < normal_epsilon
+        && fabs (a.normal.z - b.normal.z) < normal_epsilon
+        && fabs (a.distance - b.distance) < plane_epsilon;
+  }
+  
+  //
+  // plane_add
+  //
+  static void plane_add (const Plane& plane)
+  {
+    PlaneIndex index = plane_total++;
+    unsigned block = index / planeblock_size;
+    
+    if (block == block_room)
+    {
+      unsigned room = block_room ? block_room * 2 : 64;
+      Plane**      planes = new Plane*      [room];
+      PlaneIndex** nexts  = new PlaneIndex* [room];
+      
+      for (unsigned i = 0; i != room; i++)
+      {
+        planes [i] = i < block_room ? plane_blocks [i] : 0;
+        nexts  [i] = i < block_room ? next_blocks  [i] : 0;
+      }
+      
+      delete [] plane_blocks;
+      delete [] next_blocks;
+      plane_blocks = planes;
+      next_blocks  = nexts;
+      block_room   = room;
+    }
+    
+    if (!plane_blocks [block])
+    {
+      plane_blocks [block] = new Plane      [planeblock_size];
+      next_blocks  [block] = new PlaneIndex [planeblock_size];
+    }
+    
+    plane_blocks [block][index % planeblock_size] = plane;
+    
+    PlaneKey key;
+    plane_key (plane, &key);
+    
+    unsigned bucket = plane_bucket (key.cells);
+    next_blocks [block][index % planeblock_size] = plane_heads [bucket];
+    plane_heads [bucket] = index + 1;
+  }
+  
+  //
+  // plane_find
+  // Returns the index of Plane, adding it and its flip if they're new.
+  //
+  PlaneIndex plane_find (const Plane& plane)
+  {
+    PlaneKey key;
+    plane_key (plane, &key);
+    
+    // Each set bit of Near takes the neighbouring cell on that axis
+    for (unsigned near = 0; near != 16; near++)
+    {
+      int cells [4];
+      bool edge = true;
+      
+      for (unsigned i = 0; i != 4; i++)
+      {
+        cells [i] = key.cells [i];
+        if (near & (1 << i))
+        {
+          cells [i] += key.edges [i];
+          edge = edge && key.edges [i];
+        }
+      }
+      
+      if (!edge)
+        continue;
+      
+      for (PlaneIndex
+        link  = plane_heads [plane_bucket (cells)];
+        link != 0;
+        link  = next_blocks [(link - 1) / planeblock_size][(link - 1) % planeblock_size])
+      {
+        if (plane_equal (plane_get (link - 1), plane))
+          return link - 1;
+      }
+    }
+    
+    PlaneIndex index = plane_total;
+    plane_add (plane);
+    plane_add (Plane (-plane.normal, -plane.distance));
+    return index;
+  }
+  
+  //
+  // plane_count
+  // Of indices handed out; twice the surfaces.
+  //
+  unsigned plane_count ()
+  {
+    return plane_total;
+  }
+  
+  //
+  // plane_table
+  // Identifies the calling thread's table, so that whatever holds indices
+  //  can check it is back on the thread they're into.
+  //
+  const void* plane_table ()
+  {
+    return plane_heads;
+  }
+  
+  //
+  // plane_cleanup
+  //
+  void plane_cleanup ()
+  {
+    for (unsigned i = 0; i != block_room; i++)
+    {
+      delete [] plane_blocks [i];
+      delete [] next_blocks  [i];
+    }
+    
+    delete [] plane_blocks;
+    delete [] next_blocks;
+    plane_blocks = 0;
+    next_blocks  = 0;
+    block_room   = 0;
+    
+    memset (plane_heads, 0, sizeof (plane_heads));
+    plane_total = 0;
+  }
+  
+}
@@ -0,0 +1,80 @@
+//
+// Copyright (C) 2009 Roadkill Software
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+
+#ifndef INDOOR_H_PLANES
+#define INDOOR_H_PLANES
+
+#include "Vector3.hpp"
+#include "Arena.hpp"
+
+#include <Rk/Types.hpp>
+#include <Rk/Plane.hpp>
+
+namespace In
+{
+  typedef Rk::Plane <Scalar> Plane;
+  
+  //
+  // PlaneIndex
+  // Every plane the compiler uses is kept once in a per-thread table, beside
+  //  its flip. Index ^ 1 is the same plane facing the other way, and two
+  //  indices lie in the same surface when they agree above the low bit.
+  //  Indices stay valid until plane_cleanup.
+  //
+  typedef rku32 PlaneIndex;
+  
+  //
+  // plane_poly_extent
+  // Half the side of the square a plane's polygon starts as, so every
+  //  vertex of a map must lie within this of the origin. Floats can't hold
+  //  a corner a million units out to within plane_epsilon.
+  //
+#ifdef INDOOR_FLOAT
+# define plane_poly_extent 4096
+#else
+# define plane_poly_extent 1000000
+#endif
+  
+# define planeblock_size 1024
+  
+  extern indoor_thread_local Plane** plane_blocks;
+  
+  PlaneIndex  plane_find    (const Plane& plane);
+  unsigned    plane_count   ();
+  void        plane_cleanup ();
+  const void* plane_table   ();
+  
+  inline const Plane& plane_get (PlaneIndex index)
+  {
+    return plane_blocks [index / planeblock_size][index % planeblock_size];
+  }
+  
+  inline PlaneIndex plane_flip (PlaneIndex index)
+  {
+    return index ^ 1;
+  }
+  
+  inline bool plane_same (PlaneIndex a, PlaneIndex b)
+  {
+    return (a >> 1) == (b >> 1);
+  }
+  
+}
+
+#endif
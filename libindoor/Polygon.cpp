@@ -1,84 +1,136 @@
-//
-// Copyright (C) 2009 Roadkill Software
-//
-// This program is free software; you can redistribute it and/or
-// modify it under the terms of the GNU General Public License
-// as published by the Free Software Foundation; either version 2
-// of the License, or (at your option) any later version.
-//
-// This program is distributed in the hope that it will be useful,
-// but WITHOUT ANY WARRANTY; without even the implied warranty of
-// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
-//
-// See the GNU General Public License for more details.
-//
-// You should have received a copy of the GNU General Public License
-// along with this program; if not, write to the Free Software
-// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
-//
-
-#include "Polygon.hpp"
-
-namespace In
-{
-# define polyblock_size 256
-  struct PolyBlock
-  {
-    Polygon polys [polyblock_size];
-    Polygon* cur_poly;
-    PolyBlock* next;
-    
-    PolyBlock () :
-      cur_poly (polys)
-    {}
-    
-    inline bool full () const
-    {
-      return cur_poly == polys + polyblock_size;
-    }
-    
-  };
-  
-# define free_polys_size 256
-  static Polygon* free_polys [free_polys_size];
-  static Polygon** free_poly_ptr = free_polys;
-  
-  static PolyBlock* head_poly_block = 0;
-  
-  Polygon* polygon_alloc ()
-  {
-    if (free_poly_ptr > free_polys)
-      return *--free_poly_ptr;
-    
-    if (!head_poly_block || head_poly_block -> full ())
-    {
-      PolyBlock* new_pb = new PolyBlock;
-      new_pb -> next = head_poly_block;
-      head_poly_block = new_pb;
-    }
-    
-    return head_poly_block -> cur_poly++;
-  }
-  
-  void polygon_free (Polygon* poly)
-  {
-    if (!poly)
-      return;
-    
-    if (free_poly_ptr == free_polys + free_polys_size)
-      return; // Soft leak. Inefficient, but not deadly.
-    
-    *free_poly_ptr++ = poly;
-  }
-  
-  void polygon_cleanup ()
-  {
-    while (head_poly_block)
-    {
-      PolyBlock* next = head_poly_block -> next;
-      delete head_poly_block;
-      head_poly_block = next;
-    }
-  }
-  
-}
+//
+// Copyright (C) 2009 Roadkill Software
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+
+#include "Polygon.hpp"
+#include "Arena.hpp"
+
+namespace In
+{
+  //
+  // Polygon::reserve
+  //
+  void Polygon::reserve (unsigned count)
+  {
+    assert (this);
+    
+    unsigned old_capacity = capacity ();
+    if (count <= old_capacity)
+      return;
+    
+    unsigned new_capacity = old_capacity * 2;
+    if (new_capacity < count)
+      new_capacity = count;
+    
+    unsigned bytes = arena_round (new_capacity * sizeof (Vector3));
+    new_capacity = bytes / sizeof (Vector3);
+    
+    Vector3* data = (Vector3*) arena_alloc (bytes);
+    
+    unsigned count_now = size ();
+    Vector3* old_data = begin ();
+    for (unsigned i = 0; i != count_now; i++)
+      data [i] = old_data [i];
+    
+    if (spilled ())
+      arena_free (old_data, old_capacity * sizeof (Vector3));
+    
+    memcpy ((void*) vertices, &data, sizeof (data));
+    memcpy ((char*) vertices + sizeof (Vector3*), &new_capacity, sizeof (new_capacity));
+    vertices_end = data + count_now;
+  }
+  
+  //
+  // Polygon::release
+  // Returns spilled storage to the arena. Leaves the polygon empty.
+  //
+  void Polygon::release ()
+  {
+    assert (this);
+    
+    if (spilled ())
+      arena_free (spill_data (), spill_capacity () * sizeof (Vector3));
+    
+    vertices_end = vertices;
+  }
+  
+# define polyblock_size 256
+  struct PolyBlock
+  {
+    Polygon polys [polyblock_size];
+    Polygon* cur_poly;
+    PolyBlock* next;
+    
+    PolyBlock () :
+      cur_poly (polys)
+    {}
+    
+    inline bool full () const
+    {
+      return cur_poly == polys + polyblock_size;
+    }
+    
+  };
+  
+# define free_polys_size 256
+  static indoor_thread_local Polygon* free_polys [free_polys_size];
+  static indoor_thread_local unsigned free_poly_count = 0;
+  
+  static indoor_thread_local PolyBlock* head_poly_block = 0;
+  
+  Polygon* polygon_alloc ()
+  {
+    if (free_poly_count)
+      return free_polys [--free_poly_count];
+    
+    if (!head_poly_block || head_poly_block -> full ())
+    {
+      PolyBlock* new_pb = new PolyBlock;
+      new_pb -> next = head_poly_block;
+      head_poly_block = new_pb;
+    }
+    
+    return head_poly_block -> cur_poly++;
+  }
+  
+  void polygon_free (Polygon* poly)
+  {
+    if (!poly)
+      return;
+    
+    poly -> release ();
+    
+    if (free_poly_count == free_polys_size)
+      return; // Soft leak. Inefficient, but not deadly.
+    
+    free_polys [free_poly_count++] = poly;
+  }
+  
+  void polygon_cleanup ()
+  {
+    while (head_poly_block)
+    {
+      PolyBlock* next = head_poly_block -> next;
+      delete head_poly_block;
+      head_poly_block = next;
+    }
+    
+    free_poly_count = 0;
+  }
+  
+}
@@ -0,0 +1,130 @@
+//
+// Copyright (C) 2009 Roadkill Software
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+
+
+#include "Predicates.hpp"
+
+namespace In
+{
+  //
+  // Expansion arithmetic
+  // After Shewchuk, "Adaptive Precision Floating-Point Arithmetic and Fast
+  //  Robust Geometric Predicates". A value is held exactly as a sum of
+  //  non-overlapping doubles, smallest first.
+  //
+# define splitter 134217729.0 // 2^27 + 1
+  
+  static inline void two_sum (double a, double b, double& x, double& y)
+  {
+    x = a + b;
+    double b_virtual = x - a;
+    double a_virtual = x - b_virtual;
+    double b_round = b - b_virtual;
+    double a_round = a - a_virtual;
+    y = a_round + b_round;
+  }
+  
+  static inline void split (double a, double& hi, double& lo)
+  {
+    double c = splitter * a;
+    double a_big = c - a;
+    hi = c - a_big;
+    lo = a - hi;
+  }
+  
+  static inline void two_product (double a, double b, double& x, double& y)
+  {
+    x = a * b;
+    
+    double a_hi, a_lo, b_hi, b_lo;
+    split (a, a_hi, a_lo);
+    split (b, b_hi, b_lo);
+    
+    double err1 = x - (a_hi * b_hi);
+    double err2 = err1 - (a_lo * b_hi);
+    double err3 = err2 - (a_hi * b_lo);
+    y = (a_lo * b_lo) - err3;
+  }
+  
+  //
+  // grow_expansion
+  // Adds B to the Size-term expansion E in place. E needs room for one more.
+  //
+  static unsigned grow_expansion (double* e, unsigned size, double b)
+  {
+    double q = b;
+    for (unsigned i = 0; i != size; i++)
+      two_sum (q, e [i], q, e [i]);
+    
+    e [size] = q;
+    return size + 1;
+  }
+  
+  //
+  // expansion_sign
+  // The largest nonzero term carries the sign.
+  //
+  static int expansion_sign (const double* e, unsigned size)
+  {
+    while (size--)
+    {
+      if (e [size] > 0.0) return  1;
+      if (e [size] < 0.0) return -1;
+    }
+    
+    return 0;
+  }
+  
+  //
+  // distance_sign
+  // Exact sign of Normal.Point - Distance + Offset.
+  //
+  static int distance_sign (const Vector3& normal, double distance, const Vector3& point, double offset)
+  {
+    double terms [6];
+    two_product (normal.x, point.x, terms [0], terms [1]);
+    two_product (normal.y, point.y, terms [2], terms [3]);
+    two_product (normal.z, point.z, terms [4], terms [5]);
+    
+    double e [8];
+    unsigned size = 0;
+    
+    for (unsigned i = 0; i != 6; i++)
+      size = grow_expansion (e, size, terms [i]);
+    
+    size = grow_expansion (e, size, -distance);
+    size = grow_expansion (e, size, offset);
+    
+    return expansion_sign (e, size);
+  }
+  
+  //
+  // point_class_exact
+  //
+  int point_class_exact (const Vector3& normal, double distance, const Vector3& point)
+  {
+    if (distance_sign (normal, distance, point, -plane_epsilon) >= 0)
+      return 1;
+    if (distance_sign (normal, distance, point, plane_epsilon) <= 0)
+      return -1;
+    
+    return 0;
+  }
+  
+}
@@ -0,0 +1,80 @@
+//
+// Copyright (C) 2009 Roadkill Software
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+
+
+#ifndef INDOOR_H_PREDICATES
+#define INDOOR_H_PREDICATES
+
+#include "Vector3.hpp"
+
+#include <cfloat>
+#include <cmath>
+
+namespace In
+{
+  //
+  // Point classification
+  // A point is on a plane when its distance is strictly within
+  //  plane_epsilon, and in front or behind otherwise. The distance is
+  //  evaluated in doubles with a bound on its rounding error; only when
+  //  that can't settle which side of the epsilon it is does
+  //  point_class_exact work it out in exact arithmetic. Every caller gets
+  //  the same answer for the same point and plane, whatever order it
+  //  computes things in.
+  // Float vertices carry about 1e-3 of rounding at a few thousand units out,
+  //  so a float build needs the wider epsilon to keep split vertices on.
+  //
+#ifdef INDOOR_FLOAT
+# define plane_epsilon 0.001
+#else
+# define plane_epsilon 0.00001
+#endif
+  
+  // Bound on the rounding error of ((a + b) + c) - d from three products,
+  //  relative to the sum of magnitudes. 3 ulp is plenty.
+# define point_class_error (3.0 * DBL_EPSILON)
+  
+  int point_class_exact (const Vector3& normal, double distance, const Vector3& point);
+  
+  //
+  // point_class
+  // Returns 1 in front, -1 behind or 0 on.
+  //
+  inline int point_class (const Vector3& normal, double distance, const Vector3& point)
+  {
+    double px = double (normal.x) * point.x;
+    double py = double (normal.y) * point.y;
+    double pz = double (normal.z) * point.z;
+    
+    double dist  = px + py + pz - distance;
+    double bound = (fabs (px) + fabs (py) + fabs (pz) + fabs (distance)) * point_class_error;
+    
+    if (dist >= plane_epsilon + bound)
+      return 1;
+    if (dist <= -plane_epsilon - bound)
+      return -1;
+    if (dist < plane_epsilon - bound && dist > -plane_epsilon + bound)
+      return 0;
+    
+    return point_class_exact (normal, distance, point);
+  }
+  
+}
+
+#endif
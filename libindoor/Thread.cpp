@@ -0,0 +1,139 @@
+//
+// Copyright (C) 2009 Roadkill Software
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+
+#include "Thread.hpp"
+
+#include <cassert>
+
+#ifdef _WIN32
+# define WIN32_LEAN_AND_MEAN 1
+# include <windows.h>
+#else
+# include <pthread.h>
+# include <time.h>
+# include <unistd.h>
+#endif
+
+namespace In
+{
+  struct Thread
+  {
+#ifdef _WIN32
+    HANDLE handle;
+#else
+    pthread_t handle;
+#endif
+    void (*main) (void*);
+    void* param;
+    
+  };
+  
+  //
+  // thread_entry
+  //
+#ifdef _WIN32
+  static DWORD WINAPI thread_entry (void* param)
+#else
+  static void* thread_entry (void* param)
+#endif
+  {
+    Thread* thread = (Thread*) param;
+    thread -> main (thread -> param);
+    return 0;
+  }
+  
+  //
+  // thread_start
+  // Returns 0 if the thread couldn't be made.
+  //
+  Thread* thread_start (void (*main) (void*), void* param)
+  {
+    assert (main);
+    
+    Thread* thread = new Thread;
+    thread -> main  = main;
+    thread -> param = param;
+    
+#ifdef _WIN32
+    thread -> handle = CreateThread (0, 0, thread_entry, thread, 0, 0);
+    bool ok = thread -> handle != 0;
+#else
+    bool ok = pthread_create (&thread -> handle, 0, thread_entry, thread) == 0;
+#endif
+    
+    if (!ok)
+    {
+      delete thread;
+      return 0;
+    }
+    
+    return thread;
+  }
+  
+  //
+  // thread_join
+  // Waits for Thread to finish, and frees it.
+  //
+  void thread_join (Thread* thread)
+  {
+    assert (thread);
+    
+#ifdef _WIN32
+    WaitForSingleObject (thread -> handle, INFINITE);
+    CloseHandle (thread -> handle);
+#else
+    pthread_join (thread -> handle, 0);
+#endif
+    
+    delete thread;
+  }
+  
+  //
+  // thread_processors
+  //
+  unsigned thread_processors ()
+  {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo (&info);
+    long count = info.dwNumberOfProcessors;
+#else
+    long count = sysconf (_SC_NPROCESSORS_ONLN);
+#endif
+    return count > 0 ? unsigned (count) : 1;
+  }
+  
+  //
+  // thread_clock
+  //
+  double thread_clock ()
+  {
+#ifdef _WIN32
+    LARGE_INTEGER count, frequency;
+    QueryPerformanceCounter (&count);
+    QueryPerformanceFrequency (&frequency);
+    return double (count.QuadPart) / double (frequency.QuadPart);
+#else
+    timespec now;
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1000000000.0;
+#endif
+  }
+  
+}
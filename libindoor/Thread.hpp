@@ -0,0 +1,46 @@
+//
+// Copyright (C) 2009 Roadkill Software
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+
+#ifndef INDOOR_H_THREAD
+#define INDOOR_H_THREAD
+
+namespace In
+{
+  //
+  // Thread
+  // Just enough of the platform's threads for the compiler: start one, and
+  //  wait for it to finish. A thread that touches the pools must run the
+  //  cleanup functions itself before it returns; see Arena.hpp.
+  //
+  struct Thread;
+  
+  Thread*  thread_start      (void (*main) (void*), void* param);
+  void     thread_join       (Thread* thread);
+  unsigned thread_processors ();
+  
+  //
+  // thread_clock
+  // Seconds of wall time from some fixed point, never going back. Unlike
+  //  clock (), it counts time spent waiting on other threads.
+  //
+  double thread_clock ();
+  
+}
+
+#endif
@@ -1,31 +1,44 @@
-//
-// Copyright (C) 2009 Roadkill Software
-//
-// This program is free software; you can redistribute it and/or
-// modify it under the terms of the GNU General Public License
-// as published by the Free Software Foundation; either version 2
-// of the License, or (at your option) any later version.
-//
-// This program is distributed in the hope that it will be useful,
-// but WITHOUT ANY WARRANTY; without even the implied warranty of
-// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
-//
-// See the GNU General Public License for more details.
-//
-// You should have received a copy of the GNU General Public License
-// along with this program; if not, write to the Free Software
-// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
-//
-
-#ifndef INDOOR_H_VECTOR3
-#define INDOOR_H_VECTOR3
-
-#include <Rk/Vector3.hpp>
-
-namespace In
-{
-  typedef Rk::Vector3d Vector3;
-  
-}
-
-#endif
+//
+// Copyright (C) 2009 Roadkill Software
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+
+#ifndef INDOOR_H_VECTOR3
+#define INDOOR_H_VECTOR3
+
+#include <Rk/Vector3.hpp>
+#include <Rk/Types.hpp>
+
+namespace In
+{
+  //
+  // Scalar
+  // Precision of the compiler core. Output is rkf32 either way; building with
+  //  INDOOR_FLOAT halves polygon and plane storage at the cost of coarser cuts.
+  //  Run indoor --bench to see what that costs on a given map.
+  //
+#ifdef INDOOR_FLOAT
+  typedef rkf32 Scalar;
+#else
+  typedef rkf64 Scalar;
+#endif
+  
+  typedef Rk::Vector3 <Scalar> Vector3;
+  
+}
+
+#endif
@@ -1,1349 +1,4532 @@
-//
-// Copyright (C) 2009 Roadkill Software
-//
-// This program is free software; you can redistribute it and/or
-// modify it under the terms of the GNU General Public License
-// as published by the Free Software Foundation; either version 2
-// of the License, or (at your option) any later version.
-//
-// This program is distributed in the hope that it will be useful,
-// but WITHOUT ANY WARRANTY; without even the implied warranty of
-// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
-//
-// See the GNU General Public License for more details.
-//
-// You should have received a copy of the GNU General Public License
-// along with this program; if not, write to the Free Software
-// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
-//
-
-#include "World.hpp"
-#include "Portal.hpp"
-
-#include <cassert>
-#include <cstdio>
-
-#include <Rk/Types.hpp>
-#include <Rk/Plane.hpp>
-
-typedef Rk::Plane <rkf64> Plane;
-using Rk::PlaneSide;
-
-namespace In
-{
-  //inline void debug_trap (bool exp = false) { if (!exp) { *((int*) 0) = 1; } }
-  #define debug_trap(exp) { if (!(exp)) { *((int*) 0) = 1; } }
-  
-  PlaneSide polygon_side (const Plane& plane, const Polygon& poly)
-  {
-    double first_dist = 0.0;
-    
-    for (const Vector3*
-      v  = poly.vertices;
-      v != poly.vertices_end;
-      v++)
-    {
-      double dist = plane.point_distance (*v);
-      
-      if (dist > -0.00001 && dist < 0.00001)
-        dist = 0.0;
-      
-      if (first_dist == 0.0)
-      {
-        first_dist = dist;
-      }
-      else if (dist * first_dist < 0)
-      {
-        return plane_side_across;
-      }
-    }
-    
-    return (first_dist < 0 ? plane_side_back : plane_side_front);
-  }
-  
-  //
-  // is_polygon_in
-  // Returns true if Poly lies roughly within plane, false otherwise.
-  //
-  bool is_polygon_in (const Polygon& poly, const Plane& plane)
-  {
-    for (const Vector3*
-      v  = poly.vertices;
-      v != poly.vertices_end;
-      v++)
-    {
-      const double d = plane.point_distance (*v);
-      if (d > 0.00001 || d < -0.00001)
-        return false;
-    }
-    
-    return true;
-  }
-
-  //
-  // MapPlane
-  //
-# define mapplane_max_polys   1024
-# define mapplane_max_portals 1024
-  
-  struct MapPlane
-  {
-    MapPlane *prev, *next;
-    
-    Plane plane;
-    
-    Polygon* polys [mapplane_max_polys];
-    Polygon** cur_poly;
-    
-    inline       Polygon**       polys_begin ()       { return polys; }
-    inline const Polygon* const* polys_begin () const { return polys; }
-    inline       Polygon**       polys_end   ()       { return cur_poly; }
-    inline const Polygon* const* polys_end   () const { return cur_poly; }
-    
-    Portal* portals [mapplane_max_portals];
-    Portal** cur_portal;
-    
-    inline       Portal**       portals_begin ()       { return portals; }
-    inline const Portal* const* portals_begin () const { return portals; }
-    inline       Portal**       portals_end   ()       { return cur_portal; }
-    inline const Portal* const* portals_end   () const { return cur_portal; }
-    
-    inline unsigned portal_count () const { return cur_portal - portals; }
-    
-    PlaneSide boundary;
-    
-    MapPlane () :
-      prev (0), next (0),
-      cur_poly (polys),
-      cur_portal (portals),
-      boundary (0)
-    {}
-    
-    ~MapPlane ()
-    {
-      clear_polys   ();
-      clear_portals ();
-    }
-    
-    void add_poly (Polygon* poly)
-    {
-      assert (this);
-      assert (poly);
-      assert (cur_poly != polys + mapplane_max_polys);
-      
-      *cur_poly++ = poly;
-    }
-    
-    void clear_polys ()
-    {
-      assert (this);
-      
-      for (Polygon** p = polys_begin (); p != polys_end (); p++)
-        if (*p) polygon_free (*p);
-      
-      cur_poly = polys;
-    }
-    
-    void add_portal (Portal* port)
-    {
-      assert (this);
-      assert (port);
-      assert (cur_portal != portals + mapplane_max_portals);
-      
-      *cur_portal++ = port;
-    }
-    
-    void clear_portals ()
-    {
-      assert (this);
-      
-      for (Portal** p = portals_begin (); p != portals_end (); p++)
-        if (*p) portal_free (*p);
-      
-      cur_portal = portals;
-    }
-    
-  };
-  
-  //
-  // mapplane_insert
-  //
-  static void mapplane_insert (MapPlane** head, MapPlane* mp)
-  {
-    assert (head);
-    assert (mp);
-    
-    mp -> prev = 0;
-    mp -> next = *head;
-    if (*head)
-      (*head) -> prev = mp;
-    *head = mp;
-  }
-  
-  //
-  // mapplane_remove
-  //
-  static MapPlane* mapplane_remove (MapPlane** head, MapPlane* mp)
-  {
-    assert (head);
-    assert (mp);
-    
-    MapPlane* next = mp -> next;
-    
-    if (mp -> prev)
-      mp -> prev -> next = mp -> next;
-    else if (*head == mp)
-      *head = mp -> next;
-    
-    if (mp -> next)
-      mp -> next -> prev = mp -> prev;
-    
-    mp -> next = 0;
-    mp -> prev = 0;
-    
-    return next;
-  }
-  
-  //
-  // mapplane_free
-  //
-  static MapPlane* mapplane_free (MapPlane** head, MapPlane* mp)
-  {
-    MapPlane* next = mapplane_remove (head, mp);
-    delete mp;
-    return next;
-  }
-  
-  //
-  // NodeContents
-  //
-  typedef char NodeContents;
-# define contents_nonleaf -1
-# define contents_empty    0
-# define contents_solid    1
-# define contents_outside  2
-  
-  //
-  // Node
-  //
-  struct Node
-  {
-    Plane partition;
-    MapPlane* maps;
-    Node *front, *back;
-    NodeContents contents;
-    
-    Node () :
-      maps (0),
-      front (0), back (0)
-    {}
-    
-    inline bool is_leaf () const
-    {
-      return contents != contents_nonleaf;
-    }
-    
-  };
-  
-  
-  //
-  // map_by_plane
-  //
-  static MapPlane* map_by_plane (Polygon* polys, unsigned count)
-  {
-    assert (polys);
-    assert (count);
-    
-    MapPlane* maps = 0;
-    int map_count = 0;
-    
-    for (Polygon*
-      cur_poly  = polys;
-      cur_poly != polys + count;
-      cur_poly++)
-    {
-      MapPlane* cur_map = maps;
-      
-      for (;cur_map != 0; cur_map = cur_map -> next)
-      {
-        if (is_polygon_in (*cur_poly, cur_map -> plane))
-        {
-          cur_map -> add_poly (cur_poly);
-          break;                         // ---+
-        }                                //    |
-      }                                  //    |
-                                         //    |
-      if (cur_map != 0)                  // <--+
-        continue;
-      
-      Vector3 n = cur_poly -> normal   ();
-      double  d = cur_poly -> distance ();
-      
-      MapPlane* new_map = new MapPlane;
-      new_map -> prev = 0;
-      new_map -> next = maps;
-      new_map -> plane = Plane (n, d);
-      new_map -> add_poly (cur_poly);
-      maps = new_map;
-      map_count++;
-    }
-    
-    return maps;
-  }
-  
-  //
-  // mark_boundary_planes
-  //
-  static unsigned mark_boundary_planes (MapPlane* maps, MapPlane** boundaries, unsigned max_boundaries)
-  {
-    MapPlane** cur_boundary = boundaries;
-    
-    for (MapPlane*
-      cur_map  = maps;
-      cur_map != 0;
-      cur_map  = cur_map -> next)
-    {
-      bool is_boundary = true;
-      PlaneSide first_side = 0;
-      
-      for (MapPlane*
-        comp_map  = maps;
-        comp_map != 0 && is_boundary;
-        comp_map  = comp_map -> next)
-      {
-        // Don't compare with ourselves
-        if (comp_map == cur_map)
-          continue;
-        
-        PlaneSide comp_side = cur_map -> plane.plane_side (comp_map -> plane);
-        
-        // Parallel planes are easy
-        if (comp_side == plane_side_front || comp_side == plane_side_back)
-        {
-          if (first_side == 0)
-            first_side = comp_side;
-          else if (comp_side != first_side)
-            is_boundary = false;
-        }
-        else if (comp_side == plane_side_across)
-        {
-          for (Polygon**
-            p_cur_poly  = comp_map -> polys;
-            p_cur_poly != comp_map -> cur_poly && is_boundary;
-            p_cur_poly++)
-          {
-            const Polygon* cur_poly = *p_cur_poly;
-            
-            PlaneSide poly_side = polygon_side (cur_map -> plane, *cur_poly);
-            
-            if (poly_side == plane_side_front || poly_side == plane_side_back)
-            {
-              if (first_side == 0)
-                first_side = poly_side;
-              else if (poly_side != first_side)
-                is_boundary = false;
-            }
-            else if (poly_side == plane_side_across)
-            {
-              is_boundary = false;
-            }
-            else // if (poly_side == plane_side_in)
-            {
-              debug_trap (false);
-              // Plane map failure: coplanar polygon in nonparallel plane
-            }
-            
-          }
-          // p_cur_poly
-        }
-        else // if (comp_side == plane_side_in)
-        {
-          debug_trap (false);
-          // Plane map failure: close parallel planes detected
-        }
-        
-      }
-      // comp_map
-      
-      if (is_boundary)
-      {
-        cur_map -> boundary = first_side;
-        *cur_boundary++ = cur_map;
-      }
-    }
-    // cur_map
-    
-    return cur_boundary - boundaries;
-  }
-  // mark_boundary_planes
-  
-  //
-  // strip_boundary_planes
-  //
-  static void strip_boundary_planes (MapPlane** boundaries, unsigned boundary_count)
-  {
-    for (MapPlane**
-      b = boundaries;
-      b < boundaries + boundary_count;
-      b++)
-    {
-      (*b) -> clear_polys ();
-    }
-  }
-  
-  //
-  // make_plane_poly
-  //
-  static void make_plane_poly (const Plane* plane, Polygon* poly)
-  {
-    assert (plane);
-    assert (poly);
-    
-    double max_len = -1E16;
-    char major_axis = 0;
-    
-    double len = (plane -> normal.x < 0.0 ? -plane -> normal.x : plane -> normal.x);
-    if (len > max_len)
-    {
-      max_len = len;
-      major_axis = 'x';
-    }
-    
-    len = (plane -> normal.y < 0.0 ? -plane -> normal.y : plane -> normal.y);        
-    if (len > max_len)
-    {
-      max_len = len;
-      major_axis = 'y';
-    }
-        
-    len = (plane -> normal.z < 0.0 ? -plane -> normal.z : plane -> normal.z);        
-    if (len > max_len)
-    {
-      //max_len = len;
-      major_axis = 'z';
-    }
-    
-    Vector3 up;
-    
-    switch (major_axis)
-    {
-      case 'x':
-      case 'y':
-        up.z = 1.0;
-      break;
-      
-      case 'z':
-        up.x = 1.0;
-      break;
-      
-      default:
-        debug_trap (false); // bad plane
-    }
-    
-    double cosine = dot (up, plane -> normal);
-    up += plane -> normal * -cosine;
-    up.normalize ();
-    
-    Vector3 right = cross (up, plane -> normal);
-    
-    up    *= 1000000;
-    right *= 1000000;
-    
-    poly -> clear ();
-    
-    Vector3 centre = plane -> normal * plane -> distance;
-    
-    poly -> add_vertex (centre + right + up);
-    poly -> add_vertex (centre - right + up);
-    poly -> add_vertex (centre - right - up);
-    poly -> add_vertex (centre + right - up);
-  }
-  
-  //
-  // split_poly
-  //
-  void split_poly (const Polygon* poly, const Plane* split, Polygon* fore, Polygon* rear)
-  {
-    fore -> clear ();
-    rear -> clear ();
-    
-    const Vector3* prev;
-    double prev_side;
-    const Vector3* cur = poly -> begin ();
-    double side;
-    
-    while (cur != poly -> end ())
-    {
-      side = split -> point_distance (*cur);
-      
-      if (side < 0.00001 && side > -0.00001)
-        side = 0;
-      
-      if (side * prev_side < 0 && cur != poly -> begin ())
-      // Opposite sides
-      {
-        Vector3 intersection = split -> line_intersection (*cur, *prev);
-        rear -> add_vertex (intersection);
-        fore -> add_vertex (intersection);
-      }
-      
-      if (side > -0.00001)
-        fore -> add_vertex (*cur);
-      
-      if (side < 0.00001)
-        rear -> add_vertex (*cur);
-      
-      prev = cur;
-      cur++;
-      prev_side = side;
-    }
-    
-    // Deal with the last edge
-    side = split -> point_distance (*poly -> begin ());
-    
-    if (side * prev_side < 0)
-    {
-      Vector3 intersection = split -> line_intersection (*poly -> begin (), *prev);
-      rear -> add_vertex (intersection);
-      fore -> add_vertex (intersection);
-    }
-  }
-  
-  //
-  // make_root_portals
-  //
-  static void make_root_portals (Node* root, Node* outside, MapPlane** boundaries, unsigned boundary_count)
-  {
-    for (MapPlane**
-      p_boundary = boundaries;
-      p_boundary < boundaries + boundary_count;
-      p_boundary++)
-    {
-      MapPlane* boundary = *p_boundary;
-      
-      Polygon portal_poly;
-      make_plane_poly (&boundary -> plane, &portal_poly);
-      
-      for (MapPlane**
-        p_clip  = boundaries;
-        p_clip != boundaries + boundary_count;
-        p_clip++)
-      {
-        MapPlane* clip = *p_clip;
-        
-        if (boundary == clip)
-          continue; // Don't clip by ourselves
-        
-        PlaneSide side = boundary -> plane.plane_side (clip -> plane);
-        
-        if (side == plane_side_front || side == plane_side_back)
-          continue; // Don't clip by parallel planes
-        
-        Polygon front_half, back_half;
-        split_poly (&portal_poly, &clip -> plane, &front_half, &back_half);
-        
-        if (clip -> boundary == plane_side_front && !front_half.empty ())
-        {
-          portal_poly = front_half;
-        }
-        else if (!back_half.empty ())
-        {
-          portal_poly = back_half;
-        }
-      }
-      
-      Portal* new_port = portal_alloc ();
-      new_port -> poly = portal_poly;
-      new_port -> a    = root;
-      new_port -> b    = outside;
-      
-      boundary -> add_portal (new_port);
-    }
-  }
-  
-  //
-  // select_partition
-  //
-  static MapPlane* select_partition (MapPlane* maps, Plane* partition)
-  {
-    MapPlane* best = 0;
-    unsigned best_split = ~((unsigned) 0);
-    
-    for (MapPlane*
-      cur_map  = maps;
-      cur_map != 0;
-      cur_map  = cur_map -> next)
-    {
-      // Don't use boundary planes
-      if (cur_map -> boundary)
-        continue;
-      
-      unsigned split = 0;
-      
-      for (MapPlane*
-        comp_map  = maps;
-        comp_map != 0;
-        comp_map  = comp_map -> next)
-      {
-        // Don't compare with ourselves
-        if (comp_map == cur_map)
-          continue;
-        
-        PlaneSide comp_side = cur_map -> plane.plane_side (comp_map -> plane);
-        
-        if (comp_side == plane_side_across)
-        {
-          for (Polygon**
-            cur_poly  = comp_map -> polys_begin ();
-            cur_poly != comp_map -> polys_end   ();
-            cur_poly++)
-          {
-            PlaneSide poly_side = polygon_side (cur_map -> plane, **cur_poly);
-            
-            if (poly_side == plane_side_across)
-              split++;
-          }
-          // CurPoly
-        }
-      }
-      // CompMap
-      
-      if (split < best_split)
-      {
-        best_split = split;
-        best = cur_map;
-      }
-    }
-    // CurMap
-    
-    if (best)
-      *partition = best -> plane;
-    
-    return best;
-  }
-  // select_partition
-  
-  //
-  // add_portal_to_node
-  //
-  static void add_portals_to_node (Node* node, Node* outside, Portal* p1, Portal* p2)
-  {
-    for (MapPlane*
-      cur_map  = node -> maps;
-      cur_map != 0;
-      cur_map  = cur_map -> next)
-    {
-      if (is_polygon_in (p1 -> poly, cur_map -> plane))
-      {
-        cur_map -> add_portal (p1);
-        cur_map -> add_portal (p2);
-        return;
-      }
-    }
-    
-    debug_trap (node == outside);
-    
-    MapPlane* new_map = new MapPlane;
-    new_map -> plane = Plane (p1 -> poly.normal (), p1 -> poly.distance ());
-    mapplane_insert (&node -> maps, new_map);
-    
-    new_map -> add_portal (p1);
-    new_map -> add_portal (p2);
-  }
-  
-  //
-  // recursive_partition
-  // I CAN SEE FOREVER
-  //
-  static void recursive_partition (Node* node, NodeContents potential_contents, Node* outside, void (*status) (const char*))
-  {
-    // Select partition
-    MapPlane* partition_map = select_partition (node -> maps, &node -> partition);
-    
-    // If we can't find a partition, then we must be a leaf, so we're done.
-    if (!partition_map)
-    {
-      status ("Leaf");
-      
-      node -> contents = potential_contents;
-      
-      for (MapPlane*
-        m  = node -> maps;
-        m != 0;
-        m  = m -> next)
-      {
-        for (Portal**
-          p  = m -> portals_begin ();
-          p != m -> portals_end   ();
-          p++)
-        {
-          if (!portal_valid (*p))
-          {
-            portal_free (*p);
-            *p = 0;
-            continue;
-          }
-          
-          Node* other;
-          
-          if      ((*p) -> a == node) other = (*p) -> b;
-          else if ((*p) -> b == node) other = (*p) -> a;
-          else                        debug_trap (false); // Mislinked
-          
-          if (other -> is_leaf () && other -> contents != node -> contents)
-          {
-            portal_free (*p);
-            *p = 0;
-          }
-        }
-        
-        if (node -> contents != contents_empty)
-          m -> clear_polys ();
-      }
-      
-      return;
-    }
-    
-    // Not a leaf
-    node -> contents = contents_nonleaf;
-    node -> front = new Node;
-    node -> back  = new Node;
-    
-    // Create the portal for this partition
-    Portal* partition_portal = portal_alloc ();
-    partition_portal -> a = node -> front;
-    partition_portal -> b = node -> back;
-    
-    make_plane_poly (&partition_map -> plane, &partition_portal -> poly);
-    
-    // Sort geometry into children
-    for (MapPlane*
-      cur_map  = node -> maps;
-      cur_map != 0;)
-    {
-      PlaneSide side;
-      
-      MapPlane* p_front = 0;
-      MapPlane* p_back  = 0;
-      
-#     define CHECKFRONT                                      \
-        if (!p_front) {                                      \
-          p_front = new MapPlane;                            \
-          p_front -> plane = cur_map -> plane;               \
-          p_front -> boundary = cur_map -> boundary;         \
-          mapplane_insert (&node -> front -> maps, p_front); \
-        };
-      
-#     define CHECKBACK                                      \
-        if (!p_back) {                                      \
-          p_back = new MapPlane;                            \
-          p_back -> plane = cur_map -> plane;               \
-          p_back -> boundary = cur_map -> boundary;         \
-          mapplane_insert (&node -> back -> maps, p_back);  \
-        };
-      
-      if (cur_map == partition_map)
-        side = plane_side_in;
-      else
-        side = node -> partition.plane_side (cur_map -> plane);
-      
-      // Parallel planes are easy
-      if (side == plane_side_front)
-      {
-        status ("Front");
-        
-        // Move the map
-        p_front = cur_map;
-        cur_map = mapplane_remove (&node -> maps, cur_map);
-        mapplane_insert (&node -> front -> maps, p_front);
-        
-        // Relink portals
-        for (Portal**
-          cur_portal  = p_front -> portals_begin ();
-          cur_portal != p_front -> portals_end   ();
-          cur_portal++)
-        {
-          if (!portal_valid (*cur_portal))
-          {
-            portal_free (*cur_portal);
-            *cur_portal = 0;
-            continue;
-          }
-          
-          if      ((*cur_portal) -> a == node) (*cur_portal) -> a = node -> front;
-          else if ((*cur_portal) -> b == node) (*cur_portal) -> b = node -> front;
-          else    debug_trap (false); //  ("(X) Mislinked portal");
-        }
-        
-        // Don't mis-iterate - old *cur_map is in *front now, new *cur_map is the next one already
-        continue;
-      }
-      else if (side == plane_side_back)
-      {
-        status ("Back");
-        
-        // Move the map
-        p_back = cur_map;
-        cur_map = mapplane_remove (&node -> maps, cur_map);
-        mapplane_insert (&node -> back -> maps, p_back);
-        
-        // Relink portals
-        for (Portal**
-          cur_portal  = p_back -> portals_begin ();
-          cur_portal != p_back -> portals_end   ();
-          cur_portal++)
-        {
-          if (!portal_valid (*cur_portal))
-          {
-            portal_free (*cur_portal);
-            *cur_portal = 0;
-            continue;
-          }
-          
-          if      ((*cur_portal) -> a == node) (*cur_portal) -> a = node -> back;
-          else if ((*cur_portal) -> b == node) (*cur_portal) -> b = node -> back;
-          else    debug_trap (false); //  ("(X) Mislinked portal");
-        }
-        
-        // Don't mis-iterate - old *cur_map is in *back now, new *cur_map is the next one already
-        continue;
-      }
-      else if (side == plane_side_in)
-      {
-        status ("In");
-        
-        CHECKFRONT
-        p_front -> boundary = plane_side_front;
-        p_front -> add_portal (partition_portal);
-        
-        CHECKBACK
-        p_back -> boundary = plane_side_back;
-        p_back -> add_portal (partition_portal);
-        
-        for (Polygon**
-          cur_poly  = cur_map -> polys_begin ();
-          cur_poly != cur_map -> polys_end   ();
-          cur_poly++)
-        {
-          const double dist = dot (
-            (*cur_poly) -> normal (),
-            node -> partition.normal
-          );
-          
-          if (dist > 0)
-            p_front -> add_poly (*cur_poly);
-          else
-            p_back -> add_poly (*cur_poly);
-          
-          *cur_poly = 0;
-        }
-      }
-      else if (side == plane_side_across)
-      {
-        status ("Across");
-        
-        // *cur_map is not parallel to Partition
-        
-        // Clip our portal polygon if this map is a boundary
-        if (cur_map -> boundary)
-        {
-          Polygon portal_front, portal_back;
-          split_poly (&partition_portal -> poly, &cur_map -> plane, &portal_front, &portal_back);
-          
-          if (cur_map -> boundary == plane_side_front && !portal_front.empty ())
-          {
-            partition_portal -> poly = portal_front;
-          }
-          else if (cur_map -> boundary == plane_side_back && !portal_back.empty ())
-          {
-            partition_portal -> poly = portal_back;
-          }
-          else
-          {
-            status ("Portal polygon empty after clipping by boundary plane");
-            debug_trap (false);
-          }
-        }
-        
-        // We need to sort every
-        //  polygon in *cur_map into the correct child, splitting when necessary
-        for (Polygon**
-          cur_poly  = cur_map -> polys_begin ();
-          cur_poly != cur_map -> polys_end   ();
-          cur_poly++)
-        {
-          const PlaneSide poly_side = polygon_side (node -> partition, **cur_poly);
-          
-          if (poly_side == plane_side_front)
-          {
-            // Add this plane into the front if we haven't already
-            CHECKFRONT
-            p_front -> add_poly (*cur_poly);
-            *cur_poly = 0; // **cur_poly is in *front, don't free it next map
-          }
-          else if (poly_side == plane_side_back)
-          {
-            // Add this plane into the back if we haven't already
-            CHECKBACK
-            p_back -> add_poly (*cur_poly);
-            *cur_poly = 0; // **cur_poly is in *back, don't free it next map
-          }
-          else if (poly_side == plane_side_across)
-          {
-            Polygon* front_half = polygon_alloc ();
-            Polygon* back_half  = polygon_alloc ();
-            
-            split_poly (*cur_poly, &node -> partition, front_half, back_half);
-            
-            // Leave these new polygons for later. Saves duplicating the front
-            //  and back cases here. Extra empty checks, just in case.
-            
-            if (!front_half -> empty ())
-            {
-              CHECKFRONT
-              p_front -> add_poly (front_half);
-            }
-            
-            if (!back_half -> empty ())
-            {
-              CHECKBACK
-              p_back -> add_poly (back_half);
-            }
-          }
-          // if (PolySide == ...)
-        }
-        // for (Polys)
-        
-        //
-        // Perform the same process for portals
-        //
-        for (Portal**
-          cur_portal  = cur_map -> portals_begin ();
-          cur_portal != cur_map -> portals_end ();
-          cur_portal++) // shoulder been erase
-        {
-          if (!portal_valid (*cur_portal))
-          {
-            portal_free (*cur_portal);
-            *cur_portal = 0;
-            continue;
-          }
-          
-          PlaneSide portal_side = polygon_side (node -> partition, (*cur_portal) -> poly);
-          
-          if (portal_side == plane_side_front)
-          {
-            
-            if      ((*cur_portal) -> a == node) (*cur_portal) -> a = node -> front;
-            else if ((*cur_portal) -> b == node) (*cur_portal) -> b = node -> front;
-            else                                 debug_trap (false); // mislinked
-            
-            CHECKFRONT
-            p_front -> add_portal (*cur_portal);
-            *cur_portal = 0; // **cur_portal is in *front, don't free it next map
-          }
-          else if (portal_side == plane_side_back)
-          {
-            if      ((*cur_portal) -> a == node) (*cur_portal) -> a = node -> back;
-            else if ((*cur_portal) -> b == node) (*cur_portal) -> b = node -> back;
-            else                                 debug_trap (false); // mislinked
-            
-            CHECKBACK
-            p_back -> add_portal (*cur_portal);
-            *cur_portal = 0; // **cur_portal is in *back, don't free it next map
-          }
-          else if (portal_side == plane_side_across)
-          {
-            Node* other_node = (
-              (*cur_portal) -> a == node ?
-              (*cur_portal) -> b :
-              (*cur_portal) -> a
-            );
-            
-            Portal* front_portal = portal_alloc ();
-            front_portal -> a = node -> front;
-            front_portal -> b = other_node;
-            
-            Portal* back_portal = portal_alloc ();
-            back_portal -> a = node -> back;
-            back_portal -> b = other_node;
-            
-            split_poly (
-              &((*cur_portal) -> poly),
-              &node -> partition,
-              &(front_portal -> poly),
-              &(back_portal  -> poly)
-            );
-            
-            debug_trap (!front_portal -> poly.empty ());
-            debug_trap (!back_portal  -> poly.empty ());
-            
-            add_portals_to_node (other_node, outside, front_portal, back_portal);
-            
-            CHECKFRONT
-            p_front -> add_portal (front_portal);
-            
-            CHECKBACK
-            p_back -> add_portal (back_portal);
-          }
-          // if (PortalSide == ...)
-        }
-        // for (Portals)
-      }
-      else // if (Side == PlaneType::In)
-      {
-        debug_trap (false); //  ("(X) Coplanar plane detected");
-      }
-      // if (Side == ...)
-      
-      cur_map = mapplane_free (&node -> maps, cur_map);
-    }
-    // for (Maps)
-    
-    status ("recursive_partition (front)...");
-    recursive_partition (node -> front, contents_empty, outside, status);
-    
-    status ("recursive_partition (back)...");
-    recursive_partition (node -> back,  contents_solid, outside, status);
-  }
-  // recursive_partition
-  
-  //
-  // verify_portals
-  //
-  static void verify_portals (Node* node)
-  {
-    if (node -> is_leaf ())
-    {
-      unsigned portal_count = 0;
-      unsigned removed_count = 0;
-      
-      for (MapPlane*
-        m  = node -> maps;
-        m != 0;
-        m  = m -> next)
-      {
-        portal_count += m -> portal_count ();
-        
-        for (Portal**
-          p  = m -> portals_begin ();
-          p != m -> portals_end ();
-          p++)
-        {
-          if (!portal_valid (*p))
-          {
-            portal_free (*p);
-            *p = 0;
-            removed_count++;
-            continue;
-          }
-          
-          Node* n;
-          
-          if      ((*p) -> a == node) n = (*p) -> b;
-          else if ((*p) -> b == node) n = (*p) -> a;
-          else                        debug_trap (false); // mislinked
-          
-          debug_trap (n -> is_leaf ()); // portal to non-leaf
-        }
-        // for (Portals ...
-      }
-      // for (Maps ...
-      
-      //cout << "Leaf with " << PortalCount << " portals now has " << PortalCount - RemovedCount << "\n";
-    }
-    else
-    {
-      verify_portals (node -> front);
-      verify_portals (node -> back);
-    }
-  }
-  
-  //
-  // OutsideLeaves
-  //
-# define outsideleaves_max_size 1024
-  struct OutsideLeaves
-  {
-    Node* leaves [outsideleaves_max_size];
-    Node** cur_leaf;
-  };
-  
-  //
-  // fill_outside_flow
-  //
-  static void fill_outside_flow (Node* node, OutsideLeaves* ols)
-  {
-    for (MapPlane*
-      m  = node -> maps;
-      m != 0;
-      m  = m -> next)
-    {
-      m -> clear_polys ();
-      
-      for (Portal**
-        p  = m -> portals_begin ();
-        p != m -> portals_end ();
-        p++)
-      {
-        if (!portal_valid (*p))
-        {
-          portal_free (*p);
-          *p = 0;
-          continue;
-        }
-        
-        Node* other = (
-          (*p) -> a == node
-        ? (*p) -> b
-        : (*p) -> a
-        );
-        
-        for (Node**
-          ol  = ols -> leaves;
-          ol != ols -> cur_leaf;
-          ol++)
-        {
-          if (*ol == other)
-          {
-            other = 0;
-            break;
-          }
-        }
-        
-        if (other == 0)
-          continue;
-        
-        other -> contents = node -> contents;
-        *ols -> cur_leaf++ = other;
-        
-        fill_outside_flow (other, ols);
-        
-        portal_free (*p);
-        *p = 0;
-      }
-    }
-  }
-  
-  //
-  // fill_outside
-  //
-  static void fill_outside (Node* outside)
-  {
-    OutsideLeaves ols;
-    ols.cur_leaf = ols.leaves;
-    *ols.cur_leaf++ = outside;
-    
-    fill_outside_flow (outside, &ols);
-  }
-  
-  //
-  // world_locate
-  //
-  static Node* world_locate (Node* node, Vector3 point)
-  {
-    assert (node);
-    
-    while (node -> front && node -> back)
-    {
-      double side = node -> partition.point_distance (point);
-      if (side < -0.00001)
-        node = node -> back;
-      else
-        node = node -> front;
-    }
-    
-    return node;
-  }
-  
-  //
-  // check_entities
-  //
-  static void check_entities (Node* root, void (*status) (const char*))
-  {
-    Node* origin_leaf = world_locate (root, Vector3 ());
-    
-    if (origin_leaf -> contents == contents_outside)
-      status ("LEAK LEAK LEAK");
-    else if (origin_leaf -> contents == contents_solid)
-      status ("- Warning: entity embedded in solid");
-  }
-  
-  //
-  // World
-  //
-  struct World
-  {
-    Node root;
-    Node outside;
-    
-  };
-  
-  //
-  // dummy_status
-  //
-  static void dummy_status (const char*)
-  {
-    
-  }
-  
-  //
-  // world_compile
-  //
-  World* world_compile (Polygon* polys, unsigned count, void (*status) (const char*))
-  {
-    if (!status)
-      status = dummy_status;
-    
-    assert (polys);
-    assert (count);
-    
-    World* world = new World;
-    world -> outside.contents = contents_outside;
-    
-    status ("map_by_plane...");
-    world -> root.maps = map_by_plane (polys, count);
-    
-    status ("mark_boundary_planes...");
-    MapPlane* boundaries [1024];
-    unsigned boundary_count = mark_boundary_planes (world -> root.maps, boundaries, 1024);
-    
-    status ("strip_boundary_planes...");
-    strip_boundary_planes (boundaries, boundary_count);
-    
-    status ("make_root_portals...");
-    make_root_portals (&world -> root, &world -> outside, boundaries, boundary_count);
-    
-    status ("recursive_partition...");
-    recursive_partition (&world -> root, contents_empty, &world -> outside, status);
-    
-    status ("verify_portals...");
-    verify_portals (&world -> root);
-    
-    status ("fill_outside...");
-    fill_outside (&world -> outside);
-    
-    status ("check_entities...");
-    check_entities (&world -> root, status);
-    
-    status ("Done");
-    return world;
-  }
-  
-  //
-  // world_free
-  //
-  void world_free (World* world)
-  {
-    if (!world)
-      return;
-    
-    MapPlane* map = world -> root.maps;
-    while (map)
-    {
-      MapPlane* next = map -> next;
-      delete map;
-      map = next;
-    }
-    
-    delete world;
-  }
-  
-  //
-  // world_save_recursive
-  //
-  static bool world_save_recursive (Node* node, FILE* file)
-  {
-    assert (node);
-    assert (file);
-    
-    fwrite (&node -> contents, 1, 1, file);
-    
-    if (!node -> front && !node -> back) // Leaf
-    {
-      if (node -> contents != contents_empty)
-        return true;
-      
-      rku32 tri_count = 0;
-      fseek (file, 4, SEEK_CUR); // We'll write this later
-      
-      for (MapPlane*
-        m  = node -> maps;
-        m != 0;
-        m  = m -> next)
-      {
-        for (Polygon**
-          p  = m -> polys_begin ();
-          p != m -> polys_end   ();
-          p++)
-        {
-          if (!*p)
-            continue;
-          
-          unsigned size = (*p) -> size ();
-          if (!size)
-            continue;
-          
-          Rk::Vector3f verts [3];
-          verts [0] = (*p) -> vertices [0];
-          
-          for (int i = 0; i < size - 2; i++)
-          {
-            verts [1] = (*p) -> vertices [i + 1];
-            verts [2] = (*p) -> vertices [i + 2];
-            fwrite (verts, 36, 1, file);
-            tri_count++;
-          }
-        }
-      }
-      
-      int skip = tri_count * 36;
-      fseek (file, -skip - 4, SEEK_CUR);
-      fwrite (&tri_count, 4, 1, file);
-      fseek (file, skip, SEEK_CUR);
-    }
-    else if (node -> front && node -> back) // Non-Leaf
-    {
-      rkf32 plane [4] = {
-        node -> partition.normal.x,
-        node -> partition.normal.y,
-        node -> partition.normal.z,
-        node -> partition.distance
-      };
-      
-      fwrite (plane, 4, 4, file);
-      
-      world_save_recursive (node -> front, file);
-      world_save_recursive (node -> back,  file);
-    }
-    else
-    {
-      assert (false);
-    }
-    
-    return true;
-  }
-  
-  //
-  // world_save
-  //
-  bool world_save (World* world, const char* filename)
-  {
-    assert (world);
-    assert (filename);
-    
-    FILE* file = fopen (filename, "wb");
-    if (!file)
-      return false;
-    
-    fputs ("RKINDOOR", file);
-    
-    bool ok = world_save_recursive (&world -> root, file);
-    
-    fclose (file);
-    
-    return ok;
-  }
-  
-}
-// namespace In
+//
+// Copyright (C) 2009 Roadkill Software
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+
+#include "World.hpp"
+#include "Portal.hpp"
+#include "Arena.hpp"
+#include "Hash.hpp"
+#include "Clean.hpp"
+#include "Predicates.hpp"
+#include "Planes.hpp"
+#include "Thread.hpp"
+#include "Lz.hpp"
+
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+
+#include <Rk/Types.hpp>
+#include <Rk/Plane.hpp>
+
+using Rk::PlaneSide;
+
+namespace In
+{
+  //inline void debug_trap (bool exp = false) { if (!exp) { *((int*) 0) = 1; } }
+  #define debug_trap(exp) { if (!(exp)) { *((int*) 0) = 1; } }
+  
+  PlaneSide polygon_side (const Plane& plane, const Polygon& poly)
+  {
+    int first_class = 0;
+    
+    for (const Vector3*
+      v  = poly.begin ();
+      v != poly.end ();
+      v++)
+    {
+      int cls = point_class (plane.normal, plane.distance, *v);
+      
+      if (first_class == 0)
+      {
+        first_class = cls;
+      }
+      else if (cls * first_class < 0)
+      {
+        return plane_side_across;
+      }
+    }
+    
+    return (first_class < 0 ? plane_side_back : plane_side_front);
+  }
+  
+  //
+  // is_polygon_in
+  // Returns true if Poly lies roughly within plane, false otherwise.
+  //
+  bool is_polygon_in (const Polygon& poly, const Plane& plane)
+  {
+    for (const Vector3*
+      v  = poly.begin ();
+      v != poly.end ();
+      v++)
+    {
+      if (point_class (plane.normal, plane.distance, *v) != 0)
+        return false;
+    }
+    
+    return true;
+  }
+
+  //
+  // MapPlane
+  // Polygon and portal lists live in arena spans, so a plane costs only as
+  //  much as it actually holds.
+  //
+  struct MapPlane
+  {
+    MapPlane *prev, *next;
+    
+    PlaneIndex plane;
+    
+    ArenaSpan <Polygon*> polys;
+    unsigned detail_count; // The last of Polys, which clip_detail added
+    
+    inline       Polygon**       polys_begin ()       { return polys.begin (); }
+    inline const Polygon* const* polys_begin () const { return polys.begin (); }
+    inline       Polygon**       polys_end   ()       { return polys.end   (); }
+    inline const Polygon* const* polys_end   () const { return polys.end   (); }
+    
+    ArenaSpan <Portal*> portals;
+    
+    inline       Portal**       portals_begin ()       { return portals.begin (); }
+    inline const Portal* const* portals_begin () const { return portals.begin (); }
+    inline       Portal**       portals_end   ()       { return portals.end   (); }
+    inline const Portal* const* portals_end   () const { return portals.end   (); }
+    
+    inline unsigned portal_count () const { return portals.size (); }
+    
+    PlaneSide boundary;
+    
+    MapPlane () :
+      prev (0), next (0),
+      plane (0),
+      detail_count (0),
+      boundary (0)
+    {}
+    
+    ~MapPlane ()
+    {
+      clear_polys   ();
+      clear_portals ();
+    }
+    
+    void add_poly (Polygon* poly)
+    {
+      assert (this);
+      assert (poly);
+      
+      polys.push (poly);
+    }
+    
+    void clear_polys ()
+    {
+      assert (this);
+      
+      for (Polygon** p = polys_begin (); p != polys_end (); p++)
+        if (*p) polygon_free (*p);
+      
+      polys.release ();
+      detail_count = 0;
+    }
+    
+    void add_portal (Portal* port)
+    {
+      assert (this);
+      assert (port);
+      
+      portals.push (port);
+    }
+    
+    void clear_portals ()
+    {
+      assert (this);
+      
+      for (Portal** p = portals_begin (); p != portals_end (); p++)
+        if (*p) portal_free (*p);
+      
+      portals.release ();
+    }
+    
+  };
+  
+  //
+  // mapplane_insert
+  //
+  static void mapplane_insert (MapPlane** head, MapPlane* mp)
+  {
+    assert (head);
+    assert (mp);
+    
+    mp -> prev = 0;
+    mp -> next = *head;
+    if (*head)
+      (*head) -> prev = mp;
+    *head = mp;
+  }
+  
+  //
+  // mapplane_remove
+  //
+  static MapPlane* mapplane_remove (MapPlane** head, MapPlane* mp)
+  {
+    assert (head);
+    assert (mp);
+    
+    MapPlane* next = mp -> next;
+    
+    if (mp -> prev)
+      mp -> prev -> next = mp -> next;
+    else if (*head == mp)
+      *head = mp -> next;
+    
+    if (mp -> next)
+      mp -> next -> prev = mp -> prev;
+    
+    mp -> next = 0;
+    mp -> prev = 0;
+    
+    return next;
+  }
+  
+  //
+  // mapplane_free
+  //
+  static MapPlane* mapplane_free (MapPlane** head, MapPlane* mp)
+  {
+    MapPlane* next = mapplane_remove (head, mp);
+    delete mp;
+    return next;
+  }
+  
+  //
+  // NodeContents
+  //
+  typedef char NodeContents;
+# define contents_nonleaf -1
+# define contents_empty    0
+# define contents_solid    1
+# define contents_outside  2
+  
+# define no_cluster (~0u)
+  
+  //
+  // Node
+  //
+  struct Node
+  {
+    PlaneIndex partition;
+    MapPlane* maps;
+    Node *front, *back;
+    NodeContents contents;
+    unsigned leaf_index; // Dense, assigned as leaves are finished
+    rku64 input_hash;    // Of the maps this node received, for recompiles
+    rku32 tri_offset;    // Of the leaf's triangles in the output file, once written
+    rku32 tri_count;
+    rku8 tri_encoding;   // leaf_floats or leaf_quantized
+    rkf32 tri_mins [3];  // Bounds of the leaf's triangles
+    rkf32 tri_maxs [3];
+    unsigned cluster;    // Of empty leaves, once clustered
+    Node* cluster_next;  //  and the next leaf in it
+    
+    Node () :
+      partition (0),
+      maps (0),
+      front (0), back (0),
+      leaf_index (0),
+      input_hash (0),
+      tri_offset (0),
+      tri_count (0),
+      tri_encoding (0),
+      cluster (no_cluster),
+      cluster_next (0)
+    {
+      for (unsigned i = 0; i != 3; i++)
+        tri_mins [i] = tri_maxs [i] = 0.0f;
+    }
+    
+    inline bool is_leaf () const
+    {
+      return contents != contents_nonleaf;
+    }
+    
+  };
+  
+  
+  //
+  // past_deadline
+  // Stages of a compile_step check between items of work, after the first,
+  //  so every step gets somewhere. Deadlines are on thread_clock, and 0 is
+  //  none.
+  //
+  static inline bool past_deadline (double deadline)
+  {
+    return deadline != 0.0 && thread_clock () > deadline;
+  }
+  
+  //
+  // map_by_plane
+  // Works on pooled copies; partitioning splits and frees what it is given,
+  //  and the caller's polygons must survive for further compiles. Detail
+  //  polygons are skipped. Maps from Next on, until all are done, returning
+  //  true, or until the deadline passes.
+  //
+  static bool map_by_plane (MapPlane** maps, const Polygon* polys, unsigned count, unsigned* next, double deadline)
+  {
+    assert (maps);
+    assert (polys);
+    assert (count);
+    
+    unsigned done = 0;
+    
+    for (; *next != count; ++*next)
+    {
+      if (done++ && past_deadline (deadline))
+        return false;
+      
+      const Polygon* in_poly = polys + *next;
+      
+      Polygon* cur_poly = polygon_alloc ();
+      *cur_poly = *in_poly;
+      
+      PlaneIndex plane = plane_find (Plane (cur_poly -> normal (), cur_poly -> distance ()));
+      
+      MapPlane* cur_map = *maps;
+      
+      for (;cur_map != 0; cur_map = cur_map -> next)
+      {
+        if (plane_same (plane, cur_map -> plane))
+        {
+          cur_map -> add_poly (cur_poly);
+          break;                         // ---+
+        }                                //    |
+      }                                  //    |
+                                         //    |
+      if (cur_map != 0)                  // <--+
+        continue;
+      
+      MapPlane* new_map = new MapPlane;
+      new_map -> prev = 0;
+      new_map -> next = *maps;
+      new_map -> plane = plane;
+      new_map -> add_poly (cur_poly);
+      *maps = new_map;
+    }
+    
+    return true;
+  }
+  
+  //
+  // mark_boundary_planes
+  // Tests the maps from Next on, until all are done, returning true, or
+  //  until the deadline passes.
+  //
+  static bool mark_boundary_planes (MapPlane* maps, MapPlane** next, ArenaSpan <MapPlane*>* boundaries, double deadline)
+  {
+    unsigned done = 0;
+    
+    for (; *next != 0; *next = (*next) -> next)
+    {
+      if (done++ && past_deadline (deadline))
+        return false;
+      
+      MapPlane* cur_map = *next;
+      const Plane& plane = plane_get (cur_map -> plane);
+      bool is_boundary = true;
+      PlaneSide first_side = 0;
+      
+      for (MapPlane*
+        comp_map  = maps;
+        comp_map != 0 && is_boundary;
+        comp_map  = comp_map -> next)
+      {
+        // Don't compare with ourselves
+        if (comp_map == cur_map)
+          continue;
+        
+        PlaneSide comp_side = plane.plane_side (plane_get (comp_map -> plane));
+        
+        // Parallel planes are easy
+        if (comp_side == plane_side_front || comp_side == plane_side_back)
+        {
+          if (first_side == 0)
+            first_side = comp_side;
+          else if (comp_side != first_side)
+            is_boundary = false;
+        }
+        else if (comp_side == plane_side_across)
+        {
+          for (Polygon**
+            p_cur_poly  = comp_map -> polys_begin ();
+            p_cur_poly != comp_map -> polys_end () && is_boundary;
+            p_cur_poly++)
+          {
+            const Polygon* cur_poly = *p_cur_poly;
+            
+            PlaneSide poly_side = polygon_side (plane, *cur_poly);
+            
+            if (poly_side == plane_side_front || poly_side == plane_side_back)
+            {
+              if (first_side == 0)
+                first_side = poly_side;
+              else if (poly_side != first_side)
+                is_boundary = false;
+            }
+            else if (poly_side == plane_side_across)
+            {
+              is_boundary = false;
+            }
+            else // if (poly_side == plane_side_in)
+            {
+              debug_trap (false);
+              // Plane map failure: coplanar polygon in nonparallel plane
+            }
+            
+          }
+          // p_cur_poly
+        }
+        else // if (comp_side == plane_side_in)
+        {
+          debug_trap (false);
+          // Plane map failure: close parallel planes detected
+        }
+        
+      }
+      // comp_map
+      
+      if (is_boundary)
+      {
+        cur_map -> boundary = first_side;
+        boundaries -> push (cur_map);
+      }
+    }
+    // cur_map
+    
+    return true;
+  }
+  // mark_boundary_planes
+  
+  //
+  // strip_boundary_planes
+  //
+  static void strip_boundary_planes (MapPlane** boundaries, unsigned boundary_count)
+  {
+    for (MapPlane**
+      b = boundaries;
+      b < boundaries + boundary_count;
+      b++)
+    {
+      (*b) -> clear_polys ();
+    }
+  }
+  
+  //
+  // make_plane_poly
+  // A square plane_poly_extent either side of the point on Plane nearest
+  //  the origin.
+  //
+  void make_plane_poly (const Plane* plane, Polygon* poly)
+  {
+    assert (plane);
+    assert (poly);
+    
+    double max_len = -1E16;
+    char major_axis = 0;
+    
+    double len = (plane -> normal.x < 0.0 ? -plane -> normal.x : plane -> normal.x);
+    if (len > max_len)
+    {
+      max_len = len;
+      major_axis = 'x';
+    }
+    
+    len = (plane -> normal.y < 0.0 ? -plane -> normal.y : plane -> normal.y);        
+    if (len > max_len)
+    {
+      max_len = len;
+      major_axis = 'y';
+    }
+        
+    len = (plane -> normal.z < 0.0 ? -plane -> normal.z : plane -> normal.z);        
+    if (len > max_len)
+    {
+      //max_len = len;
+      major_axis = 'z';
+    }
+    
+    Vector3 up;
+    
+    switch (major_axis)
+    {
+      case 'x':
+      case 'y':
+        up.z = 1.0;
+      break;
+      
+      case 'z':
+        up.x = 1.0;
+      break;
+      
+      default:
+        debug_trap (false); // bad plane
+    }
+    
+    double cosine = dot (up, plane -> normal);
+    up += plane -> normal * -cosine;
+    up.normalize ();
+    
+    Vector3 right = cross (up, plane -> normal);
+    
+    up    *= plane_poly_extent;
+    right *= plane_poly_extent;
+    
+    poly -> clear ();
+    
+    Vector3 centre = plane -> normal * plane -> distance;
+    
+    poly -> add_vertex (centre + right + up);
+    poly -> add_vertex (centre - right + up);
+    poly -> add_vertex (centre - right - up);
+    poly -> add_vertex (centre + right - up);
+  }
+  
+  //
+  // split_classified
+  // Splits Poly by Split given its vertices' classes, one per vertex.
+  //
+  static void split_classified (const Polygon* poly, const signed char* classes, const Plane* split, Polygon* fore, Polygon* rear)
+  {
+    fore -> clear ();
+    rear -> clear ();
+    
+    if (poly -> empty ())
+      return;
+    
+    const Vector3* prev;
+    int prev_side;
+    const Vector3* cur = poly -> begin ();
+    int side;
+    
+    int first_side = classes [0];
+    
+    while (cur != poly -> end ())
+    {
+      side = classes [cur - poly -> begin ()];
+      
+      if (side * prev_side < 0 && cur != poly -> begin ())
+      // Opposite sides
+      {
+        Vector3 intersection = split -> line_intersection (*cur, *prev);
+        rear -> add_vertex (intersection);
+        fore -> add_vertex (intersection);
+      }
+      
+      if (side >= 0)
+        fore -> add_vertex (*cur);
+      
+      if (side <= 0)
+        rear -> add_vertex (*cur);
+      
+      prev = cur;
+      cur++;
+      prev_side = side;
+    }
+    
+    // Deal with the last edge
+    side = first_side;
+    
+    if (side * prev_side < 0)
+    {
+      Vector3 intersection = split -> line_intersection (*poly -> begin (), *prev);
+      rear -> add_vertex (intersection);
+      fore -> add_vertex (intersection);
+    }
+  }
+  
+  //
+  // split_poly
+  //
+  void split_poly (const Polygon* poly, const Plane* split, Polygon* fore, Polygon* rear)
+  {
+    // Each vertex is classified once, so both halves agree on it
+    signed char local [polygon_max_vertices];
+    ArenaSpan <signed char> spilled;
+    signed char* classes = local;
+    
+    if (poly -> size () > polygon_max_vertices)
+    {
+      spilled.reserve (poly -> size ());
+      classes = spilled.begin ();
+    }
+    
+    unsigned i = 0;
+    for (const Vector3*
+      v  = poly -> begin ();
+      v != poly -> end   ();
+      v++)
+    {
+      classes [i++] = point_class (split -> normal, split -> distance, *v);
+    }
+    
+    split_classified (poly, classes, split, fore, rear);
+  }
+  
+  //
+  // classify_polys
+  // Classifies every vertex of Polys against Plane in one pass, appending
+  //  to Classes in order. Null entries are skipped.
+  //
+  static void classify_polys (Polygon* const* polys, Polygon* const* polys_end, const Plane& plane, ArenaSpan <signed char>* classes)
+  {
+    unsigned total = classes -> size ();
+    for (Polygon* const* p = polys; p != polys_end; p++)
+      if (*p) total += (*p) -> size ();
+    
+    classes -> reserve (total);
+    
+    for (Polygon* const* p = polys; p != polys_end; p++)
+    {
+      if (!*p)
+        continue;
+      
+      for (const Vector3*
+        v  = (*p) -> begin ();
+        v != (*p) -> end   ();
+        v++)
+      {
+        classes -> push (point_class (plane.normal, plane.distance, *v));
+      }
+    }
+  }
+  
+  //
+  // classes_side
+  // Polygon_side, from the polygon's vertex classes.
+  //
+  static inline PlaneSide classes_side (const signed char* classes, unsigned size)
+  {
+    int first_class = 0;
+    
+    for (unsigned i = 0; i != size; i++)
+    {
+      if (first_class == 0)
+        first_class = classes [i];
+      else if (classes [i] * first_class < 0)
+        return plane_side_across;
+    }
+    
+    return (first_class < 0 ? plane_side_back : plane_side_front);
+  }
+  
+  //
+  // plane_facing
+  // Plane or its flip, whichever faces the way Poly winds.
+  //
+  static inline PlaneIndex plane_facing (PlaneIndex plane, const Polygon& poly)
+  {
+    return dot (poly.normal (), plane_get (plane).normal) < 0.0 ? plane_flip (plane) : plane;
+  }
+  
+  //
+  // hash_node_input
+  // Covers everything select_partition looks at - plane order, planes,
+  //  boundary flags and polygons - so equal hashes select equal partitions.
+  //  Planes are hashed by value, since workers number theirs differently.
+  //
+  static rku64 hash_node_input (const Node* node)
+  {
+    rku64 hash = hash_seed;
+    
+    for (const MapPlane*
+      m  = node -> maps;
+      m != 0;
+      m  = m -> next)
+    {
+      const Plane& plane = plane_get (m -> plane);
+      hash = hash_bytes (hash, &plane.normal.x, sizeof (Scalar));
+      hash = hash_bytes (hash, &plane.normal.y, sizeof (Scalar));
+      hash = hash_bytes (hash, &plane.normal.z, sizeof (Scalar));
+      hash = hash_bytes (hash, &plane.distance, sizeof (Scalar));
+      hash = hash_bytes (hash, &m -> boundary, sizeof (m -> boundary));
+      
+      for (const Polygon* const*
+        p  = m -> polys_begin ();
+        p != m -> polys_end   ();
+        p++)
+      {
+        if (!*p)
+          continue;
+        
+        for (const Vector3*
+          v  = (*p) -> begin ();
+          v != (*p) -> end   ();
+          v++)
+        {
+          hash = hash_bytes (hash, &v -> x, sizeof (Scalar));
+          hash = hash_bytes (hash, &v -> y, sizeof (Scalar));
+          hash = hash_bytes (hash, &v -> z, sizeof (Scalar));
+        }
+        
+        hash = hash_bytes (hash, "|", 1);
+      }
+      
+      hash = hash_bytes (hash, "#", 1);
+    }
+    
+    return hash;
+  }
+  
+  //
+  // select_partition
+  // The plane splitting fewest polygons, the first found on a tie. No plane
+  //  beats none, and a count already past the best can't win, so both stop
+  //  the search early without changing the choice.
+  //
+  static MapPlane* select_partition (MapPlane* maps, PlaneIndex* partition)
+  {
+    MapPlane* best = 0;
+    unsigned best_split = ~((unsigned) 0);
+    
+    for (MapPlane*
+      cur_map  = maps;
+      cur_map != 0 && best_split != 0;
+      cur_map  = cur_map -> next)
+    {
+      // Don't use boundary planes
+      if (cur_map -> boundary)
+        continue;
+      
+      const Plane& plane = plane_get (cur_map -> plane);
+      unsigned split = 0;
+      
+      for (MapPlane*
+        comp_map  = maps;
+        comp_map != 0 && split < best_split;
+        comp_map  = comp_map -> next)
+      {
+        // Don't compare with ourselves
+        if (comp_map == cur_map)
+          continue;
+        
+        PlaneSide comp_side = plane.plane_side (plane_get (comp_map -> plane));
+        
+        if (comp_side == plane_side_across)
+        {
+          for (Polygon**
+            cur_poly  = comp_map -> polys_begin ();
+            cur_poly != comp_map -> polys_end   ();
+            cur_poly++)
+          {
+            PlaneSide poly_side = polygon_side (plane, **cur_poly);
+            
+            if (poly_side == plane_side_across)
+              split++;
+          }
+          // CurPoly
+        }
+      }
+      // CompMap
+      
+      if (split < best_split)
+      {
+        best_split = split;
+        best = cur_map;
+      }
+    }
+    // CurMap
+    
+    if (best)
+      *partition = best -> plane;
+    
+    return best;
+  }
+  // select_partition
+  
+  //
+  // PartitionHint
+  // What select_partition chose for one node input. From a previous
+  //  compile, it may also carry the node itself, when the whole subtree
+  //  below it can be copied; see partition_cache_add_tree.
+  //
+  struct PartitionHint
+  {
+    rku64 hash;
+    bool leaf;
+    PlaneIndex partition;
+    const Node* source;
+    
+  };
+  
+  //
+  // PartitionCache
+  // Open-addressed table from input hash to the partition an earlier
+  //  compile chose for that input. Selection depends only on the input, so
+  //  a match is as good as selecting again.
+  //
+  struct PartitionCache
+  {
+    PartitionHint* slots;
+    rku8* used;
+    unsigned mask;
+    
+    PartitionCache () :
+      slots (0), used (0), mask (0)
+    {}
+    
+    ~PartitionCache ()
+    {
+      delete [] slots;
+      delete [] used;
+    }
+    
+    void init (unsigned count)
+    {
+      // Keep the table at most half full
+      unsigned size = 16;
+      while (size < count * 2)
+        size <<= 1;
+      
+      slots = new PartitionHint [size];
+      used  = new rku8 [size];
+      mask  = size - 1;
+      
+      for (unsigned i = 0; i != size; i++)
+        used [i] = 0;
+    }
+    
+    void insert (const PartitionHint& hint)
+    {
+      unsigned slot = unsigned (hint.hash) & mask;
+      while (used [slot] && slots [slot].hash != hint.hash)
+        slot = (slot + 1) & mask;
+      
+      slots [slot] = hint;
+      used  [slot] = 1;
+    }
+    
+    const PartitionHint* find (rku64 hash) const
+    {
+      if (!slots)
+        return 0;
+      
+      unsigned slot = unsigned (hash) & mask;
+      while (used [slot])
+      {
+        if (slots [slot].hash == hash)
+          return &slots [slot];
+        slot = (slot + 1) & mask;
+      }
+      
+      return 0;
+    }
+    
+  };
+  
+  //
+  // node_hint
+  //
+  static inline PartitionHint node_hint (const Node* node)
+  {
+    PartitionHint hint;
+    hint.hash      = node -> input_hash;
+    hint.leaf      = node -> is_leaf ();
+    hint.partition = node -> partition;
+    hint.source    = 0;
+    return hint;
+  }
+  
+  //
+  // partition_cache_add_tree
+  // With Graft, non-leaves are also given as the source of their subtree
+  //  if every empty leaf below still holds its polygons. fill_outside frees
+  //  those of the leaves it fills, so not every subtree qualifies; a
+  //  streamed world's are all gone, so it shouldn't be grafted from.
+  //
+  static void partition_cache_add_tree (PartitionCache* cache, const Node* root, unsigned depth, bool graft)
+  {
+    // Pre-order, so each node's front subtree follows it, then its back
+    ArenaSpan <const Node*> order;
+    ArenaSpan <rku8> whole; // Of leaves, then of subtrees below
+    
+    const Node** stack = new const Node* [depth + 1];
+    NodeContents* potential = new NodeContents [depth + 1];
+    unsigned top = 0;
+    
+    stack [top] = root;
+    potential [top++] = contents_empty;
+    
+    while (top != 0)
+    {
+      top--;
+      const Node* node = stack [top];
+      NodeContents contents = potential [top];
+      
+      order.push (node);
+      whole.push (contents != contents_empty || node -> contents != contents_outside);
+      
+      if (!node -> is_leaf ())
+      {
+        stack [top] = node -> back;
+        potential [top++] = contents_solid;
+        stack [top] = node -> front;
+        potential [top++] = contents_empty;
+      }
+    }
+    
+    delete [] potential;
+    delete [] stack;
+    
+    // Backwards, children come before their parents
+    unsigned count = order.size ();
+    unsigned* size = new unsigned [count];
+    
+    for (unsigned i = count; i-- != 0;)
+    {
+      const Node* node = order.begin () [i];
+      size [i] = 1;
+      
+      if (node -> is_leaf ())
+        continue;
+      
+      unsigned front = i + 1;
+      unsigned back  = front + size [front];
+      size [i] += size [front] + size [back];
+      whole.begin () [i] = whole.begin () [front] && whole.begin () [back];
+    }
+    
+    for (unsigned i = 0; i != count; i++)
+    {
+      const Node* node = order.begin () [i];
+      
+      PartitionHint hint = node_hint (node);
+      if (graft && !node -> is_leaf () && whole.begin () [i])
+        hint.source = node;
+      
+      cache -> insert (hint);
+    }
+    
+    delete [] size;
+  }
+  
+  //
+  // reuse_partition
+  // Finds the map holding the partition Hint chose before for exactly this
+  //  input. Sets *reused when that earlier choice applies.
+  //
+  static MapPlane* reuse_partition (Node* node, const PartitionHint* hint, bool* reused)
+  {
+    *reused = false;
+    
+    if (!hint)
+      return 0;
+    
+    if (hint -> leaf)
+    {
+      *reused = true;
+      return 0;
+    }
+    
+    for (MapPlane*
+      m  = node -> maps;
+      m != 0;
+      m  = m -> next)
+    {
+      if (m -> plane == hint -> partition)
+      {
+        node -> partition = m -> plane;
+        *reused = true;
+        return m;
+      }
+    }
+    
+    return 0;
+  }
+  
+  //
+  // world_write_header
+  // The file is the header, leaf triangle blocks, the node table in
+  //  pre-order, front before back, the plane table, then the cluster table:
+  //
+  //   "RKINDOOR"  u32 format  u32 depth  u32 nodes_offset  u32 planes_offset
+  //   u32 clusters_offset
+  //
+  //  Nonleaf nodes are their contents byte then a u32 plane: the index into
+  //  the plane table shifted up one, with the low bit set if the node uses
+  //  the plane flipped. Empty leaves are the contents byte, then u8
+  //  encoding, u32 triangle count, u32 file offset of their triangles and
+  //  u32 cluster. Other leaves are just the contents byte. The plane table
+  //  is a u32 count, then that many f32 plane [4]. The cluster table is a
+  //  u32 count, then for each cluster the u32 triangle count of its leaves
+  //  together and the f32 mins [3] and maxs [3] bounding them, so a loader
+  //  can tell which clusters are near without their triangles. Leaf blocks
+  //  come a cluster at a time, unless the leaves were streamed, in which
+  //  case they come in the order they were finished.
+  //
+  //  A leaf_floats block is f32 vertex [3][3] per triangle. A
+  //  leaf_quantized block is f32 origin [3] and f32 step [3], then u16
+  //  vertex [3][3] per triangle; each coordinate is origin + value * step.
+  //
+# define indoor_format_version 6
+  
+# define leaf_floats    0
+# define leaf_quantized 1
+  
+  static void world_write_header (FILE* file, rku32 depth, rku32 nodes_offset, rku32 planes_offset, rku32 clusters_offset)
+  {
+    rku32 format = indoor_format_version;
+    
+    fseek (file, 0, SEEK_SET);
+    fwrite ("RKINDOOR", 1, 8, file);
+    fwrite (&format,          4, 1, file);
+    fwrite (&depth,           4, 1, file);
+    fwrite (&nodes_offset,    4, 1, file);
+    fwrite (&planes_offset,   4, 1, file);
+    fwrite (&clusters_offset, 4, 1, file);
+  }
+  
+  //
+  // quantize_value
+  //
+  static inline rku16 quantize_value (double value, rkf32 origin, rkf32 step)
+  {
+    if (step <= 0.0f)
+      return 0;
+    
+    double q = (value - origin) / step + 0.5;
+    if (q <= 0.0)
+      return 0;
+    else if (q >= 65535.0)
+      return 65535;
+    else
+      return rku16 (q);
+  }
+  
+  //
+  // quantize_leaf
+  // Fits Node's vertices to a 16-bit grid across its bounds, as f32 origin
+  //  and step. Returns false if any vertex would be loaded back further than
+  //  Max_error from where it is, counting the loader's float arithmetic, or
+  //  if the leaf is too small for the origin and step to pay for themselves.
+  //
+  static bool quantize_leaf (const Node* node, double max_error, rkf32* origin, rkf32* step)
+  {
+    Vector3 mins ( 1E16,  1E16,  1E16);
+    Vector3 maxs (-1E16, -1E16, -1E16);
+    unsigned triangles = 0;
+    
+    for (const MapPlane* m = node -> maps; m != 0; m = m -> next)
+    {
+      for (const Polygon* const* p = m -> polys_begin (); p != m -> polys_end (); p++)
+      {
+        if (!*p || (*p) -> size () < 3)
+          continue;
+        
+        triangles += (*p) -> size () - 2;
+        
+        for (const Vector3* v = (*p) -> begin (); v != (*p) -> end (); v++)
+        {
+          if (v -> x < mins.x) mins.x = v -> x;
+          if (v -> y < mins.y) mins.y = v -> y;
+          if (v -> z < mins.z) mins.z = v -> z;
+          if (v -> x > maxs.x) maxs.x = v -> x;
+          if (v -> y > maxs.y) maxs.y = v -> y;
+          if (v -> z > maxs.z) maxs.z = v -> z;
+        }
+      }
+    }
+    
+    if (24 + triangles * 18 >= triangles * 36)
+      return false;
+    
+    for (unsigned axis = 0; axis != 3; axis++)
+    {
+      origin [axis] = rkf32 ((&mins.x) [axis]);
+      step   [axis] = rkf32 (((&maxs.x) [axis] - (&mins.x) [axis]) / 65535.0);
+    }
+    
+    for (const MapPlane* m = node -> maps; m != 0; m = m -> next)
+    {
+      for (const Polygon* const* p = m -> polys_begin (); p != m -> polys_end (); p++)
+      {
+        if (!*p || (*p) -> size () < 3)
+          continue;
+        
+        for (const Vector3* v = (*p) -> begin (); v != (*p) -> end (); v++)
+        {
+          for (unsigned axis = 0; axis != 3; axis++)
+          {
+            double value = (&v -> x) [axis];
+            rku16 q = quantize_value (value, origin [axis], step [axis]);
+            double error = double (origin [axis] + rkf32 (q) * step [axis]) - value;
+            
+            if (error > max_error || error < -max_error)
+              return false;
+          }
+        }
+      }
+    }
+    
+    return true;
+  }
+  
+  //
+  // node_free_maps
+  //
+  static void node_free_maps (Node* node)
+  {
+    MapPlane* map = node -> maps;
+    while (map)
+    {
+      MapPlane* next = map -> next;
+      delete map;
+      map = next;
+    }
+    
+    node -> maps = 0;
+  }
+  
+  //
+  // leaf_clear_polys
+  //
+  static void leaf_clear_polys (Node* node)
+  {
+    for (MapPlane*
+      m  = node -> maps;
+      m != 0;
+      m  = m -> next)
+    {
+      m -> clear_polys ();
+    }
+  }
+  
+  //
+  // world_write_leaf
+  // Appends the leaf's polygons to File as triangles. The node table
+  //  written later points back at them. Vertices are quantized if
+  //  Max_error allows; 0 keeps them floats.
+  //
+  static void world_write_leaf (Node* node, FILE* file, double max_error)
+  {
+    fseek (file, 0, SEEK_END);
+    node -> tri_offset = ftell (file);
+    node -> tri_count  = 0;
+    node -> tri_encoding = leaf_floats;
+    
+    rkf32 origin [3], step [3];
+    if (max_error > 0.0 && quantize_leaf (node, max_error, origin, step))
+    {
+      node -> tri_encoding = leaf_quantized;
+      fwrite (origin, 4, 3, file);
+      fwrite (step,   4, 3, file);
+    }
+    
+    for (MapPlane*
+      m  = node -> maps;
+      m != 0;
+      m  = m -> next)
+    {
+      for (Polygon**
+        p  = m -> polys_begin ();
+        p != m -> polys_end   ();
+        p++)
+      {
+        if (!*p)
+          continue;
+        
+        unsigned size = (*p) -> size ();
+        if (size < 3)
+          continue;
+        
+        const Vector3* pv = (*p) -> begin ();
+        
+        for (unsigned i = 0; i < size - 2; i++)
+        {
+          const Vector3* tri [3] = { pv, pv + i + 1, pv + i + 2 };
+          
+          if (node -> tri_encoding == leaf_quantized)
+          {
+            rku16 coords [9];
+            for (unsigned c = 0; c != 9; c++)
+              coords [c] = quantize_value ((&tri [c / 3] -> x) [c % 3], origin [c % 3], step [c % 3]);
+            fwrite (coords, 18, 1, file);
+          }
+          else
+          {
+            Rk::Vector3f verts [3];
+            for (unsigned c = 0; c != 3; c++)
+              verts [c] = *tri [c];
+            fwrite (verts, 36, 1, file);
+          }
+          
+          for (unsigned c = 0; c != 9; c++)
+          {
+            rkf32 value = rkf32 ((&tri [c / 3] -> x) [c % 3]);
+            rkf32& low  = node -> tri_mins [c % 3];
+            rkf32& high = node -> tri_maxs [c % 3];
+            
+            if (node -> tri_count == 0 && c < 3)
+              low = high = value;
+            else if (value < low)
+              low = value;
+            else if (value > high)
+              high = value;
+          }
+          
+          node -> tri_count++;
+        }
+      }
+    }
+  }
+  
+  //
+  // Partitioner
+  //
+  struct Partitioner
+  {
+    const PartitionCache* cache;
+    unsigned leaf_count;
+    unsigned reused, selected;
+    unsigned grafted; // Of those reused, copied whole from a previous compile
+    unsigned plane_misses;
+    FILE* stream; // Finished empty leaves go here at once, if set
+    double quantize_error;
+    void (*status) (const char*);
+    
+  };
+  
+  //
+  // count_plane_misses
+  // Vertices of a leaf's polygons that rounding in the cuts has pushed off
+  //  their own plane. Measured against a double build's plane_epsilon
+  //  whatever the precision, so indoor --bench compares like with like.
+  //
+# define plane_miss_tolerance 0.00001
+  
+  static unsigned count_plane_misses (const Node* node)
+  {
+    unsigned misses = 0;
+    
+    for (const MapPlane*
+      m  = node -> maps;
+      m != 0;
+      m  = m -> next)
+    {
+      const Plane& plane = plane_get (m -> plane);
+      
+      for (const Polygon* const*
+        p  = m -> polys_begin ();
+        p != m -> polys_end   ();
+        p++)
+      {
+        if (!*p)
+          continue;
+        
+        for (const Vector3*
+          v  = (*p) -> begin ();
+          v != (*p) -> end   ();
+          v++)
+        {
+          double distance =
+            double (plane.normal.x) * v -> x +
+            double (plane.normal.y) * v -> y +
+            double (plane.normal.z) * v -> z - plane.distance;
+          
+          if (distance > plane_miss_tolerance || distance < -plane_miss_tolerance)
+            misses++;
+        }
+      }
+    }
+    
+    return misses;
+  }
+  
+  //
+  // finish_leaf
+  //
+  static void finish_leaf (Node* node, NodeContents potential_contents, Partitioner* part)
+  {
+    node -> contents = potential_contents;
+    node -> leaf_index = part -> leaf_count++;
+    
+    if (node -> contents != contents_empty)
+      leaf_clear_polys (node);
+    
+    if (node -> contents == contents_empty)
+      part -> plane_misses += count_plane_misses (node);
+    
+    // Nothing else touches a finished leaf's polygons
+    if (part -> stream && node -> contents == contents_empty)
+    {
+      world_write_leaf (node, part -> stream, part -> quantize_error);
+      leaf_clear_polys (node);
+    }
+  }
+  
+  //
+  // graft_node
+  // Makes Node a copy of Source, a node of a previous compile given the
+  //  same input, without its children yet; partition_run_step copies those
+  //  in turn. A leaf takes Source's polygons, less the detail clip_detail
+  //  added. Returns true for a non-leaf.
+  //
+  static bool graft_node (Node* node, const Node* source, NodeContents potential_contents, Partitioner* part)
+  {
+    node -> input_hash = source -> input_hash;
+    part -> reused++;
+    part -> grafted++;
+    
+    if (!source -> is_leaf ())
+    {
+      node -> contents  = contents_nonleaf;
+      node -> partition = source -> partition;
+      node -> front = new Node;
+      node -> back  = new Node;
+      return true;
+    }
+    
+    // Kept in order, so the leaf is written just as partitioning made it
+    if (potential_contents == contents_empty)
+    {
+      MapPlane* last = 0;
+      
+      for (const MapPlane*
+        m  = source -> maps;
+        m != 0;
+        m  = m -> next)
+      {
+        MapPlane* copy = 0;
+        
+        for (const Polygon* const*
+          p  = m -> polys_begin ();
+          p != m -> polys_end   () - m -> detail_count;
+          p++)
+        {
+          if (!*p)
+            continue;
+          
+          if (!copy)
+          {
+            copy = new MapPlane;
+            copy -> plane = m -> plane;
+            copy -> boundary = m -> boundary;
+            copy -> prev = last;
+            
+            if (last)
+              last -> next = copy;
+            else
+              node -> maps = copy;
+            last = copy;
+          }
+          
+          Polygon* poly = polygon_alloc ();
+          *poly = **p;
+          copy -> add_poly (poly);
+        }
+      }
+    }
+    
+    finish_leaf (node, potential_contents, part);
+    return false;
+  }
+  
+  //
+  // partition_node
+  // Splits one node's geometry into new children, or finishes it as a leaf.
+  //  Returns true if the node was split. Given Graft, an input a previous
+  //  compile saw whole is grafted instead, and *Graft set to the node it
+  //  comes from; see graft_node.
+  //
+  static bool partition_node (Node* node, NodeContents potential_contents, Partitioner* part, const Node** graft)
+  {
+    void (*status) (const char*) = part -> status;
+    
+    // Select partition, unless an earlier compile already chose one for
+    //  this exact input
+    node -> input_hash = hash_node_input (node);
+    const PartitionHint* hint = part -> cache -> find (node -> input_hash);
+    
+    // The same input partitions the same way all the way down
+    if (graft && hint && hint -> source)
+    {
+      *graft = hint -> source;
+      node_free_maps (node);
+      return graft_node (node, hint -> source, potential_contents, part);
+    }
+    
+    bool reused;
+    MapPlane* partition_map = reuse_partition (node, hint, &reused);
+    
+    if (reused)
+    {
+      part -> reused++;
+    }
+    else
+    {
+      partition_map = select_partition (node -> maps, &node -> partition);
+      part -> selected++;
+    }
+    
+    // If we can't find a partition, then we must be a leaf, so we're done.
+    if (!partition_map)
+    {
+      status ("Leaf");
+      finish_leaf (node, potential_contents, part);
+      return false;
+    }
+    
+    // Not a leaf
+    node -> contents = contents_nonleaf;
+    node -> front = new Node;
+    node -> back  = new Node;
+    
+    const Plane& partition = plane_get (node -> partition);
+    
+    // Scratch for splitting maps' polygons, shared by every map here
+    ArenaSpan <signed char> classes;
+    Polygon fore;
+    
+    // Sort geometry into children
+    for (MapPlane*
+      cur_map  = node -> maps;
+      cur_map != 0;)
+    {
+      PlaneSide side;
+      
+      MapPlane* p_front = 0;
+      MapPlane* p_back  = 0;
+      
+#     define CHECKFRONT                                      \
+        if (!p_front) {                                      \
+          p_front = new MapPlane;                            \
+          p_front -> plane = cur_map -> plane;               \
+          p_front -> boundary = cur_map -> boundary;         \
+          mapplane_insert (&node -> front -> maps, p_front); \
+        };
+      
+#     define CHECKBACK                                      \
+        if (!p_back) {                                      \
+          p_back = new MapPlane;                            \
+          p_back -> plane = cur_map -> plane;               \
+          p_back -> boundary = cur_map -> boundary;         \
+          mapplane_insert (&node -> back -> maps, p_back);  \
+        };
+      
+      if (plane_same (cur_map -> plane, node -> partition))
+        side = plane_side_in;
+      else
+        side = partition.plane_side (plane_get (cur_map -> plane));
+      
+      // Parallel planes are easy
+      if (side == plane_side_front)
+      {
+        status ("Front");
+        
+        // Move the map
+        p_front = cur_map;
+        cur_map = mapplane_remove (&node -> maps, cur_map);
+        mapplane_insert (&node -> front -> maps, p_front);
+        
+        // Don't mis-iterate - old *cur_map is in *front now, new *cur_map is the next one already
+        continue;
+      }
+      else if (side == plane_side_back)
+      {
+        status ("Back");
+        
+        // Move the map
+        p_back = cur_map;
+        cur_map = mapplane_remove (&node -> maps, cur_map);
+        mapplane_insert (&node -> back -> maps, p_back);
+        
+        // Don't mis-iterate - old *cur_map is in *back now, new *cur_map is the next one already
+        continue;
+      }
+      else if (side == plane_side_in)
+      {
+        status ("In");
+        
+        // Faces on the partition go to the side they face, where they are
+        //  boundaries
+        for (Polygon**
+          cur_poly  = cur_map -> polys_begin ();
+          cur_poly != cur_map -> polys_end   ();
+          cur_poly++)
+        {
+          if (!*cur_poly)
+            continue;
+          
+          const double dist = dot (
+            (*cur_poly) -> normal (),
+            partition.normal
+          );
+          
+          if (dist > 0)
+          {
+            CHECKFRONT
+            p_front -> boundary = plane_side_front;
+            p_front -> add_poly (*cur_poly);
+          }
+          else
+          {
+            CHECKBACK
+            p_back -> boundary = plane_side_back;
+            p_back -> add_poly (*cur_poly);
+          }
+          
+          *cur_poly = 0;
+        }
+      }
+      else if (side == plane_side_across)
+      {
+        status ("Across");
+        
+        // *cur_map is not parallel to Partition
+        
+        // We need to sort every
+        //  polygon in *cur_map into the correct child, splitting when necessary.
+        //  The whole map is classified in one pass first; a split polygon
+        //  keeps its front half in place, so only the back half is allocated.
+        classes.clear ();
+        classify_polys (cur_map -> polys_begin (), cur_map -> polys_end (), partition, &classes);
+        const signed char* poly_classes = classes.begin ();
+        
+        for (Polygon**
+          cur_poly  = cur_map -> polys_begin ();
+          cur_poly != cur_map -> polys_end   ();
+          cur_poly++)
+        {
+          if (!*cur_poly)
+            continue;
+          
+          const signed char* vertex_classes = poly_classes;
+          poly_classes += (*cur_poly) -> size ();
+          
+          const PlaneSide poly_side = classes_side (vertex_classes, (*cur_poly) -> size ());
+          
+          if (poly_side == plane_side_front)
+          {
+            // Add this plane into the front if we haven't already
+            CHECKFRONT
+            p_front -> add_poly (*cur_poly);
+            *cur_poly = 0; // **cur_poly is in *front, don't free it next map
+          }
+          else if (poly_side == plane_side_back)
+          {
+            // Add this plane into the back if we haven't already
+            CHECKBACK
+            p_back -> add_poly (*cur_poly);
+            *cur_poly = 0; // **cur_poly is in *back, don't free it next map
+          }
+          else if (poly_side == plane_side_across)
+          {
+            Polygon* front_half = *cur_poly;
+            Polygon* back_half  = polygon_alloc ();
+            
+            split_classified (front_half, vertex_classes, &partition, &fore, back_half);
+            *front_half = fore;
+            *cur_poly = 0;
+            
+            // Extra empty checks, just in case.
+            
+            if (!front_half -> empty ())
+            {
+              CHECKFRONT
+              p_front -> add_poly (front_half);
+            }
+            else
+            {
+              polygon_free (front_half);
+            }
+            
+            if (!back_half -> empty ())
+            {
+              CHECKBACK
+              p_back -> add_poly (back_half);
+            }
+            else
+            {
+              polygon_free (back_half);
+            }
+          }
+          // if (PolySide == ...)
+        }
+        // for (Polys)
+        
+      }
+      else // if (Side == PlaneType::In)
+      {
+        debug_trap (false); //  ("(X) Coplanar plane detected");
+      }
+      // if (Side == ...)
+      
+      cur_map = mapplane_free (&node -> maps, cur_map);
+    }
+    // for (Maps)
+    
+    return true;
+  }
+  // partition_node
+  
+  //
+  // PartitionTask
+  //
+  struct PartitionTask
+  {
+    Node* node;
+    NodeContents potential_contents;
+    unsigned depth;
+    const Node* graft; // Copied from, below a node grafted whole
+    
+  };
+  
+  //
+  // PartitionRun
+  // Partitions depth-first with an explicit stack, front before back, in the
+  //  same order the recursive version did. Kept between calls so a compile
+  //  can stop after any node and carry on later. Tasks Split_depth deep are
+  //  held back for workers instead; see compile_export_jobs.
+  //
+  struct PartitionRun
+  {
+    ArenaSpan <PartitionTask> stack;
+    unsigned depth; // Of the deepest node made so far
+    unsigned split_depth;
+    ArenaSpan <PartitionTask> held; // In pre-order
+    
+  };
+  
+  //
+  // partition_run_begin
+  //
+  static void partition_run_begin (PartitionRun* run, Node* root)
+  {
+    // Each level consumes a partition plane, so the plane count is a good
+    //  first guess at the depth.
+    unsigned plane_count = 0;
+    for (MapPlane* m = root -> maps; m != 0; m = m -> next)
+      plane_count++;
+    
+    run -> stack.reserve (plane_count + 1);
+    
+    PartitionTask root_task = { root, contents_empty, 0, 0 };
+    run -> stack.push (root_task);
+    run -> depth = 0;
+    run -> split_depth = ~0u;
+  }
+  
+  //
+  // partition_run_step
+  // Partitions nodes until the tree is done, returning true, or until the
+  //  deadline passes.
+  //
+  static bool partition_run_step (PartitionRun* run, Partitioner* part, double deadline)
+  {
+    unsigned done = 0;
+    
+    while (!run -> stack.empty ())
+    {
+      if (done++ && past_deadline (deadline))
+        return false;
+      
+      PartitionTask task = run -> stack.pop ();
+      
+      if (task.depth == run -> split_depth && !task.graft)
+      {
+        run -> held.push (task);
+        continue;
+      }
+      
+      const Node* graft = task.graft;
+      bool split = graft
+        ? graft_node (task.node, graft, task.potential_contents, part)
+        : partition_node (task.node, task.potential_contents, part, &graft);
+      
+      if (!split)
+        continue;
+      
+      if (task.depth + 1 > run -> depth)
+        run -> depth = task.depth + 1;
+      
+      PartitionTask back_task  = { task.node -> back,  contents_solid, task.depth + 1, graft ? graft -> back  : 0 };
+      PartitionTask front_task = { task.node -> front, contents_empty, task.depth + 1, graft ? graft -> front : 0 };
+      run -> stack.push (back_task);
+      run -> stack.push (front_task);
+    }
+    
+    return true;
+  }
+  
+  //
+  // PortalNode
+  // The finished tree, flattened for the portal threads. They can't read the
+  //  plane table, which belongs to this thread; see Planes.hpp.
+  //
+  struct PortalNode
+  {
+    Plane partition;
+    int parent;         // -1 for the root
+    bool in_front;      // Of the parent
+    int front, back;    // -1 for leaves
+    Node* node;
+    
+  };
+  
+  //
+  // PortalWindow
+  // A plane to cut portals from: a node's partition, or a face of the hull,
+  //  facing in. Hull windows have no node.
+  //
+  struct PortalWindow
+  {
+    Plane plane;
+    PlaneIndex index;
+    int node;
+    
+  };
+  
+  //
+  // PortalPiece
+  // What is left of a window between two leaves, A in front of it. The
+  //  vertices follow the previous piece's in the output.
+  //
+  struct PortalPiece
+  {
+    unsigned window;
+    Node *a, *b;
+    unsigned vertex_count;
+    
+  };
+  
+  //
+  // PortalOutput
+  // One thread's pieces, in window order. Plain heap storage, as the arena
+  //  of a thread that made them is gone by the time they are linked.
+  //
+  struct PortalOutput
+  {
+    PortalPiece* pieces;
+    unsigned piece_count, piece_capacity;
+    Vector3* vertices;
+    unsigned vertex_count, vertex_capacity;
+    
+  };
+  
+  //
+  // portal_output_add
+  //
+  static void portal_output_add (PortalOutput* output, unsigned window, Node* a, Node* b, const Polygon& poly)
+  {
+    if (output -> piece_count == output -> piece_capacity)
+    {
+      unsigned new_capacity = output -> piece_capacity ? output -> piece_capacity * 2 : 64;
+      PortalPiece* new_pieces = new PortalPiece [new_capacity];
+      
+      for (unsigned i = 0; i != output -> piece_count; i++)
+        new_pieces [i] = output -> pieces [i];
+      
+      delete [] output -> pieces;
+      output -> pieces = new_pieces;
+      output -> piece_capacity = new_capacity;
+    }
+    
+    while (output -> vertex_count + poly.size () > output -> vertex_capacity)
+    {
+      unsigned new_capacity = output -> vertex_capacity ? output -> vertex_capacity * 2 : 256;
+      Vector3* new_vertices = new Vector3 [new_capacity];
+      
+      for (unsigned i = 0; i != output -> vertex_count; i++)
+        new_vertices [i] = output -> vertices [i];
+      
+      delete [] output -> vertices;
+      output -> vertices = new_vertices;
+      output -> vertex_capacity = new_capacity;
+    }
+    
+    PortalPiece* piece = output -> pieces + output -> piece_count++;
+    piece -> window = window;
+    piece -> a = a;
+    piece -> b = b;
+    piece -> vertex_count = poly.size ();
+    
+    for (const Vector3* v = poly.begin (); v != poly.end (); v++)
+      output -> vertices [output -> vertex_count++] = *v;
+  }
+  
+  //
+  // PortalJob
+  // Thread T of N takes windows T, T + N, T + 2N... of a batch. No window
+  //  depends on another, so nothing is shared but the read-only tree.
+  //
+  struct PortalJob
+  {
+    const PortalNode* nodes;
+    const PortalWindow* windows;
+    const Plane* hull;
+    unsigned hull_count;
+    Node* outside;
+    
+    unsigned first, last, stride; // Of the batch in hand
+    bool spawned; // Owns its pools, and must clean them up
+    PortalOutput output;
+    
+  };
+  
+  //
+  // clip_window
+  // Keeps what of Poly lies in front of Plane. Returns false if nothing does.
+  //
+  static bool clip_window (Polygon* poly, const Plane& plane, Polygon* fore, Polygon* rear)
+  {
+    PlaneSide side = polygon_side (plane, *poly);
+    
+    if (side == plane_side_back)
+      return false;
+    else if (side != plane_side_across)
+      return true;
+    
+    split_poly (poly, &plane, fore, rear);
+    *poly = *fore;
+    return poly -> size () >= 3;
+  }
+  
+  //
+  // PortalTask
+  //
+  struct PortalTask
+  {
+    int node;
+    Polygon* poly;
+    
+  };
+  
+  //
+  // push_window
+  // Carries Poly down from Node, splitting it across partitions, and adds
+  //  each piece that reaches a leaf to Leaves. Pieces on a partition go to
+  //  the front, as polygon_side has it. Poly now belongs to the pieces.
+  //
+  static void push_window (const PortalNode* nodes, int node, Polygon* poly, ArenaSpan <PortalTask>* stack, ArenaSpan <PortalTask>* leaves)
+  {
+    PortalTask task = { node, poly };
+    stack -> push (task);
+    
+    while (!stack -> empty ())
+    {
+      task = stack -> pop ();
+      const PortalNode& cur = nodes [task.node];
+      
+      if (cur.front < 0)
+      {
+        leaves -> push (task);
+        continue;
+      }
+      
+      PlaneSide side = polygon_side (cur.partition, *task.poly);
+      
+      if (side != plane_side_across)
+      {
+        PortalTask next = { side == plane_side_back ? cur.back : cur.front, task.poly };
+        stack -> push (next);
+        continue;
+      }
+      
+      Polygon* fore = polygon_alloc ();
+      Polygon* rear = polygon_alloc ();
+      split_poly (task.poly, &cur.partition, fore, rear);
+      polygon_free (task.poly);
+      
+      if (rear -> size () >= 3)
+      {
+        PortalTask back_task = { cur.back, rear };
+        stack -> push (back_task);
+      }
+      else
+      {
+        polygon_free (rear);
+      }
+      
+      if (fore -> size () >= 3)
+      {
+        PortalTask front_task = { cur.front, fore };
+        stack -> push (front_task);
+      }
+      else
+      {
+        polygon_free (fore);
+      }
+    }
+  }
+  
+  //
+  // portal_window
+  // Cuts Window down to the region of space it divides - inside the hull,
+  //  and on the near side of every ancestor's partition - then pushes it to
+  //  the leaves on either side.
+  //
+  static void portal_window (PortalJob* job, unsigned window)
+  {
+    const PortalWindow& w = job -> windows [window];
+    const PortalNode* nodes = job -> nodes;
+    
+    Polygon* poly = polygon_alloc ();
+    make_plane_poly (&w.plane, poly);
+    
+    Polygon fore, rear;
+    bool open = true;
+    
+    for (unsigned h = 0; h != job -> hull_count && open; h++)
+    {
+      if (w.node < 0 && h == window)
+        continue;
+      
+      open = clip_window (poly, job -> hull [h], &fore, &rear);
+    }
+    
+    for (int n = w.node; n >= 0 && nodes [n].parent >= 0 && open; n = nodes [n].parent)
+    {
+      const Plane& partition = nodes [nodes [n].parent].partition;
+      
+      if (nodes [n].in_front)
+        open = clip_window (poly, partition, &fore, &rear);
+      else
+        open = clip_window (poly, Plane (-partition.normal, -partition.distance), &fore, &rear);
+    }
+    
+    if (!open)
+    {
+      polygon_free (poly);
+      return;
+    }
+    
+    ArenaSpan <PortalTask> stack;
+    ArenaSpan <PortalTask> fronts;
+    ArenaSpan <PortalTask> backs;
+    
+    // The hull's only neighbour is the outside
+    if (w.node < 0)
+    {
+      push_window (nodes, 0, poly, &stack, &fronts);
+      
+      for (PortalTask* f = fronts.begin (); f != fronts.end (); f++)
+      {
+        const PortalNode& leaf = nodes [f -> node];
+        if (leaf.node -> contents != contents_solid)
+          portal_output_add (&job -> output, window, leaf.node, job -> outside, *f -> poly);
+        polygon_free (f -> poly);
+      }
+      
+      return;
+    }
+    
+    push_window (nodes, nodes [w.node].front, poly, &stack, &fronts);
+    
+    for (PortalTask* f = fronts.begin (); f != fronts.end (); f++)
+    {
+      const PortalNode& front_leaf = nodes [f -> node];
+      
+      if (front_leaf.node -> contents == contents_solid)
+      {
+        polygon_free (f -> poly);
+        continue;
+      }
+      
+      backs.clear ();
+      push_window (nodes, nodes [w.node].back, f -> poly, &stack, &backs);
+      
+      for (PortalTask* b = backs.begin (); b != backs.end (); b++)
+      {
+        const PortalNode& back_leaf = nodes [b -> node];
+        if (back_leaf.node -> contents != contents_solid)
+          portal_output_add (&job -> output, window, front_leaf.node, back_leaf.node, *b -> poly);
+        polygon_free (b -> poly);
+      }
+    }
+  }
+  
+  //
+  // portal_thread
+  //
+  static void portal_thread (void* param)
+  {
+    PortalJob* job = (PortalJob*) param;
+    
+    for (unsigned w = job -> first; w < job -> last; w += job -> stride)
+      portal_window (job, w);
+    
+    if (job -> spawned)
+    {
+      polygon_cleanup ();
+      arena_cleanup ();
+    }
+  }
+  
+  //
+  // file_portal
+  // Files Portal under the leaf's map for its surface, making one if need be.
+  //
+  static void file_portal (Node* leaf, Portal* portal)
+  {
+    for (MapPlane*
+      m  = leaf -> maps;
+      m != 0;
+      m  = m -> next)
+    {
+      if (plane_same (portal -> plane, m -> plane))
+      {
+        m -> add_portal (portal);
+        return;
+      }
+    }
+    
+    MapPlane* map = new MapPlane;
+    map -> plane = portal -> plane;
+    map -> add_portal (portal);
+    mapplane_insert (&leaf -> maps, map);
+  }
+  
+  //
+  // FlattenTask
+  //
+  struct FlattenTask
+  {
+    Node* node;
+    int parent;
+    bool in_front;
+    
+  };
+  
+  //
+  // PortalRun
+  // build_portals between steps. Windows are cut in batches, each linked
+  //  before the next is started.
+  //
+  struct PortalRun
+  {
+    PortalNode* nodes;
+    PortalWindow* windows;
+    Plane* planes;
+    unsigned window_count;
+    unsigned next_window; // First of the next batch
+    PortalJob* jobs;
+    unsigned threads;
+    
+  };
+  
+  //
+  // portal_run_begin
+  // Portalizes the finished tree, as qbsp does: every partition, cut to its
+  //  node's region, is pushed down both sides to find the leaves it joins,
+  //  and every hull face down to the leaves it closes off from the outside.
+  //  Windows are shared out to Threads threads, and linked afterwards in
+  //  window order, so the result doesn't depend on the thread count.
+  //
+  static void portal_run_begin (PortalRun* run, Node* root, Node* outside, const PlaneIndex* hull, unsigned hull_count,
+    unsigned leaf_count, unsigned threads)
+  {
+    // Leaves, the outside aside, number one more than nonleaves
+    unsigned node_count = (leaf_count - 1) * 2 - 1;
+    unsigned window_count = hull_count + leaf_count - 2;
+    
+    PortalNode*   nodes   = new PortalNode   [node_count];
+    PortalWindow* windows = new PortalWindow [window_count];
+    Plane*        planes  = new Plane        [hull_count + 1];
+    
+    for (unsigned h = 0; h != hull_count; h++)
+    {
+      planes [h] = plane_get (hull [h]);
+      windows [h].plane = planes [h];
+      windows [h].index = hull [h];
+      windows [h].node  = -1;
+    }
+    
+    // Flatten in pre-order
+    ArenaSpan <FlattenTask> stack;
+    FlattenTask root_task = { root, -1, true };
+    stack.push (root_task);
+    
+    unsigned flat_count = 0;
+    unsigned flat_windows = hull_count;
+    
+    while (!stack.empty ())
+    {
+      FlattenTask task = stack.pop ();
+      int index = flat_count++;
+      
+      PortalNode& flat = nodes [index];
+      flat.parent   = task.parent;
+      flat.in_front = task.in_front;
+      flat.node     = task.node;
+      flat.front    = -1;
+      flat.back     = -1;
+      
+      if (task.parent >= 0)
+      {
+        if (task.in_front) nodes [task.parent].front = index;
+        else               nodes [task.parent].back  = index;
+      }
+      
+      if (task.node -> is_leaf ())
+        continue;
+      
+      flat.partition = plane_get (task.node -> partition);
+      windows [flat_windows].plane = flat.partition;
+      windows [flat_windows].index = task.node -> partition;
+      windows [flat_windows].node  = index;
+      flat_windows++;
+      
+      FlattenTask back_task  = { task.node -> back,  index, false };
+      FlattenTask front_task = { task.node -> front, index, true  };
+      stack.push (back_task);
+      stack.push (front_task);
+    }
+    
+    debug_trap (flat_count == node_count && flat_windows == window_count);
+    
+    if (threads == 0)
+      threads = thread_processors ();
+    if (threads > window_count)
+      threads = window_count;
+    if (threads == 0)
+      threads = 1;
+    
+    PortalJob* jobs = new PortalJob [threads];
+    
+    for (unsigned t = 0; t != threads; t++)
+    {
+      PortalJob& job = jobs [t];
+      job.nodes      = nodes;
+      job.windows    = windows;
+      job.hull       = planes;
+      job.hull_count = hull_count;
+      job.outside    = outside;
+      job.stride     = threads;
+      
+      PortalOutput empty = { 0, 0, 0, 0, 0, 0 };
+      job.output = empty;
+    }
+    
+    run -> nodes        = nodes;
+    run -> windows      = windows;
+    run -> planes       = planes;
+    run -> window_count = window_count;
+    run -> next_window  = 0;
+    run -> jobs         = jobs;
+    run -> threads      = threads;
+  }
+  
+  //
+  // portal_run_batch
+  // Cuts windows First to Last, and files the portals made. First must be
+  //  a multiple of the thread count, so each window goes to the same job
+  //  as in one batch of them all. Unless Spawn, every job runs on this
+  //  thread.
+  //
+  static void portal_run_batch (PortalRun* run, unsigned first, unsigned last, bool spawn)
+  {
+    unsigned threads = run -> threads;
+    PortalJob* jobs = run -> jobs;
+    
+    for (unsigned t = 0; t != threads; t++)
+    {
+      jobs [t].first   = first + t;
+      jobs [t].last    = last;
+      jobs [t].spawned = t != 0;
+      jobs [t].output.piece_count  = 0;
+      jobs [t].output.vertex_count = 0;
+    }
+    
+    // This thread takes the first share, and any a thread couldn't be
+    //  started for
+    Thread** handles = new Thread* [threads];
+    for (unsigned t = 1; t != threads; t++)
+      handles [t] = spawn ? thread_start (portal_thread, jobs + t) : 0;
+    
+    portal_thread (jobs);
+    
+    for (unsigned t = 1; t != threads; t++)
+    {
+      if (handles [t])
+      {
+        thread_join (handles [t]);
+      }
+      else
+      {
+        jobs [t].spawned = false;
+        portal_thread (jobs + t);
+      }
+    }
+    
+    // Link in window order
+    unsigned* next_piece  = new unsigned [threads];
+    unsigned* next_vertex = new unsigned [threads];
+    for (unsigned t = 0; t != threads; t++)
+      next_piece [t] = next_vertex [t] = 0;
+    
+    for (unsigned w = first; w != last; w++)
+    {
+      PortalOutput& output = jobs [w % threads].output;
+      unsigned& piece  = next_piece  [w % threads];
+      unsigned& vertex = next_vertex [w % threads];
+      
+      for (; piece != output.piece_count && output.pieces [piece].window == w; piece++)
+      {
+        const PortalPiece& p = output.pieces [piece];
+        
+        Portal* portal = portal_alloc ();
+        portal -> poly = Polygon (output.vertices + vertex, p.vertex_count);
+        portal -> plane = plane_facing (run -> windows [w].index, portal -> poly);
+        portal -> a = p.a;
+        portal -> b = p.b;
+        vertex += p.vertex_count;
+        
+        file_portal (p.a, portal);
+        file_portal (p.b, portal);
+      }
+    }
+    
+    delete [] next_vertex;
+    delete [] next_piece;
+    delete [] handles;
+  }
+  
+  //
+  // portal_run_free
+  //
+  static void portal_run_free (PortalRun* run)
+  {
+    if (run -> jobs)
+    {
+      for (unsigned t = 0; t != run -> threads; t++)
+      {
+        delete [] run -> jobs [t].output.pieces;
+        delete [] run -> jobs [t].output.vertices;
+      }
+    }
+    
+    delete [] run -> jobs;
+    delete [] run -> planes;
+    delete [] run -> windows;
+    delete [] run -> nodes;
+    run -> jobs    = 0;
+    run -> planes  = 0;
+    run -> windows = 0;
+    run -> nodes   = 0;
+  }
+  
+  //
+  // portal_run_step
+  // Cuts and links windows until all are done, returning true, or until the
+  //  deadline passes. Without one, they go in a single batch shared out to
+  //  the threads. With one, they go a window for each job at a time, all
+  //  on this thread: a slice is too short to be worth starting threads,
+  //  and their pools, for.
+  //
+  static bool portal_run_step (PortalRun* run, double deadline)
+  {
+    bool sliced = deadline != 0.0;
+    unsigned batch = sliced ? run -> threads : run -> window_count;
+    
+    unsigned done = 0;
+    
+    while (run -> next_window != run -> window_count)
+    {
+      if (done++ && past_deadline (deadline))
+        return false;
+      
+      unsigned last = run -> window_count;
+      if (last - run -> next_window > batch)
+        last = run -> next_window + batch;
+      
+      portal_run_batch (run, run -> next_window, last, !sliced);
+      run -> next_window = last;
+    }
+    
+    portal_run_free (run);
+    return true;
+  }
+  
+  //
+  // verify_portals
+  //
+  static void verify_portals (Node* root, unsigned depth)
+  {
+    Node** stack = new Node* [depth + 1];
+    Node** top = stack;
+    *top++ = root;
+    
+    while (top != stack)
+    {
+      Node* node = *--top;
+      
+      if (!node -> is_leaf ())
+      {
+        *top++ = node -> back;
+        *top++ = node -> front;
+        continue;
+      }
+      
+      unsigned portal_count = 0;
+      unsigned removed_count = 0;
+      
+      for (MapPlane*
+        m  = node -> maps;
+        m != 0;
+        m  = m -> next)
+      {
+        portal_count += m -> portal_count ();
+        
+        for (Portal**
+          p  = m -> portals_begin ();
+          p != m -> portals_end ();
+          p++)
+        {
+          if (!portal_valid (*p))
+          {
+            portal_free (*p);
+            *p = 0;
+            removed_count++;
+            continue;
+          }
+          
+          Node* n;
+          
+          if      ((*p) -> a == node) n = (*p) -> b;
+          else if ((*p) -> b == node) n = (*p) -> a;
+          else                        debug_trap (false); // mislinked
+          
+          debug_trap (n -> is_leaf ()); // portal to non-leaf
+        }
+        // for (Portals ...
+      }
+      // for (Maps ...
+      
+      //cout << "Leaf with " << PortalCount << " portals now has " << PortalCount - RemovedCount << "\n";
+    }
+    
+    delete [] stack;
+  }
+  
+  //
+  // LeafSet
+  // Visited bitset over dense leaf indices.
+  //
+  struct LeafSet
+  {
+    rku32* bits;
+    
+    LeafSet (unsigned leaf_count) :
+      bits (new rku32 [(leaf_count + 31) / 32])
+    {
+      for (unsigned i = 0; i != (leaf_count + 31) / 32; i++)
+        bits [i] = 0;
+    }
+    
+    ~LeafSet ()
+    {
+      delete [] bits;
+    }
+    
+    inline bool test (const Node* leaf) const
+    {
+      return (bits [leaf -> leaf_index >> 5] >> (leaf -> leaf_index & 31)) & 1;
+    }
+    
+    inline void set (const Node* leaf)
+    {
+      bits [leaf -> leaf_index >> 5] |= rku32 (1) << (leaf -> leaf_index & 31);
+    }
+    
+  };
+  
+  //
+  // FillRun
+  // fill_outside between steps.
+  //
+  struct FillRun
+  {
+    LeafSet* visited;
+    Node** stack;
+    Node** top;
+    
+  };
+  
+  //
+  // fill_run_begin
+  //
+  static void fill_run_begin (FillRun* run, Node* outside, unsigned leaf_count)
+  {
+    run -> visited = new LeafSet (leaf_count);
+    run -> stack = new Node* [leaf_count];
+    run -> top = run -> stack;
+    
+    run -> visited -> set (outside);
+    *run -> top++ = outside;
+  }
+  
+  //
+  // fill_run_free
+  //
+  static void fill_run_free (FillRun* run)
+  {
+    delete [] run -> stack;
+    delete run -> visited;
+    run -> stack = 0;
+    run -> visited = 0;
+  }
+  
+  //
+  // fill_outside
+  // Floods outside contents through portals from the outside node. Each leaf
+  //  is pushed at most once, so the stack never exceeds the leaf count.
+  //  Returns true when done, or false if the deadline passed first.
+  //
+  static bool fill_outside (FillRun* run, double deadline)
+  {
+    LeafSet& visited = *run -> visited;
+    Node** stack = run -> stack;
+    
+    unsigned done = 0;
+    
+    while (run -> top != stack)
+    {
+      if (done++ && past_deadline (deadline))
+        return false;
+      
+      Node* node = *--run -> top;
+      
+      for (MapPlane*
+        m  = node -> maps;
+        m != 0;
+        m  = m -> next)
+      {
+        m -> clear_polys ();
+        
+        for (Portal**
+          p  = m -> portals_begin ();
+          p != m -> portals_end ();
+          p++)
+        {
+          if (!portal_valid (*p))
+          {
+            portal_free (*p);
+            *p = 0;
+            continue;
+          }
+          
+          Node* other = (
+            (*p) -> a == node
+          ? (*p) -> b
+          : (*p) -> a
+          );
+          
+          if (visited.test (other))
+            continue;
+          
+          visited.set (other);
+          other -> contents = node -> contents;
+          *run -> top++ = other;
+          
+          portal_free (*p);
+          *p = 0;
+        }
+      }
+    }
+    
+    fill_run_free (run);
+    return true;
+  }
+  
+  //
+  // world_locate
+  //
+  static Node* world_locate (Node* node, Vector3 point)
+  {
+    assert (node);
+    
+    while (node -> front && node -> back)
+    {
+      const Plane& partition = plane_get (node -> partition);
+      if (point_class (partition.normal, partition.distance, point) < 0)
+        node = node -> back;
+      else
+        node = node -> front;
+    }
+    
+    return node;
+  }
+  
+  //
+  // portal_centre
+  //
+  static Vector3 portal_centre (const Portal* portal)
+  {
+    Vector3 sum;
+    for (const Vector3* v = portal -> poly.begin (); v != portal -> poly.end (); v++)
+      sum = sum + *v;
+    
+    return sum * (1.0 / portal -> poly.size ());
+  }
+  
+  //
+  // report_leak
+  // Prints the portals crossed from the entity to the outside, entity first.
+  //
+  static void report_leak (Node* outside, Node** from, Portal** via, const Vector3& entity,
+    void (*status) (const char*))
+  {
+    char message [128];
+    
+    status ("LEAK LEAK LEAK");
+    sprintf (message, "- Leak from entity at (%g %g %g)", entity.x, entity.y, entity.z);
+    status (message);
+    
+    unsigned length = 0;
+    for (Node* leaf = outside; from [leaf -> leaf_index]; leaf = from [leaf -> leaf_index])
+      length++;
+    
+    Portal** path = new Portal* [length];
+    Portal** cur = path + length;
+    for (Node* leaf = outside; from [leaf -> leaf_index]; leaf = from [leaf -> leaf_index])
+      *--cur = via [leaf -> leaf_index];
+    
+    for (unsigned i = 0; i != length; i++)
+    {
+      Vector3 centre = portal_centre (path [i]);
+      sprintf (message, "-  through portal at (%g %g %g)", centre.x, centre.y, centre.z);
+      status (message);
+    }
+    
+    status ("-  to outside");
+    delete [] path;
+  }
+  
+  //
+  // FloodRun
+  // flood_entities between steps.
+  //
+  struct FloodRun
+  {
+    // Leaf each was reached from, the portal crossed, and whose entity
+    Node**    from;
+    Portal**  via;
+    unsigned* source;
+    
+    Node** queue;
+    Node** head;
+    Node** tail;
+    
+    unsigned entity; // To seed next
+    unsigned seeded;
+    Node* leak;
+    
+  };
+  
+  //
+  // flood_run_begin
+  //
+  static void flood_run_begin (FloodRun* run, unsigned leaf_count)
+  {
+    run -> from   = new Node*    [leaf_count];
+    run -> via    = new Portal*  [leaf_count];
+    run -> source = new unsigned [leaf_count];
+    
+    run -> queue = new Node* [leaf_count];
+    run -> head  = run -> queue;
+    run -> tail  = run -> queue;
+    
+    run -> entity = 0;
+    run -> seeded = 0;
+    run -> leak   = 0;
+  }
+  
+  //
+  // flood_run_free
+  //
+  static void flood_run_free (FloodRun* run)
+  {
+    delete [] run -> queue;
+    delete [] run -> source;
+    delete [] run -> via;
+    delete [] run -> from;
+    run -> queue  = 0;
+    run -> source = 0;
+    run -> via    = 0;
+    run -> from   = 0;
+  }
+  
+  //
+  // flood_entities
+  // Floods from each entity's leaf through portals, marking what it reaches
+  //  in Reached. Must run before fill_outside, which consumes the portals.
+  //  Returns true when done, or false if the deadline passed first. Then
+  //  Seeded is the number of entities that found an empty leaf, or 0 after
+  //  reporting a leak.
+  //
+  static bool flood_entities (FloodRun* run, Node* root, Node* outside,
+    const Vector3* entities, unsigned entity_count, LeafSet* reached, void (*status) (const char*), double deadline)
+  {
+    unsigned done = 0;
+    
+    for (; run -> entity != entity_count; run -> entity++)
+    {
+      if (done++ && past_deadline (deadline))
+        return false;
+      
+      unsigned e = run -> entity;
+      Node* leaf = world_locate (root, entities [e]);
+      
+      if (leaf -> contents == contents_solid)
+      {
+        char message [128];
+        sprintf (message, "- Warning: entity at (%g %g %g) embedded in solid",
+          entities [e].x, entities [e].y, entities [e].z);
+        status (message);
+        continue;
+      }
+      
+      run -> seeded++;
+      
+      if (reached -> test (leaf))
+        continue;
+      
+      reached -> set (leaf);
+      run -> from   [leaf -> leaf_index] = 0;
+      run -> source [leaf -> leaf_index] = e;
+      *run -> tail++ = leaf;
+    }
+    
+    while (run -> head != run -> tail && !run -> leak)
+    {
+      if (done++ && past_deadline (deadline))
+        return false;
+      
+      Node* node = *run -> head++;
+      
+      for (MapPlane*
+        m  = node -> maps;
+        m != 0;
+        m  = m -> next)
+      {
+        for (Portal**
+          p  = m -> portals_begin ();
+          p != m -> portals_end ();
+          p++)
+        {
+          if (!portal_valid (*p))
+            continue;
+          
+          Node* other = (
+            (*p) -> a == node
+          ? (*p) -> b
+          : (*p) -> a
+          );
+          
+          if (reached -> test (other) || other -> contents == contents_solid)
+            continue;
+          
+          reached -> set (other);
+          run -> from   [other -> leaf_index] = node;
+          run -> via    [other -> leaf_index] = *p;
+          run -> source [other -> leaf_index] = run -> source [node -> leaf_index];
+          *run -> tail++ = other;
+          
+          if (other == outside)
+            run -> leak = other;
+        }
+      }
+    }
+    
+    Node* leak = run -> leak;
+    if (leak)
+    {
+      report_leak (leak, run -> from, run -> via, entities [run -> source [leak -> leaf_index]], status);
+      run -> seeded = 0;
+    }
+    
+    flood_run_free (run);
+    return true;
+  }
+  
+  //
+  // remove_unreachable
+  // Makes solid every empty leaf no entity can reach, so it is neither
+  //  written nor drawn. Returns how many there were.
+  //
+  static unsigned remove_unreachable (Node* root, unsigned depth, const LeafSet& reached)
+  {
+    unsigned removed = 0;
+    
+    Node** stack = new Node* [depth + 1];
+    Node** top = stack;
+    *top++ = root;
+    
+    while (top != stack)
+    {
+      Node* node = *--top;
+      
+      if (node -> front && node -> back)
+      {
+        *top++ = node -> back;
+        *top++ = node -> front;
+      }
+      else if (node -> contents == contents_empty && !reached.test (node))
+      {
+        node -> contents = contents_solid;
+        removed++;
+      }
+    }
+    
+    delete [] stack;
+    return removed;
+  }
+  
+  //
+  // ClusterRun
+  // cluster_leaves between steps.
+  //
+  struct ClusterRun
+  {
+    ArenaSpan <Node*> stack; // Of the walk for seeds
+    Node** queue;
+    unsigned cluster_count;
+    unsigned clustered;
+    
+  };
+  
+  //
+  // cluster_run_begin
+  //
+  static void cluster_run_begin (ClusterRun* run, Node* root, unsigned depth, unsigned leaf_count)
+  {
+    run -> stack.reserve (depth + 1);
+    run -> stack.push (root);
+    run -> queue = new Node* [leaf_count];
+    run -> cluster_count = 0;
+    run -> clustered = 0;
+  }
+  
+  //
+  // cluster_run_free
+  //
+  static void cluster_run_free (ClusterRun* run)
+  {
+    run -> stack.release ();
+    delete [] run -> queue;
+    run -> queue = 0;
+  }
+  
+  //
+  // cluster_leaves
+  // Gathers empty leaves into clusters of up to Max_leaves, each grown
+  //  breadth-first through portals from the first leaf in pre-order not yet
+  //  taken. A cluster's leaves are chained from that first leaf, and are
+  //  drawn as one batch. Returns true when done, or false if the deadline
+  //  passed first, checked between clusters. Then Cluster_count is the
+  //  number of clusters, and Clustered the number of leaves in them.
+  //
+  static bool cluster_leaves (ClusterRun* run, unsigned max_leaves, double deadline)
+  {
+    if (max_leaves == 0)
+      max_leaves = 1;
+    
+    Node** queue = run -> queue;
+    unsigned done = 0;
+    
+    while (!run -> stack.empty ())
+    {
+      Node* seed = run -> stack.pop ();
+      
+      if (seed -> front && seed -> back)
+      {
+        run -> stack.push (seed -> back);
+        run -> stack.push (seed -> front);
+        continue;
+      }
+      
+      if (seed -> contents != contents_empty || seed -> cluster != no_cluster)
+        continue;
+      
+      if (done++ && past_deadline (deadline))
+      {
+        run -> stack.push (seed);
+        return false;
+      }
+      
+      unsigned cluster = run -> cluster_count++;
+      unsigned members = 1;
+      
+      Node** head = queue;
+      Node** tail = queue;
+      seed -> cluster = cluster;
+      *tail++ = seed;
+      
+      Node* last = 0;
+      
+      while (head != tail)
+      {
+        Node* node = *head++;
+        
+        if (last)
+          last -> cluster_next = node;
+        last = node;
+        
+        for (MapPlane*
+          m  = node -> maps;
+          m != 0 && members != max_leaves;
+          m  = m -> next)
+        {
+          for (Portal**
+            p  = m -> portals_begin ();
+            p != m -> portals_end () && members != max_leaves;
+            p++)
+          {
+            if (!portal_valid (*p))
+              continue;
+            
+            Node* other = (
+              (*p) -> a == node
+            ? (*p) -> b
+            : (*p) -> a
+            );
+            
+            if (other -> contents != contents_empty || other -> cluster != no_cluster)
+              continue;
+            
+            other -> cluster = cluster;
+            *tail++ = other;
+            members++;
+          }
+        }
+      }
+      
+      run -> clustered += members;
+    }
+    
+    cluster_run_free (run);
+    return true;
+  }
+  
+  //
+  // DetailTask
+  //
+  struct DetailTask
+  {
+    Node* node;
+    Polygon* poly;
+    
+  };
+  
+  //
+  // add_leaf_poly
+  // Files detail Poly under the leaf's map for its plane, making one if
+  //  need be.
+  //
+  static void add_leaf_poly (Node* leaf, Polygon* poly)
+  {
+    PlaneIndex plane = plane_find (Plane (poly -> normal (), poly -> distance ()));
+    
+    for (MapPlane*
+      m  = leaf -> maps;
+      m != 0;
+      m  = m -> next)
+    {
+      if (plane_same (plane, m -> plane))
+      {
+        m -> add_poly (poly);
+        m -> detail_count++;
+        return;
+      }
+    }
+    
+    MapPlane* map = new MapPlane;
+    map -> plane = plane;
+    map -> add_poly (poly);
+    map -> detail_count = 1;
+    mapplane_insert (&leaf -> maps, map);
+  }
+  
+  //
+  // clip_detail
+  // Pushes detail polygons down the finished tree, splitting them where
+  //  they cross a partition. Pieces reaching empty leaves join that leaf's
+  //  geometry; the rest are dropped. Faces on a partition go to the side
+  //  they face. Clips from Next on, until all are done, returning true, or
+  //  until the deadline passes.
+  //
+  static bool clip_detail (Node* root, Polygon* const* polys, unsigned count, unsigned* next, double deadline)
+  {
+    ArenaSpan <DetailTask> stack;
+    unsigned done = 0;
+    
+    for (; *next != count; ++*next)
+    {
+      if (done++ && past_deadline (deadline))
+        return false;
+      
+      DetailTask task = { root, polys [*next] };
+      stack.push (task);
+      
+      while (!stack.empty ())
+      {
+        task = stack.pop ();
+        Node* node = task.node;
+        Polygon* poly = task.poly;
+        
+        if (node -> is_leaf ())
+        {
+          if (node -> contents == contents_empty)
+            add_leaf_poly (node, poly);
+          else
+            polygon_free (poly);
+          continue;
+        }
+        
+        const Plane& partition = plane_get (node -> partition);
+        
+        PlaneSide side;
+        if (is_polygon_in (*poly, partition))
+          side = dot (poly -> normal (), partition.normal) > 0.0 ? plane_side_front : plane_side_back;
+        else
+          side = polygon_side (partition, *poly);
+        
+        if (side == plane_side_front)
+        {
+          DetailTask front_task = { node -> front, poly };
+          stack.push (front_task);
+        }
+        else if (side == plane_side_back)
+        {
+          DetailTask back_task = { node -> back, poly };
+          stack.push (back_task);
+        }
+        else
+        {
+          Polygon* fore = polygon_alloc ();
+          Polygon* rear = polygon_alloc ();
+          split_poly (poly, &partition, fore, rear);
+          polygon_free (poly);
+          
+          DetailTask front_task = { node -> front, fore };
+          DetailTask back_task  = { node -> back,  rear };
+          stack.push (back_task);
+          stack.push (front_task);
+        }
+      }
+    }
+    
+    return true;
+  }
+  
+  //
+  // stream_leaves
+  // Writes and frees every empty leaf, for streamed compiles whose leaves
+  //  had to wait for their detail. Walks on Stack, which starts with the
+  //  root, until it is done, returning true, or until the deadline passes.
+  //
+  static bool stream_leaves (ArenaSpan <Node*>* stack, FILE* file, double quantize_error, double deadline)
+  {
+    unsigned done = 0;
+    
+    while (!stack -> empty ())
+    {
+      Node* node = stack -> pop ();
+      
+      if (node -> front && node -> back)
+      {
+        stack -> push (node -> back);
+        stack -> push (node -> front);
+      }
+      else if (node -> contents == contents_empty)
+      {
+        if (done++ && past_deadline (deadline))
+        {
+          stack -> push (node);
+          return false;
+        }
+        
+        world_write_leaf (node, file, quantize_error);
+        leaf_clear_polys (node);
+      }
+    }
+    
+    return true;
+  }
+  
+  //
+  // World
+  //
+  struct World
+  {
+    Node root;
+    Node outside;
+    unsigned leaf_count;
+    unsigned depth; // Of the deepest leaf, root being 0
+    unsigned plane_misses;
+    unsigned cluster_count;
+    FILE* stream;   // Output being streamed to, until world_save finishes it
+    char* stream_name; // Its name, kept once saved; the geometry is gone
+    double quantize_error; // Leaves are written with; see CompileOptions
+    ArenaSpan <Polygon*> detail; // Until clip_detail places it in the leaves
+    ArenaSpan <PlaneIndex> hull; // Boundary planes, facing in, until build_portals
+    const void* planes; // Table its indices are into; see plane_table
+    
+  };
+  
+  //
+  // dummy_status
+  //
+  static void dummy_status (const char*)
+  {
+    
+  }
+  
+  //
+  // world_alloc
+  //
+  static World* world_alloc ()
+  {
+    World* world = new World;
+    world -> outside.contents = contents_outside;
+    world -> outside.leaf_index = 0;
+    world -> leaf_count = 1;
+    world -> depth = 0;
+    world -> plane_misses = 0;
+    world -> cluster_count = 0;
+    world -> quantize_error = 0.0;
+    world -> stream = 0;
+    world -> stream_name = 0;
+    world -> planes = plane_table ();
+    return world;
+  }
+  
+  //
+  // world_add_detail
+  // Keeps pooled copies of the detail polygons for clip_detail.
+  //
+  static void world_add_detail (World* world, const Polygon* polys, unsigned count)
+  {
+    for (const Polygon* p = polys; p != polys + count; p++)
+    {
+      Polygon* detail = polygon_alloc ();
+      *detail = *p;
+      world -> detail.push (detail);
+    }
+  }
+  
+  //
+  // world_add_hull
+  // Strips the boundaries mark_boundary_planes found, and keeps their
+  //  planes, facing in, as the hull.
+  //
+  static void world_add_hull (World* world, ArenaSpan <MapPlane*>* boundaries)
+  {
+    strip_boundary_planes (boundaries -> begin (), boundaries -> size ());
+    
+    // Portals to the outside are cut from these once the tree is done
+    for (MapPlane** b = boundaries -> begin (); b != boundaries -> end (); b++)
+    {
+      if ((*b) -> boundary)
+        world -> hull.push ((*b) -> boundary == plane_side_front ? (*b) -> plane : plane_flip ((*b) -> plane));
+    }
+  }
+  
+  //
+  // CompileContext
+  // The stages are listed in World.hpp. Each keeps what it needs between
+  //  steps here.
+  //
+  struct CompileContext
+  {
+    CompileOptions options;
+    void (*status) (const char*);
+    
+    const Polygon* polys; // Until mapped
+    unsigned count;
+    unsigned detail_count; // The last of Polys
+    Polygon* cleaned;     // Polys, if they were cleaned
+    CleanRun clean;
+    
+    unsigned next;        // Polygon to map, or detail to clip, next
+    MapPlane* next_map;   // To test as a boundary
+    ArenaSpan <MapPlane*> boundaries;
+    
+    World* world;
+    PartitionCache cache;
+    Partitioner part;
+    PartitionRun run;
+    
+    ArenaSpan <Node*> walk; // Of stream_leaves
+    PortalRun portals;
+    FloodRun flood;
+    FillRun fill;
+    ClusterRun clusters;
+    
+    LeafSet* reached; // By the entity flood
+    unsigned seeded;  // Entities in empty leaves, or 0 if there was a leak
+    
+    int stage;
+    
+  };
+  
+  //
+  // compile_begin
+  // Nothing is done until the first compile_step, and Polys must stay valid
+  //  until the compile is finished or cancelled.
+  //
+  CompileContext* compile_begin (const Polygon* polys, unsigned count, const CompileOptions& options)
+  {
+    assert (polys);
+    assert (count);
+    assert (options.detail_count <= count);
+    
+    CompileContext* context = new CompileContext;
+    context -> options  = options;
+    context -> status   = options.status ? options.status : dummy_status;
+    context -> polys    = polys;
+    context -> count    = count;
+    context -> detail_count = options.detail_count;
+    context -> cleaned  = 0;
+    context -> next     = 0;
+    context -> next_map = 0;
+    context -> world    = 0;
+    context -> reached  = 0;
+    context -> seeded   = 0;
+    context -> stage    = compile_stage_begin;
+    
+    context -> clean.slots  = 0;
+    context -> clean.hashes = 0;
+    context -> clean.dead   = 0;
+    context -> clean.detail = 0;
+    
+    context -> portals.nodes   = 0;
+    context -> portals.windows = 0;
+    context -> portals.planes  = 0;
+    context -> portals.jobs    = 0;
+    
+    context -> flood.from   = 0;
+    context -> flood.via    = 0;
+    context -> flood.source = 0;
+    context -> flood.queue  = 0;
+    
+    context -> fill.visited = 0;
+    context -> fill.stack   = 0;
+    
+    context -> clusters.queue = 0;
+    
+    return context;
+  }
+  
+  //
+  // compile_open
+  // Checks the input, cleaned if it was to be, and makes the world and any
+  //  stream. Returns false if there is nothing to compile.
+  //
+  static bool compile_open (CompileContext* context)
+  {
+    const CompileOptions& options = context -> options;
+    void (*status) (const char*) = context -> status;
+    
+    const Polygon* polys = context -> polys;
+    unsigned count = context -> count;
+    
+    // Detail alone leaves nothing to partition
+    if (context -> detail_count == count)
+      return false;
+    
+    // Partitions are cut from squares that only reach so far
+    double reach = 0.0;
+    for (unsigned i = 0; i != count; i++)
+    {
+      for (const Vector3* v = polys [i].begin (); v != polys [i].end (); v++)
+      {
+        double length = v -> length ();
+        if (length > reach)
+          reach = length;
+      }
+    }
+    
+    if (reach >= plane_poly_extent)
+    {
+      char message [128];
+      sprintf (message, "Input reaches %g units from the origin; this build handles under %g",
+        reach, double (plane_poly_extent));
+      status (message);
+      return false;
+    }
+    
+    FILE* stream = 0;
+    if (options.stream)
+    {
+      stream = fopen (options.stream, "wb");
+      if (!stream)
+        return false;
+      
+      world_write_header (stream, 0, 0, 0, 0);
+    }
+    
+    World* world = world_alloc ();
+    
+    world -> stream = stream;
+    if (stream)
+    {
+      world -> stream_name = new char [strlen (options.stream) + 1];
+      strcpy (world -> stream_name, options.stream);
+    }
+    
+    world -> quantize_error = options.quantize_error;
+    context -> world = world;
+    
+    return true;
+  }
+  
+  //
+  // compile_partition_begin
+  // Fills the partition cache from any earlier compile, and starts on the
+  //  tree.
+  //
+  static void compile_partition_begin (CompileContext* context)
+  {
+    const CompileOptions& options = context -> options;
+    World* world = context -> world;
+    
+    const World* previous = options.previous;
+    
+    if (previous)
+    {
+      context -> cache.init (previous -> leaf_count * 2);
+      
+      assert (previous -> planes == plane_table ());
+      partition_cache_add_tree (&context -> cache, &previous -> root, previous -> depth, !previous -> stream_name);
+    }
+    
+    // Leaves with detail to come can't be streamed until it's there
+    FILE* leaf_stream = world -> detail.empty () ? world -> stream : 0;
+    
+    Partitioner part = { &context -> cache, world -> leaf_count, 0, 0, 0, 0, leaf_stream, options.quantize_error, context -> status };
+    context -> part = part;
+    
+    context -> status ("partition_tree...");
+    partition_run_begin (&context -> run, &world -> root);
+  }
+  
+  //
+  // compile_drop
+  // Frees the world and whatever else the compile has in hand.
+  //
+  static void compile_drop (CompileContext* context)
+  {
+    if (context -> world)
+    {
+      world_free (context -> world);
+      context -> world = 0;
+      
+      if (context -> options.stream)
+        remove (context -> options.stream);
+    }
+    
+    clean_run_free (&context -> clean);
+    delete [] context -> cleaned;
+    context -> cleaned = 0;
+    context -> polys = 0;
+    
+    context -> boundaries.release ();
+    context -> run.stack.release ();
+    context -> run.held.release ();
+    context -> walk.release ();
+    
+    portal_run_free  (&context -> portals);
+    flood_run_free   (&context -> flood);
+    fill_run_free    (&context -> fill);
+    cluster_run_free (&context -> clusters);
+    
+    delete context -> reached;
+    context -> reached = 0;
+  }
+  
+  //
+  // compile_step
+  // Works through the compile until it is finished or Budget_ms of wall
+  //  time has gone. Every stage that loops checks the time as it goes, and
+  //  carries on where it left off in the next step; each step makes some
+  //  progress, however small the budget.
+  //
+  CompileState compile_step (CompileContext* context, unsigned budget_ms)
+  {
+    assert (context);
+    
+    double deadline = 0.0;
+    if (budget_ms != compile_unbounded)
+      deadline = thread_clock () + budget_ms / 1000.0;
+    
+    const CompileOptions& options = context -> options;
+    void (*status) (const char*) = context -> status;
+    World* world = context -> world;
+    
+    switch (context -> stage)
+    {
+      case compile_stage_begin:
+        if (options.clean)
+        {
+          status ("clean_polygons...");
+          context -> cleaned = new Polygon [context -> count];
+          clean_run_begin (&context -> clean, context -> polys, context -> count, context -> detail_count,
+            options.snap_grid, context -> cleaned);
+        }
+        
+        context -> stage = compile_stage_clean;
+      return compile_running;
+      
+      case compile_stage_clean:
+        if (context -> cleaned)
+        {
+          if (!clean_run_step (&context -> clean, deadline))
+            return compile_running;
+          
+          char message [192];
+          clean_describe (&context -> clean.stats, message);
+          status (message);
+          
+          context -> polys = context -> cleaned;
+          context -> count = context -> clean.stats.faces_out;
+          context -> detail_count = context -> clean.stats.detail_out;
+        }
+        
+        if (!context -> count || !compile_open (context))
+        {
+          compile_drop (context);
+          context -> stage = compile_stage_failed;
+          return compile_failed;
+        }
+        
+        status ("map_by_plane...");
+        context -> next = 0;
+        context -> stage = compile_stage_map;
+      return compile_running;
+      
+      case compile_stage_map:
+        if (!map_by_plane (&world -> root.maps, context -> polys, context -> count - context -> detail_count, &context -> next, deadline))
+          return compile_running;
+        
+        world_add_detail (world, context -> polys + context -> count - context -> detail_count, context -> detail_count);
+        
+        delete [] context -> cleaned;
+        context -> cleaned = 0;
+        context -> polys = 0;
+        
+        status ("mark_boundary_planes...");
+        context -> next_map = world -> root.maps;
+        context -> stage = compile_stage_boundary;
+      return compile_running;
+      
+      case compile_stage_boundary:
+        if (!mark_boundary_planes (world -> root.maps, &context -> next_map, &context -> boundaries, deadline))
+          return compile_running;
+        
+        status ("strip_boundary_planes...");
+        world_add_hull (world, &context -> boundaries);
+        context -> boundaries.release ();
+        
+        compile_partition_begin (context);
+        context -> stage = compile_stage_partition;
+      return compile_running;
+      
+      case compile_stage_partition:
+        // Deepest node so far bounds the tree, should it be freed early
+        world -> depth = context -> run.depth;
+        
+        if (!partition_run_step (&context -> run, &context -> part, deadline))
+        {
+          world -> depth = context -> run.depth;
+          world -> leaf_count = context -> part.leaf_count;
+          world -> plane_misses = context -> part.plane_misses;
+          return compile_running;
+        }
+        
+        world -> depth = context -> run.depth;
+        world -> leaf_count = context -> part.leaf_count;
+        world -> plane_misses = context -> part.plane_misses;
+        context -> run.stack.release ();
+        
+        if (options.previous)
+        {
+          char message [128];
+          sprintf (message, "Reused %u of %u partitions, %u grafted whole", context -> part.reused,
+            context -> part.reused + context -> part.selected, context -> part.grafted);
+          status (message);
+        }
+        
+        if (!world -> detail.empty ())
+          status ("clip_detail...");
+        
+        context -> next = 0;
+        context -> stage = compile_stage_detail;
+      return compile_running;
+      
+      case compile_stage_detail:
+        if (!world -> detail.empty ())
+        {
+          if (!clip_detail (&world -> root, world -> detail.begin (), world -> detail.size (), &context -> next, deadline))
+            return compile_running;
+          
+          world -> detail.release ();
+          
+          if (world -> stream)
+          {
+            context -> walk.reserve (world -> depth + 1);
+            context -> walk.push (&world -> root);
+          }
+        }
+        
+        context -> stage = compile_stage_stream;
+      return compile_running;
+      
+      case compile_stage_stream:
+        if (!stream_leaves (&context -> walk, world -> stream, world -> quantize_error, deadline))
+          return compile_running;
+        
+        context -> walk.release ();
+        
+        status ("build_portals...");
+        portal_run_begin (&context -> portals, &world -> root, &world -> outside, world -> hull.begin (), world -> hull.size (),
+          world -> leaf_count, options.threads);
+        context -> stage = compile_stage_portals;
+      return compile_running;
+      
+      case compile_stage_portals:
+        if (!portal_run_step (&context -> portals, deadline))
+          return compile_running;
+        
+        world -> hull.release ();
+        context -> stage = compile_stage_verify;
+      return compile_running;
+      
+      case compile_stage_verify:
+        status ("verify_portals...");
+        verify_portals (&world -> root, world -> depth);
+        
+        status ("flood_entities...");
+        context -> reached = new LeafSet (world -> leaf_count);
+        flood_run_begin (&context -> flood, world -> leaf_count);
+        context -> stage = compile_stage_flood;
+      return compile_running;
+      
+      case compile_stage_flood:
+      {
+        // Without entities, the origin stands in for the player start, but
+        //  only to look for leaks; see compile_stage_check
+        const Vector3 origin;
+        const Vector3* entities = &origin;
+        unsigned entity_count = 1;
+        if (options.entities)
+        {
+          entities = options.entities;
+          entity_count = options.entity_count;
+        }
+        
+        if (!flood_entities (&context -> flood, &world -> root, &world -> outside,
+          entities, entity_count, context -> reached, status, deadline))
+        {
+          return compile_running;
+        }
+        
+        context -> seeded = context -> flood.seeded;
+        
+        status ("fill_outside...");
+        fill_run_begin (&context -> fill, &world -> outside, world -> leaf_count);
+        context -> stage = compile_stage_fill;
+      }
+      return compile_running;
+      
+      case compile_stage_fill:
+        if (!fill_outside (&context -> fill, deadline))
+          return compile_running;
+        
+        context -> stage = compile_stage_check;
+      return compile_running;
+      
+      case compile_stage_check:
+        // After a leak, or with every entity in solid, nothing is known to
+        //  be unreachable. Nor is it without an entity list: the origin
+        //  could be in any room.
+        if (context -> seeded && options.entities)
+        {
+          status ("remove_unreachable...");
+          unsigned removed = remove_unreachable (&world -> root, world -> depth, *context -> reached);
+          
+          char message [96];
+          sprintf (message, "Removed %u unreachable leaves", removed);
+          status (message);
+        }
+        
+        delete context -> reached;
+        context -> reached = 0;
+        
+        status ("cluster_leaves...");
+        cluster_run_begin (&context -> clusters, &world -> root, world -> depth, world -> leaf_count);
+        context -> stage = compile_stage_cluster;
+      return compile_running;
+      
+      case compile_stage_cluster:
+      {
+        if (!cluster_leaves (&context -> clusters, options.cluster_leaves, deadline))
+          return compile_running;
+        
+        world -> cluster_count = context -> clusters.cluster_count;
+        
+        char message [96];
+        sprintf (message, "Clustered %u empty leaves into %u", context -> clusters.clustered, world -> cluster_count);
+        status (message);
+        
+        status ("Done");
+        context -> stage = compile_stage_done;
+      }
+      return compile_done;
+      
+      case compile_stage_done:
+      return compile_done;
+      
+      case compile_stage_cancelled:
+      return compile_cancelled;
+      
+      default:
+      return compile_failed;
+    }
+  }
+  
+  //
+  // compile_progress
+  //
+  void compile_progress (const CompileContext* context, CompileProgress* progress)
+  {
+    assert (context);
+    assert (progress);
+    
+    progress -> stage    = context -> stage;
+    progress -> depth    = 0;
+    progress -> leaves   = 0;
+    progress -> pending  = 0;
+    
+    if (context -> stage >= compile_stage_partition && context -> world)
+    {
+      progress -> depth   = context -> run.depth;
+      progress -> leaves  = context -> part.leaf_count - 1; // Less the outside
+      progress -> pending = context -> run.stack.size ();
+    }
+  }
+  
+  //
+  // compile_cancel
+  // Drops all work done so far. Later steps report compile_cancelled.
+  //
+  void compile_cancel (CompileContext* context)
+  {
+    assert (context);
+    
+    if (context -> stage == compile_stage_done || context -> stage == compile_stage_cancelled)
+      return;
+    
+    compile_drop (context);
+    context -> stage = compile_stage_cancelled;
+  }
+  
+  //
+  // compile_end
+  // Frees the context. Returns the world if the compile finished, in which
+  //  case it now belongs to the caller.
+  //
+  World* compile_end (CompileContext* context)
+  {
+    if (!context)
+      return 0;
+    
+    if (context -> stage != compile_stage_done)
+      compile_cancel (context);
+    
+    World* world = context -> world;
+    delete context;
+    return world;
+  }
+  
+  //
+  // world_compile
+  // Partitions Previous, an earlier compile, already chose for the same
+  //  node input are reused, so only new input runs select_partition. Where
+  //  Previous saw a node's input, the subtree it made is copied, leaves and
+  //  all, with nothing below hashed or split again. The result is the same
+  //  as a full compile.
+  // With Stream, each empty leaf's geometry is written to that file and
+  //  freed as soon as the leaf is finished. world_save then only adds the
+  //  node table; see there.
+  // Detail polygons play no part in partitioning. Once the tree is built,
+  //  they are clipped into the empty leaves they touch.
+  //
+  World* world_compile (const Polygon* polys, unsigned count, const CompileOptions& options)
+  {
+    CompileContext* context = compile_begin (polys, count, options);
+    
+    while (compile_step (context, compile_unbounded) == compile_running)
+      ;
+    
+    return compile_end (context);
+  }
+  
+  //
+  // world_stats
+  //
+  void world_stats (const World* world, WorldStats* stats)
+  {
+    assert (world);
+    assert (stats);
+    
+    stats -> leaves       = world -> leaf_count - 1; // Less the outside
+    stats -> depth        = world -> depth;
+    stats -> plane_misses = world -> plane_misses;
+    stats -> clusters     = world -> cluster_count;
+    
+    // Leaves only know their encoding once written
+    stats -> quantized      = 0;
+    stats -> triangle_bytes = 0;
+    stats -> float_bytes    = 0;
+    
+    const Node** stack = new const Node* [world -> depth + 1];
+    const Node** top = stack;
+    *top++ = &world -> root;
+    
+    while (top != stack)
+    {
+      const Node* node = *--top;
+      
+      if (node -> front && node -> back)
+      {
+        *top++ = node -> back;
+        *top++ = node -> front;
+      }
+      else if (node -> contents == contents_empty)
+      {
+        stats -> float_bytes += node -> tri_count * 36ul;
+        
+        if (node -> tri_encoding == leaf_quantized)
+        {
+          stats -> quantized++;
+          stats -> triangle_bytes += 24 + node -> tri_count * 18ul;
+        }
+        else
+        {
+          stats -> triangle_bytes += node -> tri_count * 36ul;
+        }
+      }
+    }
+    
+    delete [] stack;
+  }
+  
+  //
+  // world_free
+  //
+  void world_free (World* world)
+  {
+    if (!world)
+      return;
+    
+    assert (world -> planes == plane_table ());
+    
+    if (world -> stream)
+      fclose (world -> stream);
+    delete [] world -> stream_name;
+    
+    for (Polygon** p = world -> detail.begin (); p != world -> detail.end (); p++)
+      polygon_free (*p);
+    
+    node_free_maps (&world -> outside);
+    
+    Node** stack = new Node* [world -> depth + 1];
+    Node** top = stack;
+    *top++ = &world -> root;
+    
+    while (top != stack)
+    {
+      Node* node = *--top;
+      
+      if (node -> front) *top++ = node -> front;
+      if (node -> back ) *top++ = node -> back;
+      
+      node_free_maps (node);
+      
+      if (node != &world -> root)
+        delete node;
+    }
+    
+    delete [] stack;
+    delete world;
+  }
+  
+  //
+  // ClusterEntry
+  //
+  struct ClusterEntry
+  {
+    rku32 tri_count;
+    rkf32 mins [3], maxs [3];
+    
+  };
+  
+  //
+  // world_save
+  // Writes a complete file for a world compiled normally, as often as
+  //  wanted. A streamed world is finished in the file it was streamed to,
+  //  which is then moved to Filename if that differs. Its geometry went
+  //  with it, so it can only be saved once.
+  //
+  bool world_save (World* world, const char* filename)
+  {
+    assert (world);
+    assert (filename);
+    assert (world -> planes == plane_table ());
+    
+    if (world -> stream_name && !world -> stream)
+      return false;
+    
+    FILE* file = world -> stream;
+    world -> stream = 0;
+    
+    Node** stack = new Node* [world -> depth + 1];
+    Node** top;
+    
+    if (!file)
+    {
+      file = fopen (filename, "wb");
+      if (!file)
+      {
+        delete [] stack;
+        return false;
+      }
+      
+      world_write_header (file, 0, 0, 0, 0);
+      
+      // Leaf geometry first, a cluster at a time. Each cluster's first leaf
+      //  in pre-order is where its chain starts.
+      unsigned written = 0;
+      
+      top = stack;
+      *top++ = &world -> root;
+      
+      while (top != stack)
+      {
+        Node* node = *--top;
+        
+        if (node -> front && node -> back)
+        {
+          *top++ = node -> back;
+          *top++ = node -> front;
+        }
+        else if (node -> contents == contents_empty && node -> cluster == written)
+        {
+          for (Node* leaf = node; leaf; leaf = leaf -> cluster_next)
+            world_write_leaf (leaf, file, world -> quantize_error);
+          written++;
+        }
+      }
+    }
+    
+    // Node table, numbering the planes it uses densely as it goes
+    fseek (file, 0, SEEK_END);
+    rku32 nodes_offset = ftell (file);
+    
+    unsigned surface_count = plane_count () / 2;
+    rku32* remap = new rku32 [surface_count];
+    for (unsigned i = 0; i != surface_count; i++)
+      remap [i] = ~0u;
+    
+    PlaneIndex* used = new PlaneIndex [surface_count];
+    rku32 used_count = 0;
+    
+    // Each cluster's triangle count then bounds, as the cluster table has them
+    ClusterEntry* clusters = new ClusterEntry [world -> cluster_count];
+    for (unsigned i = 0; i != world -> cluster_count; i++)
+    {
+      clusters [i].tri_count = 0;
+      for (unsigned c = 0; c != 3; c++)
+        clusters [i].mins [c] = clusters [i].maxs [c] = 0.0f;
+    }
+    
+    top = stack;
+    *top++ = &world -> root;
+    
+    while (top != stack)
+    {
+      Node* node = *--top;
+      
+      fwrite (&node -> contents, 1, 1, file);
+      
+      if (!node -> front && !node -> back) // Leaf
+      {
+        if (node -> contents == contents_empty)
+        {
+          assert (node -> cluster < world -> cluster_count);
+          
+          rku32 cluster = node -> cluster;
+          ClusterEntry& entry = clusters [cluster];
+          
+          for (unsigned c = 0; node -> tri_count && c != 3; c++)
+          {
+            if (entry.tri_count == 0 || node -> tri_mins [c] < entry.mins [c])
+              entry.mins [c] = node -> tri_mins [c];
+            if (entry.tri_count == 0 || node -> tri_maxs [c] > entry.maxs [c])
+              entry.maxs [c] = node -> tri_maxs [c];
+          }
+          
+          entry.tri_count += node -> tri_count;
+          
+          fwrite (&node -> tri_encoding, 1, 1, file);
+          fwrite (&node -> tri_count,    4, 1, file);
+          fwrite (&node -> tri_offset,   4, 1, file);
+          fwrite (&cluster,              4, 1, file);
+        }
+      }
+      else if (node -> front && node -> back) // Non-Leaf
+      {
+        rku32 surface = node -> partition >> 1;
+        if (remap [surface] == ~0u)
+        {
+          remap [surface] = used_count;
+          used [used_count++] = node -> partition & ~1u;
+        }
+        
+        rku32 plane = (remap [surface] << 1) | (node -> partition & 1);
+        fwrite (&plane, 4, 1, file);
+        
+        *top++ = node -> back;
+        *top++ = node -> front;
+      }
+      else
+      {
+        assert (false);
+      }
+    }
+    
+    delete [] stack;
+    
+    // Plane table
+    rku32 planes_offset = ftell (file);
+    fwrite (&used_count, 4, 1, file);
+    
+    for (unsigned i = 0; i != used_count; i++)
+    {
+      const Plane& partition = plane_get (used [i]);
+      
+      rkf32 plane [4] = {
+        partition.normal.x,
+        partition.normal.y,
+        partition.normal.z,
+        partition.distance
+      };
+      
+      fwrite (plane, 4, 4, file);
+    }
+    
+    delete [] remap;
+    delete [] used;
+    
+    // Cluster table
+    rku32 clusters_offset = ftell (file);
+    rku32 cluster_count = world -> cluster_count;
+    fwrite (&cluster_count, 4, 1, file);
+    for (unsigned i = 0; i != cluster_count; i++)
+    {
+      fwrite (&clusters [i].tri_count, 4, 1, file);
+      fwrite (clusters [i].mins, 4, 3, file);
+      fwrite (clusters [i].maxs, 4, 3, file);
+    }
+    
+    delete [] clusters;
+    
+    world_write_header (file, world -> depth, nodes_offset, planes_offset, clusters_offset);
+    
+    bool ok = !ferror (file);
+    if (fclose (file))
+      ok = false;
+    
+    // rename won't replace a file everywhere
+    if (ok && world -> stream_name && strcmp (world -> stream_name, filename))
+    {
+      remove (filename);
+      ok = rename (world -> stream_name, filename) == 0;
+    }
+    
+    return ok;
+  }
+  
+  //
+  // world_compress
+  // Rewrites a saved file as a packed one: the same bytes, cut into blocks
+  //  that never cross from one section into the next, each compressed on
+  //  its own so a loader can unpack just the blocks it reads.
+  //
+  //   "RKINDPAK"  u32 pack_format  u32 plain_size  u32 block_count
+  //   block_count of u32 plain_size  u32 packed_size
+  //
+  //  The blocks follow in order. A block whose packed size equals its plain
+  //  size is stored as it is; others are LZ; see Lz.hpp.
+  //
+# define pack_format     1
+# define pack_block_size 32768
+  
+  bool world_compress (const char* filename)
+  {
+    assert (filename);
+    
+    char temp [1024];
+    if (strlen (filename) + 5 > sizeof (temp))
+      return false;
+    
+    strcpy (temp, filename);
+    strcat (temp, ".tmp");
+    
+    if (rename (filename, temp))
+      return false;
+    
+    FILE* plain = fopen (temp, "rb");
+    if (!plain)
+    {
+      rename (temp, filename);
+      return false;
+    }
+    
+    // Sections start at 0 and at each table's offset
+    char magic [8];
+    rku32 header [5] = { 0, 0, 0, 0, 0 }; // Format, depth, node, plane and cluster table offsets
+    
+    bool ok = fread (magic, 1, 8, plain) == 8
+           && !strncmp (magic, "RKINDOOR", 8)
+           && fread (header, 4, 5, plain) == 5
+           && header [0] == indoor_format_version
+           && !fseek (plain, 0, SEEK_END);
+    
+    rku32 plain_size = ok ? ftell (plain) : 0;
+    rku32 bounds [5] = { 0, header [2], header [3], header [4], plain_size };
+    
+    for (unsigned i = 0; ok && i != 4; i++)
+      ok = bounds [i] <= bounds [i + 1];
+    
+    FILE* packed = ok ? fopen (filename, "wb") : 0;
+    if (!packed)
+    {
+      fclose (plain);
+      remove (filename);
+      rename (temp, filename);
+      return false;
+    }
+    
+    rku32 block_count = 0;
+    for (unsigned i = 0; i != 4; i++)
+      block_count += (bounds [i + 1] - bounds [i] + pack_block_size - 1) / pack_block_size;
+    
+    rku32* sizes = new rku32 [block_count * 2];
+    
+    rku32 format = pack_format;
+    fwrite ("RKINDPAK", 1, 8, packed);
+    fwrite (&format,      4, 1, packed);
+    fwrite (&plain_size,  4, 1, packed);
+    fwrite (&block_count, 4, 1, packed);
+    fwrite (sizes, 8, block_count, packed); // Filled in at the end
+    
+    rku8* block    = new rku8 [pack_block_size];
+    rku8* unpacked = new rku8 [pack_block_size];
+    unsigned capacity = lz_bound (pack_block_size);
+    rku8* lz = new rku8 [capacity];
+    
+    fseek (plain, 0, SEEK_SET);
+    rku32* size = sizes;
+    
+    for (unsigned i = 0; ok && i != 4; i++)
+    {
+      for (rku32 start = bounds [i]; ok && start != bounds [i + 1]; size += 2)
+      {
+        rku32 length = bounds [i + 1] - start;
+        if (length > pack_block_size)
+          length = pack_block_size;
+        
+        ok = fread (block, 1, length, plain) == length;
+        
+        // Only keep what is smaller and does come back out the same
+        unsigned lz_size = ok ? lz_compress (block, length, lz, capacity) : 0;
+        if (lz_size && (lz_size >= length
+         || !lz_decompress (lz, lz_size, unpacked, length)
+         || memcmp (block, unpacked, length)))
+        {
+          lz_size = 0;
+        }
+        
+        size [0] = length;
+        size [1] = lz_size ? lz_size : length;
+        fwrite (lz_size ? lz : block, 1, size [1], packed);
+        
+        start += length;
+      }
+    }
+    
+    fseek (packed, 20, SEEK_SET);
+    fwrite (sizes, 8, block_count, packed);
+    
+    delete [] lz;
+    delete [] unpacked;
+    delete [] block;
+    delete [] sizes;
+    
+    if (ferror (packed))
+      ok = false;
+    if (fclose (packed))
+      ok = false;
+    fclose (plain);
+    
+    if (ok)
+    {
+      remove (temp);
+    }
+    else
+    {
+      remove (filename);
+      rename (temp, filename);
+    }
+    
+    return ok;
+  }
+  
+  //
+  // Jobs
+  // A distributed compile partitions the top few levels itself and writes
+  //  each node left at the frontier to a job file: the node's maps in list
+  //  order, with their polygons. A worker partitions the job as a tree of
+  //  its own and writes the finished subtree back, which the compile then
+  //  puts in the node's place. Portals only come once the tree is done, so
+  //  a node's input depends on nothing outside its subtree, and the tree is
+  //  the one a single-process compile would make.
+  //
+  
+  //
+  // write_polygon
+  //
+  static void write_polygon (FILE* file, const Polygon* poly)
+  {
+    rku32 size = poly -> size ();
+    fwrite (&size, 4, 1, file);
+    
+    for (const Vector3*
+      v  = poly -> begin ();
+      v != poly -> end   ();
+      v++)
+    {
+      double xyz [3] = { v -> x, v -> y, v -> z };
+      fwrite (xyz, 8, 3, file);
+    }
+  }
+  
+  //
+  // read_polygon
+  //
+  static bool read_polygon (FILE* file, Polygon* poly)
+  {
+    rku32 size;
+    if (fread (&size, 4, 1, file) != 1)
+      return false;
+    
+    poly -> clear ();
+    poly -> reserve (size);
+    
+    while (size--)
+    {
+      double xyz [3];
+      if (fread (xyz, 8, 3, file) != 3)
+        return false;
+      
+      poly -> add_vertex (Vector3 (xyz [0], xyz [1], xyz [2]));
+    }
+    
+    return true;
+  }
+  
+  //
+  // maps_write
+  // A u32 count, then for each map in list order its f64 plane [4], i32
+  //  boundary, u32 polygon count and polygons.
+  //
+  static void maps_write (FILE* file, const MapPlane* maps)
+  {
+    rku32 map_count = 0;
+    for (const MapPlane* m = maps; m != 0; m = m -> next)
+      map_count++;
+    
+    fwrite (&map_count, 4, 1, file);
+    
+    for (const MapPlane*
+      m  = maps;
+      m != 0;
+      m  = m -> next)
+    {
+      const Plane& map_plane = plane_get (m -> plane);
+      
+      double plane [4] = {
+        map_plane.normal.x,
+        map_plane.normal.y,
+        map_plane.normal.z,
+        map_plane.distance
+      };
+      
+      fwrite (plane, 8, 4, file);
+      
+      rki32 boundary = m -> boundary;
+      fwrite (&boundary, 4, 1, file);
+      
+      rku32 poly_count = 0;
+      for (const Polygon* const* p = m -> polys_begin (); p != m -> polys_end (); p++)
+        if (*p) poly_count++;
+      
+      fwrite (&poly_count, 4, 1, file);
+      for (const Polygon* const* p = m -> polys_begin (); p != m -> polys_end (); p++)
+        if (*p) write_polygon (file, *p);
+    }
+  }
+  
+  //
+  // maps_read
+  // Rebuilds Node's maps, in the order they were written.
+  //
+  static bool maps_read (FILE* file, Node* node)
+  {
+    rku32 map_count;
+    if (fread (&map_count, 4, 1, file) != 1)
+      return false;
+    
+    MapPlane* tail = 0;
+    bool ok = true;
+    
+    while (ok && map_count--)
+    {
+      double plane [4];
+      rki32 boundary;
+      rku32 poly_count;
+      
+      if (fread (plane, 8, 4, file) != 4
+       || fread (&boundary, 4, 1, file) != 1
+       || fread (&poly_count, 4, 1, file) != 1)
+      {
+        ok = false;
+        break;
+      }
+      
+      // Append, keeping the order the maps had
+      MapPlane* map = new MapPlane;
+      map -> plane = plane_find (Plane (Vector3 (plane [0], plane [1], plane [2]), plane [3]));
+      map -> boundary = boundary;
+      map -> prev = tail;
+      if (tail)
+        tail -> next = map;
+      else
+        node -> maps = map;
+      tail = map;
+      
+      while (ok && poly_count--)
+      {
+        Polygon* poly = polygon_alloc ();
+        ok = read_polygon (file, poly);
+        map -> add_poly (poly);
+      }
+    }
+    
+    return ok;
+  }
+  
+  //
+  // job_write
+  //
+  static bool job_write (const char* filename, const Node* node, NodeContents potential_contents)
+  {
+    FILE* file = fopen (filename, "wb");
+    if (!file)
+      return false;
+    
+    fwrite ("RKINJOB2", 1, 8, file);
+    fwrite (&potential_contents, 1, 1, file);
+    maps_write (file, node -> maps);
+    
+    bool ok = !ferror (file);
+    if (fclose (file))
+      ok = false;
+    
+    return ok;
+  }
+  
+  //
+  // job_read
+  // Rebuilds the job's node as Root.
+  //
+  static bool job_read (const char* filename, Node* root, NodeContents* potential_contents)
+  {
+    FILE* file = fopen (filename, "rb");
+    if (!file)
+      return false;
+    
+    char magic [8];
+    
+    bool ok = fread (magic, 1, 8, file) == 8
+           && !strncmp (magic, "RKINJOB2", 8)
+           && fread (potential_contents, 1, 1, file) == 1
+           && maps_read (file, root);
+    
+    fclose (file);
+    return ok;
+  }
+  
+  //
+  // subtree_write
+  // A worker's finished tree: "RKINSUB1" and its u32 depth, then the nodes
+  //  in pre-order, front before back. Each is its u64 input hash and its
+  //  contents byte, then for a nonleaf its f64 plane [4], and for a leaf
+  //  its maps, as in a job.
+  //
+  static bool subtree_write (const char* filename, const Node* root, unsigned depth)
+  {
+    FILE* file = fopen (filename, "wb");
+    if (!file)
+      return false;
+    
+    fwrite ("RKINSUB1", 1, 8, file);
+    
+    rku32 depth32 = depth;
+    fwrite (&depth32, 4, 1, file);
+    
+    const Node** stack = new const Node* [depth + 1];
+    const Node** top = stack;
+    *top++ = root;
+    
+    while (top != stack)
+    {
+      const Node* node = *--top;
+      
+      fwrite (&node -> input_hash, 8, 1, file);
+      fwrite (&node -> contents,   1, 1, file);
+      
+      if (node -> is_leaf ())
+      {
+        maps_write (file, node -> maps);
+        continue;
+      }
+      
+      const Plane& partition = plane_get (node -> partition);
+      
+      double plane [4] = {
+        partition.normal.x,
+        partition.normal.y,
+        partition.normal.z,
+        partition.distance
+      };
+      
+      fwrite (plane, 8, 4, file);
+      
+      *top++ = node -> back;
+      *top++ = node -> front;
+    }
+    
+    delete [] stack;
+    
+    bool ok = !ferror (file);
+    if (fclose (file))
+      ok = false;
+    
+    return ok;
+  }
+  
+  //
+  // subtree_free
+  // Frees a subtree read back from a worker that won't be used.
+  //
+  static void subtree_free (Node* root)
+  {
+    ArenaSpan <Node*> stack;
+    stack.push (root);
+    
+    while (!stack.empty ())
+    {
+      Node* node = stack.pop ();
+      
+      if (node -> front) stack.push (node -> front);
+      if (node -> back ) stack.push (node -> back);
+      
+      node_free_maps (node);
+      delete node;
+    }
+  }
+  
+  //
+  // subtree_read
+  // Rebuilds a worker's tree under a new node, its leaves not yet finished;
+  //  see subtree_graft. Sets *Depth to the tree's depth. A tree deeper than
+  //  its header claims is corrupt, and would overrun the stacks sized by it.
+  //
+  static bool subtree_read (const char* filename, Node** root, unsigned* depth)
+  {
+    FILE* file = fopen (filename, "rb");
+    if (!file)
+      return false;
+    
+    char magic [8];
+    rku32 depth32;
+    
+    if (fread (magic, 1, 8, file) != 8
+     || strncmp (magic, "RKINSUB1", 8)
+     || fread (&depth32, 4, 1, file) != 1)
+    {
+      fclose (file);
+      return false;
+    }
+    
+    Node* subtree = new Node;
+    
+    ArenaSpan <Node*> stack;
+    ArenaSpan <unsigned> depths; // Of the nodes on Stack
+    stack.push (subtree);
+    depths.push (0);
+    
+    bool ok = true;
+    
+    while (ok && !stack.empty ())
+    {
+      Node* node = stack.pop ();
+      unsigned node_depth = depths.pop ();
+      
+      if (fread (&node -> input_hash, 8, 1, file) != 1
+       || fread (&node -> contents,   1, 1, file) != 1)
+      {
+        ok = false;
+        break;
+      }
+      
+      if (node -> is_leaf ())
+      {
+        ok = maps_read (file, node);
+        continue;
+      }
+      
+      double plane [4];
+      if (node_depth + 1 > depth32
+       || fread (plane, 8, 4, file) != 4)
+      {
+        ok = false;
+        break;
+      }
+      
+      node -> partition = plane_find (Plane (Vector3 (plane [0], plane [1], plane [2]), plane [3]));
+      node -> front = new Node;
+      node -> back  = new Node;
+      stack.push (node -> back);
+      stack.push (node -> front);
+      depths.push (node_depth + 1);
+      depths.push (node_depth + 1);
+    }
+    
+    fclose (file);
+    
+    if (!ok)
+    {
+      subtree_free (subtree);
+      return false;
+    }
+    
+    *root = subtree;
+    *depth = depth32;
+    return true;
+  }
+  
+  //
+  // subtree_graft
+  // Puts Subtree, read back from a worker, in place of Node, and finishes
+  //  its leaves in the order partitioning would have.
+  //
+  static void subtree_graft (Node* node, Node* subtree, NodeContents potential_contents, Partitioner* part)
+  {
+    node_free_maps (node);
+    
+    node -> input_hash = subtree -> input_hash;
+    node -> contents   = subtree -> contents;
+    node -> partition  = subtree -> partition;
+    node -> maps       = subtree -> maps;
+    node -> front      = subtree -> front;
+    node -> back       = subtree -> back;
+    
+    subtree -> maps  = 0;
+    subtree -> front = 0;
+    subtree -> back  = 0;
+    delete subtree;
+    
+    ArenaSpan <PartitionTask> stack;
+    PartitionTask root_task = { node, potential_contents, 0, 0 };
+    stack.push (root_task);
+    
+    while (!stack.empty ())
+    {
+      PartitionTask task = stack.pop ();
+      
+      if (task.node -> is_leaf ())
+      {
+        finish_leaf (task.node, task.potential_contents, part);
+        continue;
+      }
+      
+      PartitionTask back_task  = { task.node -> back,  contents_solid, 0, 0 };
+      PartitionTask front_task = { task.node -> front, contents_empty, 0, 0 };
+      stack.push (back_task);
+      stack.push (front_task);
+    }
+  }
+  
+  //
+  // compile_export_jobs
+  // Runs Context up to partitioning, then partitions the top Split_depth
+  //  levels, holding back each node below them as a job for a worker. Job
+  //  files are named by Job_format and the job's index. Returns the number
+  //  of jobs; with none, or if they couldn't all be written, the compile
+  //  partitions everything itself.
+  //
+  unsigned compile_export_jobs (CompileContext* context, unsigned split_depth, const char* job_format)
+  {
+    assert (context);
+    assert (job_format);
+    
+    while (context -> stage < compile_stage_partition)
+    {
+      if (compile_step (context, compile_unbounded) != compile_running)
+        return 0;
+    }
+    
+    if (context -> stage != compile_stage_partition)
+      return 0;
+    
+    PartitionRun* run = &context -> run;
+    run -> split_depth = split_depth;
+    partition_run_step (run, &context -> part, 0.0);
+    run -> split_depth = ~0u;
+    
+    unsigned job_count = run -> held.size ();
+    bool ok = true;
+    
+    for (unsigned i = 0; ok && i != job_count; i++)
+    {
+      const PartitionTask& task = run -> held.begin () [i];
+      
+      char filename [512];
+      sprintf (filename, job_format, i);
+      ok = job_write (filename, task.node, task.potential_contents);
+    }
+    
+    if (!ok)
+    {
+      compile_import_jobs (context, 0);
+      return 0;
+    }
+    
+    return job_count;
+  }
+  
+  //
+  // compile_import_jobs
+  // Grafts each job's subtree, from the file Subtree_format names, in place
+  //  of its node. Jobs without one, as when a worker failed, are left to
+  //  the compile to partition; with no Subtree_format, all are. Returns the
+  //  number grafted. compile_step then carries on from there.
+  //
+  unsigned compile_import_jobs (CompileContext* context, const char* subtree_format)
+  {
+    assert (context);
+    
+    if (context -> stage != compile_stage_partition)
+      return 0;
+    
+    PartitionRun* run = &context -> run;
+    ArenaSpan <PartitionTask> local;
+    unsigned grafted = 0;
+    
+    for (unsigned i = 0; i != run -> held.size (); i++)
+    {
+      const PartitionTask& task = run -> held.begin () [i];
+      
+      char filename [512];
+      Node* subtree = 0;
+      unsigned depth = 0;
+      
+      if (subtree_format)
+        sprintf (filename, subtree_format, i);
+      
+      if (!subtree_format || !subtree_read (filename, &subtree, &depth))
+      {
+        local.push (task);
+        continue;
+      }
+      
+      subtree_graft (task.node, subtree, task.potential_contents, &context -> part);
+      grafted++;
+      
+      if (task.depth + depth > run -> depth)
+        run -> depth = task.depth + depth;
+    }
+    
+    // Backwards, so they come off the stack in order
+    while (!local.empty ())
+      run -> stack.push (local.pop ());
+    
+    run -> held.release ();
+    return grafted;
+  }
+  
+  //
+  // world_run_job
+  // Worker side: partitions one job and writes the subtree it makes.
+  //
+  bool world_run_job (const char* job_file, const char* subtree_file)
+  {
+    assert (job_file);
+    assert (subtree_file);
+    
+    World* world = world_alloc ();
+    
+    NodeContents potential_contents;
+    if (!job_read (job_file, &world -> root, &potential_contents))
+    {
+      world_free (world);
+      return false;
+    }
+    
+    PartitionCache no_cache;
+    Partitioner part = { &no_cache, world -> leaf_count, 0, 0, 0, 0, 0, 0.0, dummy_status };
+    
+    PartitionRun run;
+    PartitionTask root_task = { &world -> root, potential_contents, 0, 0 };
+    run.stack.push (root_task);
+    run.depth = 0;
+    run.split_depth = ~0u;
+    
+    partition_run_step (&run, &part, 0.0);
+    world -> depth = run.depth;
+    
+    bool ok = subtree_write (subtree_file, &world -> root, world -> depth);
+    
+    world_free (world);
+    return ok;
+  }
+  
+}
+// namespace In
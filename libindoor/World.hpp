@@ -1,37 +1,152 @@
-//
-// Copyright (C) 2009 Roadkill Software
-//
-// This program is free software; you can redistribute it and/or
-// modify it under the terms of the GNU General Public License
-// as published by the Free Software Foundation; either version 2
-// of the License, or (at your option) any later version.
-//
-// This program is distributed in the hope that it will be useful,
-// but WITHOUT ANY WARRANTY; without even the implied warranty of
-// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
-//
-// See the GNU General Public License for more details.
-//
-// You should have received a copy of the GNU General Public License
-// along with this program; if not, write to the Free Software
-// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
-//
-
-#ifndef INDOOR_H_WORLD
-#define INDOOR_H_WORLD
-
-#include "Polygon.hpp"
-
-namespace In
-{
-  struct Node;
-  struct World;
-  
-  World* world_compile (Polygon* polys, unsigned count, void (*status) (const char*) = 0);
-  void   world_free    (World* world);
-  
-  bool world_save (World* world, const char* filename);
-  
-}
-
-#endif
+//
+// Copyright (C) 2009 Roadkill Software
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+//
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+
+#ifndef INDOOR_H_WORLD
+#define INDOOR_H_WORLD
+
+#include "Polygon.hpp"
+
+namespace In
+{
+  //
+  // indoor_compiler_version
+  // Bump whenever compiled output changes for the same input.
+  //
+# define indoor_compiler_version 10
+  
+  struct Node;
+  struct World;
+  
+  //
+  // CompileOptions
+  //
+  struct CompileOptions
+  {
+    void (*status) (const char*);
+    unsigned detail_count;       // The last this many polygons are detail
+    const World* previous;       // Reuse subtrees from an earlier compile
+    const char* stream;          // Stream leaf geometry straight to this file
+    const Vector3* entities;     // Leaves none of these reach are made solid;
+    unsigned entity_count;       //  without them, the origin is just leak-checked
+    bool clean;                  // Run clean_polygons on the input first
+    double snap_grid;            //  snapping to this, unless it's 0
+    unsigned threads;            // For building portals; 0 for one per processor
+    unsigned cluster_leaves;     // Most empty leaves drawn as one batch
+    double quantize_error;       // Store leaf vertices in 16 bits where they
+                                 //  move no further than this; 0 for never
+    
+    CompileOptions () :
+      status (0), detail_count (0), previous (0), stream (0), entities (0), entity_count (0),
+      clean (false), snap_grid (0.0), threads (0), cluster_leaves (8),
+      quantize_error (0.0)
+    {}
+    
+  };
+  
+  //
+  // world_compile
+  // Detail polygons, the last CompileOptions::detail_count of Polys, are
+  //  drawn but never partition, so they can't open a leak or a leaf.
+  // A World, like the CompileContext it comes from, belongs to the thread
+  //  that compiled it: its planes, polygons and portals live in that
+  //  thread's pools; see Arena.hpp and Planes.hpp. Step, save, free it and
+  //  pass it as CompileOptions::previous on that thread only. world_stats
+  //  alone may be called from anywhere.
+  //
+  World* world_compile (const Polygon* polys, unsigned count, const CompileOptions& options = CompileOptions ());
+  
+  //
+  // Resumable compiles
+  // compile_step does a slice of the work at a time, so a compile can run
+  //  between an editor's frames. world_compile is these run to completion.
+  //
+  struct CompileContext;
+  
+  typedef int CompileState;
+# define compile_running   0
+# define compile_done      1
+# define compile_cancelled 2
+# define compile_failed    3
+  
+# define compile_unbounded (~0u)
+  
+  //
+  // Compile stages
+  // What CompileProgress::stage reports, in the order they run. Those from
+  //  clean to cluster, but for the quick verify and check, may each take
+  //  many steps.
+  //
+# define compile_stage_begin     0  // Nothing done yet
+# define compile_stage_clean     1  // clean_polygons, with CompileOptions::clean
+# define compile_stage_map       2  // Gathering the input by plane
+# define compile_stage_boundary  3  // Finding the hull
+# define compile_stage_partition 4
+# define compile_stage_detail    5  // Clipping detail into the leaves
+# define compile_stage_stream    6  // Writing leaves that waited for detail
+# define compile_stage_portals   7
+# define compile_stage_verify    8
+# define compile_stage_flood     9  // From the entities, looking for leaks
+# define compile_stage_fill      10 // Filling the outside
+# define compile_stage_check     11 // Removing unreachable leaves
+# define compile_stage_cluster   12
+# define compile_stage_done      13
+# define compile_stage_cancelled 14
+# define compile_stage_failed    15
+  
+  struct CompileProgress
+  {
+    int stage;        // One of the compile stages above
+    unsigned depth;   // Of the tree so far
+    unsigned leaves;  // Finished so far
+    unsigned pending; // Nodes waiting to be partitioned
+    
+  };
+  
+  CompileContext* compile_begin    (const Polygon* polys, unsigned count, const CompileOptions& options = CompileOptions ());
+  CompileState    compile_step     (CompileContext* context, unsigned budget_ms);
+  void            compile_progress (const CompileContext* context, CompileProgress* progress);
+  void            compile_cancel   (CompileContext* context);
+  World*          compile_end      (CompileContext* context);
+  void   world_free    (World* world);
+  
+  struct WorldStats
+  {
+    unsigned leaves;
+    unsigned depth;
+    unsigned plane_misses; // Leaf vertices rounding has pushed off their plane
+    unsigned clusters;     // Batches the empty leaves are drawn in
+    unsigned quantized;    // Leaves with 16-bit vertices
+    unsigned long triangle_bytes; // Of leaf triangles in the output,
+    unsigned long float_bytes;    //  and as they would be all floats
+    
+  };
+  
+  void world_stats (const World* world, WorldStats* stats);
+  
+  bool world_save     (World* world, const char* filename);
+  bool world_compress (const char* filename);
+  
+  // Distributed compiles; see Distribute.hpp
+  unsigned compile_export_jobs (CompileContext* context, unsigned split_depth, const char* job_format);
+  unsigned compile_import_jobs (CompileContext* context, const char* subtree_format);
+  bool     world_run_job       (const char* job_file, const char* subtree_file);
+  
+}
+
+#endif